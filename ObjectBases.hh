@@ -21,8 +21,10 @@
 #define OBJECTBASES_HH
 
 #include "osmtypes.h"
+#include "stringtable.hh"
 
 #include <map>
+#include <vector>
 #include <string>
 #include <iostream>
 #include <iomanip>
@@ -75,6 +77,10 @@ public:
 		return id_;
 	}
 
+	void SetId(osmid_t id) {
+		id_ = id;
+	}
+
 	void SetModify() {
 		action_ = MODIFY;
 	}
@@ -193,87 +199,168 @@ public:
 	}
 };
 
+/**
+ * Tags of an object, stored as flat array of interned key/value ids
+ *
+ * Methods taking strings look them up in global StringTable, so
+ * code checking tags often should rather intern keys and values
+ * once and use id-based methods, which only compare integers.
+ */
 class TagContainer {
 public:
 	typedef std::map<std::string, std::string> TagMap;
 
+	struct Tag {
+		strid_t key;
+		strid_t value;
+
+		Tag(strid_t k, strid_t v) : key(k), value(v) {
+		}
+	};
+
+private:
+	typedef std::vector<Tag> TagVector;
+
 private:
-	TagMap tags_;
+	TagVector tags_;
+
+private:
+	static StringTable& Strings() {
+		return StringTable::Instance();
+	}
+
+	Tag* FindTag(strid_t key) {
+		for (TagVector::iterator tag = tags_.begin(); tag != tags_.end(); ++tag)
+			if (tag->key == key)
+				return &*tag;
+		return NULL;
+	}
+
+	const Tag* FindTag(strid_t key) const {
+		for (TagVector::const_iterator tag = tags_.begin(); tag != tags_.end(); ++tag)
+			if (tag->key == key)
+				return &*tag;
+		return NULL;
+	}
 
 public:
 	TagContainer() {
 	}
 
+	/* id-based interface */
+
+	bool AddTag(strid_t key, strid_t value) {
+		if (FindTag(key) != NULL)
+			return false;
+		tags_.push_back(Tag(key, value));
+		return true;
+	}
+
+	/* returns id of tag value, or 0 if there's no such tag */
+	strid_t GetTagId(strid_t key) const {
+		const Tag* tag = FindTag(key);
+		return tag ? tag->value : 0;
+	}
+
+	bool HasTag(strid_t key) const {
+		return FindTag(key) != NULL;
+	}
+
+	bool IsTag(strid_t key, strid_t value) const {
+		const Tag* tag = FindTag(key);
+		return tag != NULL && tag->value == value;
+	}
+
+	const Tag& TagAt(int pos) const {
+		return tags_[pos];
+	}
+
+	/* string-based interface */
+
+	bool AddTag(const char* key, const char* value) {
+		return AddTag(Strings().Intern(key), Strings().Intern(value));
+	}
+
 	bool AddTag(const std::string& key, const std::string& value) {
-		std::pair<TagMap::iterator, bool> res = tags_.insert(std::make_pair(key, value));
-		return res.second;
+		return AddTag(Strings().Intern(key), Strings().Intern(value));
 	}
 
 	bool ChangeTag(const std::string& key, const std::string& value) {
-		std::pair<TagMap::iterator, bool> res = tags_.insert(std::make_pair(key, value));
-		if (!res.second)
+		Tag* tag = FindTag(Strings().Find(key));
+		if (tag == NULL)
 			return false;
-		res.first->second = value;
+		tag->value = Strings().Intern(value);
 		return true;
 	}
 
 	bool SetTag(const std::string& key, const std::string& value) {
-		std::pair<TagMap::iterator, bool> res = tags_.insert(std::make_pair(key, value));
-		if (!res.second)
-			res.first->second = value;
-		return res.second;
+		strid_t key_id = Strings().Intern(key);
+		Tag* tag = FindTag(key_id);
+		if (tag != NULL) {
+			tag->value = Strings().Intern(value);
+			return false;
+		}
+		tags_.push_back(Tag(key_id, Strings().Intern(value)));
+		return true;
 	}
 
 	bool GetTag(const std::string& key, std::string& value) const {
-		TagMap::const_iterator i = tags_.find(key);
-		if (i == tags_.end())
+		const Tag* tag = FindTag(Strings().Find(key));
+		if (tag == NULL)
 			return false;
-		value = i->second;
+		value = Strings().Get(tag->value);
 		return true;
 	}
 
 	std::string GetTag(const std::string& key) const {
-		TagMap::const_iterator i = tags_.find(key);
-		if (i == tags_.end())
+		const Tag* tag = FindTag(Strings().Find(key));
+		if (tag == NULL)
 			return "";
-		return i->second;
+		return Strings().Get(tag->value);
 	}
 
 	std::string GetKeyAt(int pos) const {
-		int n = 0;
-		for (TagMap::const_iterator i = tags_.begin(); i != tags_.end(); ++i, ++n)
-			if (n == pos)
-				return i->first;
-
-		return "";
+		if (pos < 0 || pos >= (int)tags_.size())
+			return "";
+		return Strings().Get(tags_[pos].key);
 	}
 
 	std::string GetValAt(int pos) const {
-		int n = 0;
-		for (TagMap::const_iterator i = tags_.begin(); i != tags_.end(); ++i, ++n)
-			if (n == pos)
-				return i->second;
-
-		return "";
+		if (pos < 0 || pos >= (int)tags_.size())
+			return "";
+		return Strings().Get(tags_[pos].value);
 	}
 
 	bool RemoveTag(const std::string& key) {
-		return tags_.erase(key);
+		strid_t key_id = Strings().Find(key);
+		for (TagVector::iterator tag = tags_.begin(); tag != tags_.end(); ++tag) {
+			if (tag->key == key_id) {
+				tags_.erase(tag);
+				return true;
+			}
+		}
+		return false;
 	}
 
 	bool HasTag(const std::string& key) const {
-		return tags_.find(key) != tags_.end();
+		return FindTag(Strings().Find(key)) != NULL;
 	}
 
 	bool HasTags() const {
 		return !tags_.empty();
 	}
 
+	void ClearTags() {
+		tags_.clear();
+	}
+
+	void ReserveTags(int count) {
+		tags_.reserve(count);
+	}
+
 	bool IsTag(const std::string& key, const std::string& value) const {
-		TagMap::const_iterator it = tags_.find(key);
-		if (it == tags_.end())
-			return false;
-		return it->second == value;
+		const Tag* tag = FindTag(Strings().Find(key));
+		return tag != NULL && tag->value == Strings().Find(value);
 	}
 
 	int GetTagsCount() const {
@@ -281,12 +368,15 @@ public:
 	}
 
 	void Dump(std::ostream& stream = std::cout) const {
-		for (TagMap::const_iterator tag = tags_.begin(); tag != tags_.end(); ++tag)
-			stream << "    <tag k=\"" << XMLEncodeAttr(tag->first) << "\" v=\"" << XMLEncodeAttr(tag->second) << "\"/>" << std::endl;
+		for (TagVector::const_iterator tag = tags_.begin(); tag != tags_.end(); ++tag)
+			stream << "    <tag k=\"" << XMLEncodeAttr(Strings().Get(tag->key)) << "\" v=\"" << XMLEncodeAttr(Strings().Get(tag->value)) << "\"/>" << std::endl;
 	}
 
-	const TagMap& GetTagMap() const {
-		return tags_;
+	TagMap GetTagMap() const {
+		TagMap tags;
+		for (TagVector::const_iterator tag = tags_.begin(); tag != tags_.end(); ++tag)
+			tags.insert(std::make_pair(Strings().Get(tag->key), Strings().Get(tag->value)));
+		return tags;
 	}
 };
 
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OBJECTBUFFER_HH
+#define OBJECTBUFFER_HH
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstring>
+
+#include "ObjectViews.hh"
+
+/**
+ * Sequence of OSM objects of mixed types, in the order they were read
+ *
+ * Objects are stored flat: fixed size entries plus shared arrays of
+ * node refs, members and tags, which are accessed through views.
+ * Strings are either copied into buffer's own arena, or reference
+ * storage owned by the buffer, such as unpacked PBF block. Clear()
+ * keeps memory allocated for objects, so a buffer is reused for
+ * subsequent objects without allocations.
+ *
+ * Used to hand objects decoded by worker threads over to the thread
+ * which runs pass callbacks.
+ */
+class ObjectBuffer {
+private:
+	struct Entry {
+		TagType type;
+		osmid_t id;
+		osmint_t lon;
+		osmint_t lat;
+
+		/* node refs for ways, members for relations */
+		size_t first_item;
+		size_t nitems;
+
+		size_t first_tag;
+		size_t ntags;
+
+		Entry(TagType t, osmid_t i, osmint_t ln, osmint_t lt, size_t item, size_t tag)
+			: type(t), id(i), lon(ln), lat(lt), first_item(item), nitems(0), first_tag(tag), ntags(0) {
+		}
+	};
+
+	typedef std::vector<Entry> EntryVector;
+	typedef std::vector<osmid_t> RefVector;
+	typedef std::vector<MemberView> MemberVector;
+	typedef std::vector<TagView> TagVector;
+	typedef std::deque<std::vector<char> > ArenaChunks;
+	typedef std::deque<std::string> StorageDeque;
+
+private:
+	EntryVector entries_;
+	RefVector refs_;
+	MemberVector members_;
+	TagVector tags_;
+
+	/* arena for copied strings; deques never move existing chunks */
+	ArenaChunks arena_;
+	size_t arena_chunk_;
+	size_t arena_used_;
+
+	/* storage for data views may reference; it holds whole
+	 * unpacked blocks, so unlike the rest it's freed on Clear() */
+	StorageDeque storage_;
+
+private:
+	ObjectBuffer(const ObjectBuffer&);
+	ObjectBuffer& operator=(const ObjectBuffer&);
+
+public:
+	ObjectBuffer() : arena_chunk_(0), arena_used_(0) {
+	}
+
+	void AddNode(osmid_t id, osmint_t lat, osmint_t lon) {
+		entries_.push_back(Entry(NODE, id, lon, lat, 0, tags_.size()));
+	}
+
+	void AddWay(osmid_t id) {
+		entries_.push_back(Entry(WAY, id, 0, 0, refs_.size(), tags_.size()));
+	}
+
+	void AddRelation(osmid_t id) {
+		entries_.push_back(Entry(RELATION, id, 0, 0, members_.size(), tags_.size()));
+	}
+
+	/* adds node reference to last added way */
+	void AddRef(osmid_t ref) {
+		refs_.push_back(ref);
+		entries_.back().nitems++;
+	}
+
+	/* adds member to last added relation; role must be owned by buffer */
+	void AddMember(Relation::MemberType type, osmid_t id, const StrView& role) {
+		members_.push_back(MemberView(type, id, role));
+		entries_.back().nitems++;
+	}
+
+	/* adds tag to last added object; strings must be owned by buffer */
+	void AddTag(const StrView& key, const StrView& value) {
+		tags_.push_back(TagView(key, value));
+		entries_.back().ntags++;
+	}
+
+	/* copies string into buffer's arena */
+	StrView Copy(const char* data, size_t size) {
+		const size_t chunk_size = 64 * 1024;
+
+		if (size == 0)
+			return StrView();
+
+		while (arena_chunk_ < arena_.size() && arena_used_ + size > arena_[arena_chunk_].size()) {
+			arena_chunk_++;
+			arena_used_ = 0;
+		}
+
+		if (arena_chunk_ == arena_.size()) {
+			arena_.push_back(std::vector<char>(size > chunk_size ? size : chunk_size));
+			arena_used_ = 0;
+		}
+
+		char* dst = &arena_[arena_chunk_][arena_used_];
+		memcpy(dst, data, size);
+		arena_used_ += size;
+		return StrView(dst, size);
+	}
+
+	/**
+	 * Returns string which stays in place until Clear()
+	 *
+	 * Decoder may place its input here and then add views of it
+	 * without copying.
+	 */
+	std::string& AddStorage() {
+		storage_.push_back(std::string());
+		return storage_.back();
+	}
+
+	size_t size() const {
+		return entries_.size();
+	}
+
+	bool empty() const {
+		return entries_.empty();
+	}
+
+	TagType TypeAt(size_t pos) const {
+		return entries_[pos].type;
+	}
+
+	/* views are valid until buffer is modified */
+	NodeView NodeAt(size_t pos) const {
+		const Entry& entry = entries_[pos];
+		return NodeView(entry.id, entry.lon, entry.lat, TagsView(tags_.data() + entry.first_tag, entry.ntags));
+	}
+
+	WayView WayAt(size_t pos) const {
+		const Entry& entry = entries_[pos];
+		return WayView(entry.id, refs_.data() + entry.first_item, entry.nitems, TagsView(tags_.data() + entry.first_tag, entry.ntags));
+	}
+
+	RelationView RelationAt(size_t pos) const {
+		const Entry& entry = entries_[pos];
+		return RelationView(entry.id, members_.data() + entry.first_item, entry.nitems, TagsView(tags_.data() + entry.first_tag, entry.ntags));
+	}
+
+	void Clear() {
+		entries_.clear();
+		refs_.clear();
+		members_.clear();
+		tags_.clear();
+		arena_chunk_ = 0;
+		arena_used_ = 0;
+		storage_.clear();
+	}
+};
+
+#endif
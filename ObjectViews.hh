@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OBJECTVIEWS_HH
+#define OBJECTVIEWS_HH
+
+#include <string>
+#include <cstring>
+
+#include "Objects.hh"
+
+/**
+ * Non-owning reference to a string which is not necessarily
+ * 0-terminated
+ */
+class StrView {
+private:
+	const char* data_;
+	size_t size_;
+
+public:
+	StrView() : data_(""), size_(0) {
+	}
+
+	StrView(const char* data, size_t size) : data_(data), size_(size) {
+	}
+
+	const char* data() const {
+		return data_;
+	}
+
+	size_t size() const {
+		return size_;
+	}
+
+	bool operator==(const char* str) const {
+		return strlen(str) == size_ && memcmp(data_, str, size_) == 0;
+	}
+
+	bool operator!=(const char* str) const {
+		return !(*this == str);
+	}
+
+	std::string str() const {
+		return std::string(data_, size_);
+	}
+
+	strid_t Intern() const {
+		return StringTable::Instance().Intern(data_, size_);
+	}
+};
+
+struct TagView {
+	StrView key;
+	StrView value;
+
+	TagView(const StrView& k, const StrView& v) : key(k), value(v) {
+	}
+};
+
+/**
+ * Tags of an object being parsed
+ *
+ * Like the rest of views, only valid for the duration of the
+ * callback it was passed to.
+ */
+class TagsView {
+private:
+	const TagView* tags_;
+	size_t size_;
+
+public:
+	TagsView(const TagView* tags, size_t size) : tags_(tags), size_(size) {
+	}
+
+	size_t size() const {
+		return size_;
+	}
+
+	const TagView& operator[](size_t pos) const {
+		return tags_[pos];
+	}
+
+	/* returns value of given tag, or NULL if there's no such tag */
+	const StrView* Find(const char* key) const {
+		for (size_t i = 0; i < size_; ++i)
+			if (tags_[i].key == key)
+				return &tags_[i].value;
+		return NULL;
+	}
+
+	bool Has(const char* key) const {
+		return Find(key) != NULL;
+	}
+
+	bool Is(const char* key, const char* value) const {
+		const StrView* found = Find(key);
+		return found != NULL && *found == value;
+	}
+
+	/* interns tags into persistent container */
+	void CopyTo(TagContainer& tags) const {
+		tags.ReserveTags(tags.GetTagsCount() + size_);
+		for (size_t i = 0; i < size_; ++i)
+			tags.AddTag(tags_[i].key.Intern(), tags_[i].value.Intern());
+	}
+};
+
+struct NodeView {
+	osmid_t id;
+	osmint_t lon;
+	osmint_t lat;
+	TagsView tags;
+
+	NodeView(osmid_t i, osmint_t ln, osmint_t lt, const TagsView& t) : id(i), lon(ln), lat(lt), tags(t) {
+	}
+
+	LonLat GetLonLat() const {
+		return LonLat(lon, lat);
+	}
+};
+
+struct WayView {
+	osmid_t id;
+	const osmid_t* refs;
+	size_t nrefs;
+	TagsView tags;
+
+	WayView(osmid_t i, const osmid_t* r, size_t n, const TagsView& t) : id(i), refs(r), nrefs(n), tags(t) {
+	}
+};
+
+struct MemberView {
+	Relation::MemberType type;
+	osmid_t id;
+	StrView role;
+
+	MemberView(Relation::MemberType t, osmid_t i, const StrView& r) : type(t), id(i), role(r) {
+	}
+};
+
+struct RelationView {
+	osmid_t id;
+	const MemberView* members;
+	size_t nmembers;
+	TagsView tags;
+
+	RelationView(osmid_t i, const MemberView* m, size_t n, const TagsView& t) : id(i), members(m), nmembers(n), tags(t) {
+	}
+};
+
+#endif
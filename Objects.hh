@@ -63,6 +63,10 @@ public:
 		nodes_.clear();
 	}
 
+	void ReserveNodes(int count) {
+		nodes_.reserve(count);
+	}
+
 	int RemoveNode(osmid_t id) {
 		NodeVector temp;
 		temp.reserve(nodes_.size());
@@ -25,19 +25,18 @@
 #include <unistd.h>
 
 #include <vector>
-#include <memory>
 #include <stdexcept>
 #include <sstream>
 #include <cstdlib>
 #include <cstring>
 
 #include "Objects.hh"
-
-class ParsingException : public std::runtime_error {
-public:
-	ParsingException(const std::string& what) : std::runtime_error(what) {
-	}
-};
+#include "ObjectBuffer.hh"
+#include "ParsingException.hh"
+#include "PbfReader.hh"
+#include "TagFilter.hh"
+#include "parallel.hh"
+#include "mappedfile.hh"
 
 template<int I>
 static int ParseInt(const char* str) {
@@ -75,35 +74,79 @@ static int ParseInt(const char* str) {
 
 template <class Parser>
 class ParserBase {
+public:
+	enum InputMode {
+		/* read input with read(2) through intermediate buffer */
+		READ_INPUT,
+		/* mmap(2) input file, falling back to read(2) for stdin and
+		 * other non-mappable inputs */
+		MMAP_INPUT,
+	};
+
 protected:
 	typedef void(Parser::*ProcessNodeFn)(Node& node);
 	typedef void(Parser::*ProcessWayFn)(Way& way);
 	typedef void(Parser::*ProcessRelationFn)(Relation& relation);
 	typedef void(Parser::*SimplePassFn)();
+	typedef bool(Parser::*ObjectFilterFn)(TagType type, osmid_t id) const;
+
+	/* view callbacks; views are only valid during the call */
+	typedef void(Parser::*ProcessNodeViewFn)(const NodeView& node);
+	typedef void(Parser::*ProcessWayViewFn)(const WayView& way);
+	typedef void(Parser::*ProcessRelationViewFn)(const RelationView& relation);
 
 private:
 	struct Pass {
 		ProcessNodeFn node;
 		ProcessWayFn way;
 		ProcessRelationFn relation;
+		ProcessNodeViewFn node_view;
+		ProcessWayViewFn way_view;
+		ProcessRelationViewFn relation_view;
 		SimplePassFn pass;
+		ObjectFilterFn filter;
 		bool dumps_data;
 		std::string name;
 
-		Pass(ProcessNodeFn n, ProcessWayFn w, ProcessRelationFn r, SimplePassFn p, bool d, const std::string& nm) : node(n), way(w), relation(r), pass(p), dumps_data(d), name(nm) {
+		Pass(ProcessNodeFn n, ProcessWayFn w, ProcessRelationFn r, SimplePassFn p, bool d, const std::string& nm) : node(n), way(w), relation(r), node_view(NULL), way_view(NULL), relation_view(NULL), pass(p), filter(NULL), dumps_data(d), name(nm) {
+		}
+
+		Pass(ProcessNodeViewFn n, ProcessWayViewFn w, ProcessRelationViewFn r, SimplePassFn p, bool d, const std::string& nm) : node(NULL), way(NULL), relation(NULL), node_view(n), way_view(w), relation_view(r), pass(p), filter(NULL), dumps_data(d), name(nm) {
+		}
+
+		bool WantsNodes() const {
+			return node || node_view;
+		}
+
+		bool WantsWays() const {
+			return way || way_view;
+		}
+
+		bool WantsRelations() const {
+			return relation || relation_view;
 		}
 	};
 
 	struct State {
 		TagType type;
-		std::auto_ptr<Node> node;
-		std::auto_ptr<Way> way;
-		std::auto_ptr<Relation> relation;
+
+		/* whether current object is being collected */
+		bool collecting;
 
 		const Pass& pass;
-		Parser& parser;
+		ParserBase& parser;
+		const TagFilter& tags;
+
+		/* objects are collected here; unless buffer is external,
+		 * each object is passed to callbacks as soon as it ends */
+		ObjectBuffer& buffer;
+		bool external_buffer;
 
-		State(const Pass& p, Parser& r) : pass(p), parser(r) {
+		State(const Pass& p, ParserBase& r, const TagFilter& t, ObjectBuffer& b, bool e) : type(NOTAG), collecting(false), pass(p), parser(r), tags(t), buffer(b), external_buffer(e) {
+		}
+
+		bool WantsObject(TagType type, osmid_t id) const {
+			return pass.filter == NULL || (static_cast<Parser&>(parser).*(pass.filter))(type, id);
 		}
 	};
 
@@ -114,6 +157,19 @@ private:
 
 	bool dump_opened_;
 
+	int nthreads_;
+
+	bool parallel_xml_;
+
+	InputMode input_mode_;
+
+	TagFilter tag_filter_;
+
+	/* objects passed to non-view callbacks, reused between calls */
+	Node node_;
+	Way way_;
+	Relation relation_;
+
 private:
 	void DumpOpen() {
 		std::cout << "<?xml version='1.0' encoding='UTF-8'?>" << std::endl;
@@ -128,19 +184,58 @@ private:
 
 	void DoPass(const Pass& pass, const char* filename) {
 		int f = 0;
-		XML_Parser parser = NULL;
 
 		/* if filename = "-", work with stdin */
 		if (strcmp(filename, "-") != 0 && (f = open(filename, O_RDONLY)) == -1)
 			throw std::runtime_error("cannot open input file");
 
-		/* Create and setup parser */
-		if ((parser = XML_ParserCreate(NULL)) == NULL) {
+		try {
+			MappedFile mapping;
+			if (input_mode_ == MMAP_INPUT && f != 0 && mapping.Map(f, MADV_SEQUENTIAL)) {
+				/* whole input is available in memory */
+				if (PbfReader::Detect(mapping.data(), mapping.size())) {
+					PbfReader reader(mapping.data(), mapping.size());
+					DoPbfPass(pass, reader);
+				} else if (parallel_xml_ && nthreads_ > 1 && IsPlainXml(mapping.data(), mapping.size())) {
+					DoParallelXmlPass(pass, mapping.data(), mapping.size());
+				} else {
+					DoXmlPass(pass, -1, mapping.data(), mapping.size());
+				}
+			} else {
+				/* read first block to detect input format */
+				char buf[65536];
+				ssize_t len = 0, got;
+				do {
+					if ((got = read(f, buf + len, sizeof(buf) - len)) < 0)
+						throw std::runtime_error("input read error");
+					len += got;
+				} while (got != 0 && len < (ssize_t)sizeof(buf));
+
+				if (PbfReader::Detect(buf, len)) {
+					PbfReader reader(f, buf, len);
+					DoPbfPass(pass, reader);
+				} else {
+					DoXmlPass(pass, f, buf, len);
+				}
+			}
+		} catch (...) {
 			close(f);
-			throw std::runtime_error("cannot create XML parser");
+			throw;
 		}
 
-		State state(pass, *static_cast<Parser*>(this));
+		close(f);
+	}
+
+	/* parses prefix, then rest of input from f, unless f is -1 */
+	void DoXmlPass(const Pass& pass, int f, const char* prefix, size_t prefix_len) {
+		XML_Parser parser = NULL;
+
+		/* Create and setup parser */
+		if ((parser = XML_ParserCreate(NULL)) == NULL)
+			throw std::runtime_error("cannot create XML parser");
+
+		ObjectBuffer buffer;
+		State state(pass, *this, tag_filter_, buffer, false);
 
 		XML_SetElementHandler(parser, StartElement, EndElement);
 
@@ -148,28 +243,289 @@ private:
 
 		/* Parse file */
 		try {
-			char buf[65536];
-			ssize_t len;
+			/* prefix may be whole mmap()ed file, so pass it in large
+			 * slices, as expat takes int length */
+			const size_t slice = 64*1024*1024;
 			do {
+				size_t len = std::min(prefix_len, slice);
+				if (XML_Parse(parser, prefix, len, f == -1 && len == prefix_len) == XML_STATUS_ERROR)
+					throw ParsingException(XML_ErrorString(XML_GetErrorCode(parser)));
+				prefix += len;
+				prefix_len -= len;
+			} while (prefix_len > 0);
+
+			char buf[65536];
+			ssize_t len = f != -1;
+			while (len != 0) {
 				if ((len = read(f, buf, sizeof(buf))) < 0)
 					throw std::runtime_error("input read error");
 				if (XML_Parse(parser, buf, len, len == 0) == XML_STATUS_ERROR)
 					throw ParsingException(XML_ErrorString(XML_GetErrorCode(parser)));
-			} while (len != 0);
+			}
 		} catch (ParsingException &e) {
 			std::stringstream ss;
 			ss << "error parsing input: " << e.what() << " at line " << XML_GetCurrentLineNumber(parser) << " pos " << XML_GetCurrentColumnNumber(parser);
-			close(f);
 			XML_ParserFree(parser);
 			throw ParsingException(ss.str());;
 		} catch (...) {
-			close(f);
 			XML_ParserFree(parser);
 			throw;
 		}
 
 		XML_ParserFree(parser);
-		close(f);
+	}
+
+	/* checks that XML has no markup chunk splitter doesn't handle:
+	 * comments, CDATA sections, DOCTYPE and processing instructions
+	 * past XML declaration */
+	static bool IsPlainXml(const char* data, size_t size) {
+		if (memmem(data, size, "<!", 2) != NULL)
+			return false;
+
+		const char* pi = static_cast<const char*>(memmem(data, size, "<?", 2));
+		if (pi != NULL && pi == data && size >= 5 && memcmp(data, "<?xml", 5) == 0)
+			pi = static_cast<const char*>(memmem(data + 2, size - 2, "<?", 2));
+
+		return pi == NULL;
+	}
+
+	/* finds start of next node, way or relation element at or after pos */
+	static size_t FindElementStart(const char* data, size_t size, size_t pos) {
+		static const char* const elements[] = { "node", "way", "relation" };
+
+		while (pos < size) {
+			const char* lt = static_cast<const char*>(memchr(data + pos, '<', size - pos));
+			if (lt == NULL)
+				return size;
+			pos = lt - data;
+
+			for (size_t i = 0; i < sizeof(elements)/sizeof(elements[0]); ++i) {
+				size_t len = strlen(elements[i]);
+				if (size - pos > len + 1 && memcmp(data + pos + 1, elements[i], len) == 0) {
+					char next = data[pos + 1 + len];
+					if (next == ' ' || next == '\t' || next == '\n' || next == '\r' || next == '/' || next == '>')
+						return pos;
+				}
+			}
+
+			pos++;
+		}
+
+		return size;
+	}
+
+	/* parses single chunk [begin, end) of data, wrapped into root element */
+	void ParseXmlChunk(const Pass& pass, const char* data, size_t begin, size_t end, ObjectBuffer& buffer) {
+		static const char head[] = "<osm>";
+		static const char tail[] = "</osm>";
+
+		XML_Parser parser = NULL;
+
+		if ((parser = XML_ParserCreate("UTF-8")) == NULL)
+			throw std::runtime_error("cannot create XML parser");
+
+		State state(pass, *this, tag_filter_, buffer, true);
+
+		XML_SetElementHandler(parser, StartElement, EndElement);
+
+		XML_SetUserData(parser, &state);
+
+		try {
+			if (XML_Parse(parser, head, sizeof(head) - 1, 0) == XML_STATUS_ERROR ||
+					XML_Parse(parser, data + begin, end - begin, 0) == XML_STATUS_ERROR ||
+					XML_Parse(parser, tail, sizeof(tail) - 1, 1) == XML_STATUS_ERROR)
+				throw ParsingException(XML_ErrorString(XML_GetErrorCode(parser)));
+		} catch (ParsingException &e) {
+			std::stringstream ss;
+			/* report position in whole input, counted as expat does:
+			 * lines from 1, columns in characters from 0 */
+			size_t offset = begin + XML_GetCurrentByteIndex(parser) - (sizeof(head) - 1);
+			size_t line = 1, column = 0;
+			for (size_t pos = 0; pos < offset && pos < end; ++pos) {
+				if (data[pos] == '\n') {
+					line++;
+					column = 0;
+				} else if ((data[pos] & 0xc0) != 0x80) {
+					column++;
+				}
+			}
+			ss << "error parsing input: " << e.what() << " at line " << line << " pos " << column;
+			XML_ParserFree(parser);
+			throw ParsingException(ss.str());
+		} catch (...) {
+			XML_ParserFree(parser);
+			throw;
+		}
+
+		XML_ParserFree(parser);
+	}
+
+	/**
+	 * Parses XML file available in memory in parallel
+	 *
+	 * Input is split into chunks at node/way/relation element
+	 * boundaries, chunks are parsed by separate expat parsers in
+	 * batches, and objects are then passed to callbacks in order.
+	 * Input must have no comments, CDATA sections or processing
+	 * instructions (see IsPlainXml()), and be encoded in UTF-8,
+	 * as document prolog is skipped.
+	 */
+	void DoParallelXmlPass(const Pass& pass, const char* data, size_t size) {
+		const size_t chunk_size = 4*1024*1024;
+		const size_t batch_size = nthreads_ * 4;
+
+		/* contents of root element, without prolog and closing tag */
+		size_t begin = FindElementStart(data, size, 0);
+		size_t end = size;
+		static const char root_end[] = "</osm>";
+		for (size_t pos = size; pos > begin + sizeof(root_end) - 1; --pos) {
+			if (memcmp(data + pos - (sizeof(root_end) - 1), root_end, sizeof(root_end) - 1) == 0) {
+				end = pos - (sizeof(root_end) - 1);
+				break;
+			}
+		}
+
+		if (begin >= end)
+			return;
+
+		std::vector<std::pair<size_t, size_t> > chunks;
+		std::vector<ObjectBuffer> buffers(batch_size);
+
+		size_t pos = begin;
+		while (pos < end) {
+			chunks.clear();
+			while (pos < end && chunks.size() < batch_size) {
+				size_t next = pos + chunk_size < end ? FindElementStart(data, end, pos + chunk_size) : end;
+				chunks.push_back(std::make_pair(pos, next));
+				pos = next;
+			}
+
+			ParallelFor(chunks.size(), nthreads_, [&](size_t i) {
+				ParseXmlChunk(pass, data, chunks[i].first, chunks[i].second, buffers[i]);
+			});
+
+			for (size_t i = 0; i < chunks.size(); ++i) {
+				DispatchBuffer(pass, buffers[i]);
+				buffers[i].Clear();
+			}
+		}
+	}
+
+	void DoPbfPass(const Pass& pass, PbfReader& reader) {
+		PbfDecoder::Filter filter;
+		filter.types = 0;
+		if (pass.WantsNodes())
+			filter.types |= PbfDecoder::NODES;
+		if (pass.WantsWays())
+			filter.types |= PbfDecoder::WAYS;
+		if (pass.WantsRelations())
+			filter.types |= PbfDecoder::RELATIONS;
+		filter.tags = &tag_filter_;
+		if (pass.filter) {
+			const Parser& parser = *static_cast<Parser*>(this);
+			const ObjectFilterFn fn = pass.filter;
+			filter.objects = [&parser, fn](TagType type, osmid_t id) {
+				return (parser.*fn)(type, id);
+			};
+		}
+
+		/* blobs are read sequentially, decoded in parallel in
+		 * batches, and then passed to callbacks in file order */
+		const size_t batch_size = nthreads_ * 4;
+		std::vector<std::string> storage(batch_size);
+		std::vector<std::pair<const char*, size_t> > blobs(batch_size);
+		std::vector<ObjectBuffer> buffers(batch_size);
+
+		std::string type;
+		size_t nblob = 0;
+		bool eof = false;
+		bool had_header = false;
+		while (!eof) {
+			size_t nread = 0;
+			try {
+				while (nread < batch_size) {
+					if (!reader.ReadBlob(type, storage[nread], blobs[nread])) {
+						eof = true;
+						break;
+					}
+					nblob++;
+
+					if (type == "OSMHeader") {
+						PbfDecoder::CheckHeader(blobs[nread]);
+						had_header = true;
+					} else if (type == "OSMData") {
+						if (!had_header)
+							throw ParsingException("OSMData blob before OSMHeader");
+						nread++;
+					}
+				}
+
+				ParallelFor(nread, nthreads_, [&](size_t i) {
+					PbfDecoder::DecodeData(blobs[i], filter, buffers[i]);
+				});
+			} catch (ParsingException &e) {
+				std::stringstream ss;
+				ss << "error parsing input: " << e.what() << " near blob " << nblob;
+				throw ParsingException(ss.str());
+			}
+
+			for (size_t i = 0; i < nread; ++i) {
+				DispatchBuffer(pass, buffers[i]);
+				buffers[i].Clear();
+			}
+		}
+	}
+
+	void DispatchBuffer(const Pass& pass, const ObjectBuffer& buffer) {
+		Parser& parser = *static_cast<Parser*>(this);
+
+		for (size_t i = 0; i < buffer.size(); ++i) {
+			switch (buffer.TypeAt(i)) {
+			case NODE:
+				if (pass.node_view) {
+					(parser.*(pass.node_view))(buffer.NodeAt(i));
+				} else if (pass.node) {
+					NodeView view = buffer.NodeAt(i);
+					node_.SetId(view.id);
+					node_.SetLonI(view.lon);
+					node_.SetLatI(view.lat);
+					node_.ClearTags();
+					view.tags.CopyTo(node_);
+					(parser.*(pass.node))(node_);
+				}
+				break;
+			case WAY:
+				if (pass.way_view) {
+					(parser.*(pass.way_view))(buffer.WayAt(i));
+				} else if (pass.way) {
+					WayView view = buffer.WayAt(i);
+					way_.SetId(view.id);
+					way_.ClearNodes();
+					for (size_t n = 0; n < view.nrefs; ++n)
+						way_.AddNode(view.refs[n]);
+					way_.ClearTags();
+					view.tags.CopyTo(way_);
+					(parser.*(pass.way))(way_);
+				}
+				break;
+			case RELATION:
+				if (pass.relation_view) {
+					(parser.*(pass.relation_view))(buffer.RelationAt(i));
+				} else if (pass.relation) {
+					RelationView view = buffer.RelationAt(i);
+					relation_.SetId(view.id);
+					relation_.ClearMembers();
+					for (size_t n = 0; n < view.nmembers; ++n)
+						relation_.AddMember(view.members[n].type, view.members[n].id, view.members[n].role.str());
+					relation_.ClearTags();
+					view.tags.CopyTo(relation_);
+					(parser.*(pass.relation))(relation_);
+				}
+				break;
+			default:
+				break;
+			}
+		}
 	}
 
 	static void StartElement(void* userData, const char* name, const char** atts) {
@@ -184,23 +540,14 @@ private:
 			}
 			if (key == NULL || value == NULL)
 				throw ParsingException("bad tag");
-			switch (state.type) {
-			case NODE:
-				if (state.node.get())
-					state.node->AddTag(key, value);
-				break;
-			case WAY:
-				if (state.way.get())
-					state.way->AddTag(key, value);
-				break;
-			case RELATION:
-				if (state.relation.get())
-					state.relation->AddTag(key, value);
-				break;
-			default:
-				break;
-			}
-		} else if (state.type == WAY && strcmp(name, "nd") == 0 && state.way.get()) {
+			if (!state.collecting)
+				return;
+			size_t key_len = strlen(key);
+			if (!state.tags.Matches(key, key_len))
+				return;
+			/* expat strings only live until this callback returns */
+			state.buffer.AddTag(state.buffer.Copy(key, key_len), state.buffer.Copy(value, strlen(value)));
+		} else if (state.type == WAY && strcmp(name, "nd") == 0 && state.collecting) {
 			const char* ref = NULL;
 			for (const char** att = atts; *att; att += 2) {
 				if (strcmp(*att, "ref") == 0) ref = *(att + 1);
@@ -209,8 +556,8 @@ private:
 			if (ref == NULL)
 				throw ParsingException("bad node reference");
 
-			state.way->AddNode(strtoul(ref, NULL, 10));
-		} else if (state.type == RELATION && strcmp(name, "member") == 0 && state.relation.get()) {
+			state.buffer.AddRef(strtoul(ref, NULL, 10));
+		} else if (state.type == RELATION && strcmp(name, "member") == 0 && state.collecting) {
 			const char* type = NULL;
 			const char* ref = NULL;
 			const char* role = NULL;
@@ -233,7 +580,7 @@ private:
 			else
 				throw ParsingException("bad relation member");
 
-			state.relation->AddMember(t, strtoul(ref, NULL, 10), role);
+			state.buffer.AddMember(t, strtoul(ref, NULL, 10), state.buffer.Copy(role, strlen(role)));
 		}
 
 	   	if (strcmp(name, "node") == 0)
@@ -260,23 +607,21 @@ private:
 		if (state.type == NODE && (lat == NULL || lon == NULL))
 			throw ParsingException("bad node");
 
+		/* objects pass is not interested in are not collected,
+		 * so their children are skipped as well */
+		osmid_t objid = strtol/*l*/(id, NULL, 10);
 		switch (state.type) {
 		case NODE:
-			state.node.reset(new Node(
-					strtol/*l*/(id, NULL, 10),
-					ParseInt<7>(lat),
-					ParseInt<7>(lon)
-				));
+			if ((state.collecting = state.pass.WantsNodes() && state.WantsObject(NODE, objid)))
+				state.buffer.AddNode(objid, ParseInt<7>(lat), ParseInt<7>(lon));
 			break;
 		case WAY:
-			state.way.reset(new Way(
-					strtol/*l*/(id, NULL, 10)
-				));
+			if ((state.collecting = state.pass.WantsWays() && state.WantsObject(WAY, objid)))
+				state.buffer.AddWay(objid);
 			break;
 		case RELATION:
-			state.relation.reset(new Relation(
-					strtol/*l*/(id, NULL, 10)
-				));
+			if ((state.collecting = state.pass.WantsRelations() && state.WantsObject(RELATION, objid)))
+				state.buffer.AddRelation(objid);
 			break;
 		default:
 			break;
@@ -285,26 +630,40 @@ private:
 
 	static void EndElement(void* userData, const char* name) {
 		State& state = *static_cast<State*>(userData);
-		const Pass& pass = state.pass;
-		Parser& parser = state.parser;
-
-		if (strcmp(name, "node") == 0 && state.type == NODE && pass.node && state.node.get())
-			(static_cast<Parser&>(parser).*(pass.node))(*state.node.get());
-		if (strcmp(name, "way") == 0 && state.type == WAY && pass.way && state.way.get())
-			(static_cast<Parser&>(parser).*(pass.way))(*state.way.get());
-		if (strcmp(name, "relation") == 0 && state.type == RELATION && pass.relation && state.relation.get())
-			(static_cast<Parser&>(parser).*(pass.relation))(*state.relation.get());
 
 		if (strcmp(name, "node") == 0 || strcmp(name, "way") == 0 || strcmp(name, "relation") == 0) {
-			state.node.reset(NULL);
-			state.way.reset(NULL);
-			state.relation.reset(NULL);
+			if (state.collecting && !state.external_buffer) {
+				state.parser.DispatchBuffer(state.pass, state.buffer);
+				state.buffer.Clear();
+			}
 
+			state.collecting = false;
 			state.type = NOTAG;
 		}
 	}
 
 protected:
+	/**
+	 * Declares tag key parser is interested in
+	 *
+	 * If any keys are declared, tags with other keys are dropped
+	 * while parsing, before they are stored anywhere.
+	 */
+	void AddTagKey(const std::string& key) {
+		tag_filter_.AddKey(key);
+	}
+
+	/**
+	 * Sets filter for objects of the last added pass
+	 *
+	 * Objects for which filter returns false are skipped before
+	 * their contents are parsed. Filter may be called from input
+	 * decoding threads, but never concurrently with callbacks.
+	 */
+	void SetPassFilter(ObjectFilterFn filter) {
+		passes_.back().filter = filter;
+	}
+
 	void AddPass(ProcessNodeFn node, bool dumps_data = false, const std::string name = "") {
 		passes_.push_back(Pass(node, NULL, NULL, NULL, dumps_data, name));
 	}
@@ -329,8 +688,44 @@ protected:
 		passes_.push_back(Pass(node, way, relation, pass, dumps_data, name));
 	}
 
+	/**
+	 * Adds pass with view callbacks
+	 *
+	 * Views reference parser buffers directly and are only valid
+	 * during the call, so callbacks should copy what they keep.
+	 * This avoids constructing and copying an object per element.
+	 */
+	void AddViewPass(ProcessNodeViewFn node, ProcessWayViewFn way, ProcessRelationViewFn relation, SimplePassFn pass, bool dumps_data = false, const std::string name = "") {
+		passes_.push_back(Pass(node, way, relation, pass, dumps_data, name));
+	}
+
 public:
-	ParserBase() : dump_opened_(false) {
+	ParserBase() : dump_opened_(false), nthreads_(DefaultThreads()), parallel_xml_(false), input_mode_(READ_INPUT), node_(0, 0, 0), way_(0), relation_(0) {
+	}
+
+	void SetInputMode(InputMode mode) {
+		input_mode_ = mode;
+	}
+
+	/**
+	 * Sets number of threads used for decoding input
+	 */
+	void SetThreads(int nthreads) {
+		nthreads_ = nthreads > 0 ? nthreads : 1;
+	}
+
+	int GetThreads() const {
+		return nthreads_;
+	}
+
+	/**
+	 * Enables parsing of mmap()ed XML input in parallel chunks
+	 *
+	 * Inputs with comments, CDATA sections or processing
+	 * instructions are still parsed serially.
+	 */
+	void SetParallelXml(bool parallel) {
+		parallel_xml_ = parallel;
 	}
 
 	void Parse(const char* filename) {
@@ -345,7 +740,7 @@ public:
 				DumpOpen();
 				dump_opened_ = true;
 			}
-			if (pass->node || pass->way || pass->relation)
+			if (pass->WantsNodes() || pass->WantsWays() || pass->WantsRelations())
 				DoPass(*pass, filename);
 			if (pass->pass)
 				(static_cast<Parser*>(this)->*(pass->pass))();
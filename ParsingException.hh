@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARSINGEXCEPTION_HH
+#define PARSINGEXCEPTION_HH
+
+#include <stdexcept>
+#include <string>
+
+class ParsingException : public std::runtime_error {
+public:
+	ParsingException(const std::string& what) : std::runtime_error(what) {
+	}
+};
+
+#endif
@@ -0,0 +1,668 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PBFREADER_HH
+#define PBFREADER_HH
+
+#include <zlib.h>
+#include <unistd.h>
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstring>
+#include <stdint.h>
+
+#include "ParsingException.hh"
+#include "ObjectBuffer.hh"
+#include "TagFilter.hh"
+
+/**
+ * Minimal reader of protobuf wire format, enough for OSM PBF
+ */
+class ProtobufMessage {
+public:
+	enum WireType {
+		VARINT = 0,
+		FIXED64 = 1,
+		BYTES = 2,
+		FIXED32 = 5,
+	};
+
+private:
+	const unsigned char* cur_;
+	const unsigned char* end_;
+
+	int field_;
+	int wire_type_;
+
+private:
+	uint64_t ReadVarint(const unsigned char*& cur, const unsigned char* end) const {
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (cur == end)
+				throw ParsingException("truncated varint");
+			unsigned char byte = *cur++;
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+		throw ParsingException("bad varint");
+	}
+
+public:
+	ProtobufMessage(const char* data, size_t len)
+		: cur_(reinterpret_cast<const unsigned char*>(data)),
+		  end_(reinterpret_cast<const unsigned char*>(data) + len),
+		  field_(0),
+		  wire_type_(-1) {
+	}
+
+	ProtobufMessage(const std::pair<const char*, size_t>& bytes)
+		: cur_(reinterpret_cast<const unsigned char*>(bytes.first)),
+		  end_(reinterpret_cast<const unsigned char*>(bytes.first) + bytes.second),
+		  field_(0),
+		  wire_type_(-1) {
+	}
+
+	/* advances to next field; returns false at the end of message */
+	bool Next() {
+		if (cur_ == end_)
+			return false;
+		uint64_t key = ReadVarint(cur_, end_);
+		field_ = key >> 3;
+		wire_type_ = key & 7;
+		return true;
+	}
+
+	int Field() const {
+		return field_;
+	}
+
+	uint64_t Varint() {
+		if (wire_type_ != VARINT)
+			throw ParsingException("unexpected protobuf wire type");
+		return ReadVarint(cur_, end_);
+	}
+
+	int64_t SVarint() {
+		uint64_t value = Varint();
+		return (value >> 1) ^ -(int64_t)(value & 1);
+	}
+
+	std::pair<const char*, size_t> Bytes() {
+		if (wire_type_ != BYTES)
+			throw ParsingException("unexpected protobuf wire type");
+		uint64_t len = ReadVarint(cur_, end_);
+		if (len > (uint64_t)(end_ - cur_))
+			throw ParsingException("truncated protobuf message");
+		const char* data = reinterpret_cast<const char*>(cur_);
+		cur_ += len;
+		return std::make_pair(data, (size_t)len);
+	}
+
+	std::string String() {
+		std::pair<const char*, size_t> bytes = Bytes();
+		return std::string(bytes.first, bytes.second);
+	}
+
+	void Skip() {
+		switch (wire_type_) {
+		case VARINT: ReadVarint(cur_, end_); break;
+		case BYTES: Bytes(); break;
+		case FIXED64:
+		case FIXED32:
+			{
+				size_t len = wire_type_ == FIXED64 ? 8 : 4;
+				if ((size_t)(end_ - cur_) < len)
+					throw ParsingException("truncated protobuf message");
+				cur_ += len;
+			}
+			break;
+		default:
+			throw ParsingException("unsupported protobuf wire type");
+		}
+	}
+
+	/* reads packed repeated varints */
+	template<class T>
+	void PackedVarints(std::vector<T>& out, bool zigzag) {
+		std::pair<const char*, size_t> bytes = Bytes();
+		const unsigned char* cur = reinterpret_cast<const unsigned char*>(bytes.first);
+		const unsigned char* end = cur + bytes.second;
+		out.clear();
+		while (cur != end) {
+			uint64_t value = ReadVarint(cur, end);
+			out.push_back(zigzag ? (T)((value >> 1) ^ -(int64_t)(value & 1)) : (T)value);
+		}
+	}
+};
+
+/**
+ * Decoder of OSM PBF data blobs
+ *
+ * Stateless, so separate blobs may be decoded in parallel.
+ */
+class PbfDecoder {
+public:
+	enum Types {
+		NODES = 1,
+		WAYS = 2,
+		RELATIONS = 4,
+	};
+
+	/**
+	 * Specifies which objects and tags to decode
+	 *
+	 * Object filter is called from decoding threads.
+	 */
+	struct Filter {
+		int types;
+		const TagFilter* tags;
+		std::function<bool(TagType, osmid_t)> objects;
+
+		Filter() : types(NODES | WAYS | RELATIONS), tags(NULL) {
+		}
+
+		bool WantsObject(TagType type, osmid_t id) const {
+			return !objects || objects(type, id);
+		}
+	};
+
+private:
+	typedef std::vector<std::pair<const char*, size_t> > BlockStrings;
+
+	struct Block {
+		const Filter& filter;
+
+		BlockStrings strings;
+
+		/* whether string is a wanted tag key: 1/0, or -1 if not checked yet */
+		mutable std::vector<signed char> wanted_keys;
+
+		int64_t granularity;
+		int64_t lat_offset;
+		int64_t lon_offset;
+
+		Block(const Filter& f) : filter(f), granularity(100), lat_offset(0), lon_offset(0) {
+		}
+
+		/* converts to internal fixed point with 1e-7 degree resolution */
+		int Lat(int64_t lat) const {
+			return ToFixed(lat_offset + granularity * lat);
+		}
+
+		int Lon(int64_t lon) const {
+			return ToFixed(lon_offset + granularity * lon);
+		}
+
+		static int ToFixed(int64_t nanodegrees) {
+			return nanodegrees >= 0 ? (nanodegrees + 50) / 100 : -((-nanodegrees + 50) / 100);
+		}
+
+		/* strings point into unpacked block, which is owned by output buffer */
+		StrView String(uint64_t index) const {
+			if (index >= strings.size())
+				throw ParsingException("bad string table index");
+			return StrView(strings[index].first, strings[index].second);
+		}
+
+		bool WantsKey(uint64_t index) const {
+			if (filter.tags == NULL || filter.tags->IsEmpty())
+				return true;
+			if (index >= strings.size())
+				throw ParsingException("bad string table index");
+			if (wanted_keys.size() != strings.size())
+				wanted_keys.resize(strings.size(), -1);
+			if (wanted_keys[index] == -1)
+				wanted_keys[index] = filter.tags->Matches(strings[index].first, strings[index].second);
+			return wanted_keys[index];
+		}
+	};
+
+	/* scratch space for packed arrays, reused between objects */
+	struct Scratch {
+		std::vector<int64_t> ids;
+		std::vector<int64_t> lats;
+		std::vector<int64_t> lons;
+		std::vector<uint32_t> keys;
+		std::vector<uint32_t> vals;
+		std::vector<uint32_t> keys_vals;
+		std::vector<int32_t> roles;
+		std::vector<int32_t> types;
+	};
+
+private:
+	static void AddTags(ObjectBuffer& out, const Block& block, const std::vector<uint32_t>& keys, const std::vector<uint32_t>& vals) {
+		if (keys.size() != vals.size())
+			throw ParsingException("tag keys and values mismatch");
+		for (size_t i = 0; i < keys.size(); ++i)
+			if (block.WantsKey(keys[i]))
+				out.AddTag(block.String(keys[i]), block.String(vals[i]));
+	}
+
+	static void DecodeNode(ProtobufMessage msg, const Block& block, Scratch& scratch, ObjectBuffer& out) {
+		int64_t id = 0, lat = 0, lon = 0;
+		scratch.keys.clear();
+		scratch.vals.clear();
+
+		while (msg.Next()) {
+			switch (msg.Field()) {
+			case 1: id = msg.SVarint(); break;
+			case 2: msg.PackedVarints(scratch.keys, false); break;
+			case 3: msg.PackedVarints(scratch.vals, false); break;
+			case 8: lat = msg.SVarint(); break;
+			case 9: lon = msg.SVarint(); break;
+			default: msg.Skip(); break;
+			}
+		}
+
+		if (block.filter.WantsObject(NODE, id)) {
+			out.AddNode(id, block.Lat(lat), block.Lon(lon));
+			AddTags(out, block, scratch.keys, scratch.vals);
+		}
+	}
+
+	static void DecodeDenseNodes(ProtobufMessage msg, const Block& block, Scratch& scratch, ObjectBuffer& out) {
+		std::vector<uint32_t>& keys_vals = scratch.keys_vals;
+
+		scratch.ids.clear();
+		scratch.lats.clear();
+		scratch.lons.clear();
+		keys_vals.clear();
+
+		while (msg.Next()) {
+			switch (msg.Field()) {
+			case 1: msg.PackedVarints(scratch.ids, true); break;
+			case 8: msg.PackedVarints(scratch.lats, true); break;
+			case 9: msg.PackedVarints(scratch.lons, true); break;
+			case 10: msg.PackedVarints(keys_vals, false); break;
+			default: msg.Skip(); break;
+			}
+		}
+
+		if (scratch.lats.size() != scratch.ids.size() || scratch.lons.size() != scratch.ids.size())
+			throw ParsingException("dense nodes arrays mismatch");
+
+		int64_t id = 0, lat = 0, lon = 0;
+		size_t kv = 0;
+		for (size_t i = 0; i < scratch.ids.size(); ++i) {
+			id += scratch.ids[i];
+			lat += scratch.lats[i];
+			lon += scratch.lons[i];
+
+			bool wanted = block.filter.WantsObject(NODE, id);
+			if (wanted)
+				out.AddNode(id, block.Lat(lat), block.Lon(lon));
+
+			/* keys_vals is either empty or holds 0-terminated k/v list for each node */
+			if (kv < keys_vals.size()) {
+				while (kv < keys_vals.size() && keys_vals[kv] != 0) {
+					if (kv + 1 >= keys_vals.size())
+						throw ParsingException("truncated dense node tags");
+					if (wanted && block.WantsKey(keys_vals[kv]))
+						out.AddTag(block.String(keys_vals[kv]), block.String(keys_vals[kv + 1]));
+					kv += 2;
+				}
+				kv++;
+			}
+		}
+	}
+
+	static void DecodeWay(ProtobufMessage msg, const Block& block, Scratch& scratch, ObjectBuffer& out) {
+		int64_t id = 0;
+		scratch.keys.clear();
+		scratch.vals.clear();
+		scratch.ids.clear();
+
+		while (msg.Next()) {
+			switch (msg.Field()) {
+			case 1: id = msg.Varint(); break;
+			case 2: msg.PackedVarints(scratch.keys, false); break;
+			case 3: msg.PackedVarints(scratch.vals, false); break;
+			case 8: msg.PackedVarints(scratch.ids, true); break;
+			default: msg.Skip(); break;
+			}
+		}
+
+		if (!block.filter.WantsObject(WAY, id))
+			return;
+
+		out.AddWay(id);
+
+		int64_t ref = 0;
+		for (size_t i = 0; i < scratch.ids.size(); ++i)
+			out.AddRef(ref += scratch.ids[i]);
+
+		AddTags(out, block, scratch.keys, scratch.vals);
+	}
+
+	static void DecodeRelation(ProtobufMessage msg, const Block& block, Scratch& scratch, ObjectBuffer& out) {
+		int64_t id = 0;
+		scratch.keys.clear();
+		scratch.vals.clear();
+		scratch.roles.clear();
+		scratch.ids.clear();
+		scratch.types.clear();
+
+		while (msg.Next()) {
+			switch (msg.Field()) {
+			case 1: id = msg.Varint(); break;
+			case 2: msg.PackedVarints(scratch.keys, false); break;
+			case 3: msg.PackedVarints(scratch.vals, false); break;
+			case 8: msg.PackedVarints(scratch.roles, false); break;
+			case 9: msg.PackedVarints(scratch.ids, true); break;
+			case 10: msg.PackedVarints(scratch.types, false); break;
+			default: msg.Skip(); break;
+			}
+		}
+
+		if (scratch.roles.size() != scratch.ids.size() || scratch.types.size() != scratch.ids.size())
+			throw ParsingException("relation member arrays mismatch");
+
+		if (!block.filter.WantsObject(RELATION, id))
+			return;
+
+		out.AddRelation(id);
+
+		int64_t ref = 0;
+		for (size_t i = 0; i < scratch.ids.size(); ++i) {
+			Relation::MemberType type;
+			switch (scratch.types[i]) {
+			case 0: type = Relation::NODE; break;
+			case 1: type = Relation::WAY; break;
+			case 2: type = Relation::RELATION; break;
+			default: throw ParsingException("bad relation member type");
+			}
+			out.AddMember(type, ref += scratch.ids[i], block.String(scratch.roles[i]));
+		}
+
+		AddTags(out, block, scratch.keys, scratch.vals);
+	}
+
+	static void DecodeGroup(ProtobufMessage msg, const Block& block, Scratch& scratch, ObjectBuffer& out) {
+		const int types = block.filter.types;
+
+		while (msg.Next()) {
+			switch (msg.Field()) {
+			case 1:
+				if (types & NODES)
+					DecodeNode(msg.Bytes(), block, scratch, out);
+				else
+					msg.Skip();
+				break;
+			case 2:
+				if (types & NODES)
+					DecodeDenseNodes(msg.Bytes(), block, scratch, out);
+				else
+					msg.Skip();
+				break;
+			case 3:
+				if (types & WAYS)
+					DecodeWay(msg.Bytes(), block, scratch, out);
+				else
+					msg.Skip();
+				break;
+			case 4:
+				if (types & RELATIONS)
+					DecodeRelation(msg.Bytes(), block, scratch, out);
+				else
+					msg.Skip();
+				break;
+			default:
+				msg.Skip();
+				break;
+			}
+		}
+	}
+
+public:
+	/**
+	 * Unpacks raw or zlib-compressed Blob message
+	 */
+	static void Unpack(const std::pair<const char*, size_t>& blob, std::string& out) {
+		ProtobufMessage msg(blob);
+
+		std::pair<const char*, size_t> zlib_data(NULL, 0);
+		uint64_t raw_size = 0;
+
+		while (msg.Next()) {
+			switch (msg.Field()) {
+			case 1: /* raw */
+				{
+					std::pair<const char*, size_t> raw = msg.Bytes();
+					out.assign(raw.first, raw.second);
+				}
+				return;
+			case 2: raw_size = msg.Varint(); break;
+			case 3: zlib_data = msg.Bytes(); break;
+			case 4: case 5: case 6: case 7:
+				throw ParsingException("unsupported PBF blob compression");
+			default: msg.Skip(); break;
+			}
+		}
+
+		if (zlib_data.first == NULL)
+			throw ParsingException("empty PBF blob");
+
+		if (raw_size > 32 * 1024 * 1024)
+			throw ParsingException("PBF blob too large");
+
+		out.resize(raw_size);
+
+		uLongf len = raw_size;
+		if (uncompress(reinterpret_cast<Bytef*>(&out[0]), &len, reinterpret_cast<const Bytef*>(zlib_data.first), zlib_data.second) != Z_OK || len != raw_size)
+			throw ParsingException("PBF blob decompression failed");
+	}
+
+	/**
+	 * Checks that features required by OSMHeader block are supported
+	 */
+	static void CheckHeader(const std::pair<const char*, size_t>& blob) {
+		std::string data;
+		Unpack(blob, data);
+
+		ProtobufMessage msg(data.data(), data.size());
+		while (msg.Next()) {
+			if (msg.Field() == 4) {
+				std::string feature = msg.String();
+				if (feature != "OsmSchema-V0.6" && feature != "DenseNodes")
+					throw ParsingException("unsupported PBF feature required: " + feature);
+			} else {
+				msg.Skip();
+			}
+		}
+	}
+
+	/**
+	 * Decodes OSMData blob, appending objects passing filter to out
+	 *
+	 * Blob is unpacked into storage of out, and strings of objects
+	 * reference it directly.
+	 */
+	static void DecodeData(const std::pair<const char*, size_t>& blob, const Filter& filter, ObjectBuffer& out) {
+		std::string& data = out.AddStorage();
+		Unpack(blob, data);
+
+		Block block(filter);
+		std::vector<std::pair<const char*, size_t> > groups;
+
+		ProtobufMessage msg(data.data(), data.size());
+		while (msg.Next()) {
+			switch (msg.Field()) {
+			case 1:
+				{
+					ProtobufMessage strings(msg.Bytes());
+					while (strings.Next()) {
+						if (strings.Field() == 1)
+							block.strings.push_back(strings.Bytes());
+						else
+							strings.Skip();
+					}
+				}
+				break;
+			case 2: groups.push_back(msg.Bytes()); break;
+			case 17: block.granularity = msg.Varint(); break;
+			case 19: block.lat_offset = msg.Varint(); break;
+			case 20: block.lon_offset = msg.Varint(); break;
+			default: msg.Skip(); break;
+			}
+		}
+
+		/* groups may precede string table, so decode them afterwards */
+		Scratch scratch;
+		for (std::vector<std::pair<const char*, size_t> >::const_iterator group = groups.begin(); group != groups.end(); ++group)
+			DecodeGroup(*group, block, scratch, out);
+	}
+};
+
+/**
+ * Reader of PBF file structure: sequence of BlobHeader/Blob pairs
+ *
+ * Reads either from file descriptor, or from memory (such as mmap()ed
+ * file), in which case blobs are not copied.
+ */
+class PbfReader {
+private:
+	int fd_;
+
+	/* data already read from fd_ by format detection, or whole input */
+	std::string prefix_;
+	const char* data_;
+	size_t data_size_;
+	size_t data_pos_;
+
+private:
+	PbfReader(const PbfReader&);
+	PbfReader& operator=(const PbfReader&);
+
+	/* returns pointer to next len bytes of memory input */
+	const char* Take(size_t len) {
+		if (data_size_ - data_pos_ < len)
+			throw ParsingException("truncated PBF file");
+		const char* where = data_ + data_pos_;
+		data_pos_ += len;
+		return where;
+	}
+
+	/* reads exactly len bytes; returns false on clean EOF before first byte */
+	bool Read(char* buf, size_t len) {
+		if (fd_ == -1) {
+			if (data_pos_ == data_size_)
+				return false;
+			memcpy(buf, Take(len), len);
+			return true;
+		}
+
+		size_t done = 0;
+
+		if (data_pos_ < data_size_) {
+			done = std::min(len, data_size_ - data_pos_);
+			memcpy(buf, data_ + data_pos_, done);
+			data_pos_ += done;
+		}
+
+		while (done < len) {
+			ssize_t got = read(fd_, buf + done, len - done);
+			if (got < 0)
+				throw std::runtime_error("input read error");
+			if (got == 0) {
+				if (done == 0)
+					return false;
+				throw ParsingException("truncated PBF file");
+			}
+			done += got;
+		}
+
+		return true;
+	}
+
+public:
+	PbfReader(int fd, const char* prefix, size_t prefix_len)
+		: fd_(fd),
+		  prefix_(prefix, prefix_len),
+		  data_(prefix_.data()),
+		  data_size_(prefix_.size()),
+		  data_pos_(0) {
+	}
+
+	PbfReader(const char* data, size_t len)
+		: fd_(-1),
+		  data_(data),
+		  data_size_(len),
+		  data_pos_(0) {
+	}
+
+	/**
+	 * Checks whether data starts with PBF BlobHeader
+	 */
+	static bool Detect(const char* data, size_t len) {
+		static const char magic[] = "\x0a\x09OSMHeader";
+		return len >= 15 && data[0] == 0 && data[1] == 0 && memcmp(data + 4, magic, 11) == 0;
+	}
+
+	/**
+	 * Reads next blob; returns false at the end of file
+	 *
+	 * Blob data is placed into storage, unless it's available
+	 * in memory input.
+	 */
+	bool ReadBlob(std::string& type, std::string& storage, std::pair<const char*, size_t>& blob) {
+		unsigned char lenbuf[4];
+		if (!Read(reinterpret_cast<char*>(lenbuf), 4))
+			return false;
+
+		uint32_t header_len = (lenbuf[0] << 24) | (lenbuf[1] << 16) | (lenbuf[2] << 8) | lenbuf[3];
+		if (header_len > 64 * 1024)
+			throw ParsingException("PBF blob header too large");
+
+		std::string header(header_len, '\0');
+		if (header_len > 0 && !Read(&header[0], header_len))
+			throw ParsingException("truncated PBF file");
+
+		uint64_t datasize = 0;
+		type.clear();
+
+		ProtobufMessage msg(header.data(), header.size());
+		while (msg.Next()) {
+			switch (msg.Field()) {
+			case 1: type = msg.String(); break;
+			case 3: datasize = msg.Varint(); break;
+			default: msg.Skip(); break;
+			}
+		}
+
+		if (datasize > 32 * 1024 * 1024)
+			throw ParsingException("PBF blob too large");
+
+		if (fd_ == -1) {
+			blob.first = Take(datasize);
+		} else {
+			storage.resize(datasize);
+			if (datasize > 0 && !Read(&storage[0], datasize))
+				throw ParsingException("truncated PBF file");
+			blob.first = storage.data();
+		}
+		blob.second = datasize;
+
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TAGFILTER_HH
+#define TAGFILTER_HH
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+
+/**
+ * Set of tag keys parser is interested in
+ *
+ * Empty filter matches all keys. Meant for a handful of keys, so
+ * lookup is a plain scan, which is faster than hashing for that.
+ */
+class TagFilter {
+private:
+	typedef std::vector<std::string> KeyVector;
+
+private:
+	KeyVector keys_;
+
+public:
+	TagFilter() {
+	}
+
+	void AddKey(const std::string& key) {
+		if (std::find(keys_.begin(), keys_.end(), key) == keys_.end())
+			keys_.push_back(key);
+	}
+
+	bool IsEmpty() const {
+		return keys_.empty();
+	}
+
+	bool Matches(const char* key, size_t length) const {
+		if (keys_.empty())
+			return true;
+
+		for (KeyVector::const_iterator k = keys_.begin(); k != keys_.end(); ++k)
+			if (k->size() == length && memcmp(k->data(), key, length) == 0)
+				return true;
+
+		return false;
+	}
+
+	bool Matches(const char* key) const {
+		return Matches(key, strlen(key));
+	}
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BENCH_HH
+#define BENCH_HH
+
+#include <unistd.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdio>
+
+#include "osmtypes.h"
+
+/* helpers shared by benchmark programs */
+
+typedef std::chrono::steady_clock BenchClock;
+
+static inline double SecondsSince(BenchClock::time_point start) {
+	return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+/**
+ * Latency statistics of a series of measurements, in milliseconds
+ */
+struct LatencyStats {
+	double mean;
+	double p50;
+	double p99;
+
+	LatencyStats(std::vector<double> latencies) : mean(0.0), p50(0.0), p99(0.0) {
+		if (latencies.empty())
+			return;
+		std::sort(latencies.begin(), latencies.end());
+		for (size_t i = 0; i < latencies.size(); ++i)
+			mean += latencies[i];
+		mean = mean / latencies.size() * 1000.0;
+		p50 = latencies[latencies.size() / 2] * 1000.0;
+		p99 = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)] * 1000.0;
+	}
+};
+
+/**
+ * Temporary OSM XML file with synthetic rail network
+ *
+ * The network is a size x size grid of stations named "X<x>Y<y>",
+ * about 5 km apart, with neighbours connected by tracks of several
+ * nodes each; about a tenth of tracks are missing. The file is
+ * removed when the object is destroyed.
+ */
+class SyntheticGrid {
+private:
+	std::string filename_;
+	int size_;
+
+private:
+	SyntheticGrid(const SyntheticGrid&);
+	SyntheticGrid& operator=(const SyntheticGrid&);
+
+public:
+	SyntheticGrid(int size, int track_nodes = 3) : size_(size) {
+		const char* tmpdir = getenv("TMPDIR");
+		filename_ = std::string(tmpdir ? tmpdir : "/tmp") + "/bench_grid.XXXXXX";
+		int fd = mkstemp(&filename_[0]);
+		if (fd == -1)
+			throw std::runtime_error("cannot create temporary file");
+		close(fd);
+
+		std::ofstream out(filename_.c_str());
+		std::mt19937 random(1);
+		std::uniform_real_distribution<double> jitter(-0.002, 0.002);
+
+		const double step = 0.05;
+		osmid_t nid = 1;
+		std::vector<std::pair<double, double> > stations;
+		char buf[256];
+
+		out << "<?xml version='1.0' encoding='UTF-8'?>\n<osm version='0.6' generator='bench'>\n";
+		for (int y = 0; y < size; ++y) {
+			for (int x = 0; x < size; ++x) {
+				stations.push_back(std::make_pair(30.0 + x * step + jitter(random), 50.0 + y * step + jitter(random)));
+				snprintf(buf, sizeof(buf), " <node id='%lld' lat='%.7f' lon='%.7f'>\n  <tag k='railway' v='station'/>\n  <tag k='name' v='X%dY%d'/>\n </node>\n",
+						(long long)nid++, stations.back().second, stations.back().first, x, y);
+				out << buf;
+			}
+		}
+
+		std::vector<std::vector<osmid_t> > ways;
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		for (int y = 0; y < size; ++y) {
+			for (int x = 0; x < size; ++x) {
+				for (int dir = 0; dir < 2; ++dir) {
+					int nx = x + (dir == 0), ny = y + (dir == 1);
+					if (nx >= size || ny >= size || uniform(random) >= 0.9)
+						continue;
+
+					const std::pair<double, double>& a = stations[y * size + x];
+					const std::pair<double, double>& b = stations[ny * size + nx];
+					std::vector<osmid_t> refs(1, y * size + x + 1);
+					for (int i = 1; i <= track_nodes; ++i) {
+						double t = (double)i / (track_nodes + 1);
+						snprintf(buf, sizeof(buf), " <node id='%lld' lat='%.7f' lon='%.7f'/>\n",
+								(long long)nid, a.second + (b.second - a.second) * t + jitter(random), a.first + (b.first - a.first) * t + jitter(random));
+						out << buf;
+						refs.push_back(nid++);
+					}
+					refs.push_back(ny * size + nx + 1);
+					ways.push_back(refs);
+				}
+			}
+		}
+
+		for (size_t i = 0; i < ways.size(); ++i) {
+			out << " <way id='" << i + 1 << "'>\n";
+			for (size_t n = 0; n < ways[i].size(); ++n)
+				out << "  <nd ref='" << ways[i][n] << "'/>\n";
+			out << "  <tag k='railway' v='rail'/>\n </way>\n";
+		}
+		out << "</osm>\n";
+
+		if (!out)
+			throw std::runtime_error("cannot write temporary file");
+	}
+
+	~SyntheticGrid() {
+		unlink(filename_.c_str());
+	}
+
+	const char* GetFilename() const {
+		return filename_.c_str();
+	}
+
+	int GetSize() const {
+		return size_;
+	}
+};
+
+/**
+ * Picks given number of random pairs of distinct names
+ */
+static inline void RandomPairs(const std::vector<std::string>& names, size_t count, std::vector<std::pair<std::string, std::string> >& pairs) {
+	pairs.clear();
+	if (names.size() < 2)
+		return;
+
+	std::mt19937 random(42);
+	std::uniform_int_distribution<size_t> pick(0, names.size() - 1);
+	while (pairs.size() < count) {
+		size_t a = pick(random), b = pick(random);
+		if (a != b)
+			pairs.push_back(std::make_pair(names[a], names[b]));
+	}
+}
+
+#endif
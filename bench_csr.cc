@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <limits>
+#include <exception>
+#include <cstdlib>
+
+#include "railrouting.hh"
+#include "bench.hh"
+
+/*
+ * Compares route search latency on routing graph stored in compressed
+ * sparse row form, as RailRouting does, and in former layout of route
+ * nodes pointing into pool of route edges, on the same graph and
+ * random node pairs; also measures FindRoute latency
+ */
+
+/* compressed sparse row graph: offsets and split edge arrays */
+class CsrGraph {
+private:
+	std::vector<uint32_t> offsets_;
+	std::vector<uint32_t> targets_;
+	std::vector<double> lengths_;
+
+public:
+	CsrGraph(const RailRouting& routing) {
+		routing.ExportGraph(offsets_, targets_, lengths_);
+	}
+
+	size_t size() const {
+		return offsets_.empty() ? 0 : offsets_.size() - 1;
+	}
+
+	size_t GetEdgesCount() const {
+		return targets_.size();
+	}
+
+	const std::vector<uint32_t>& GetOffsets() const {
+		return offsets_;
+	}
+
+	const std::vector<uint32_t>& GetTargets() const {
+		return targets_;
+	}
+
+	const std::vector<double>& GetLengths() const {
+		return lengths_;
+	}
+
+	template <class Visitor>
+	void VisitEdges(int node, Visitor& visit) const {
+		const uint32_t end = offsets_[node + 1];
+		for (uint32_t nedge = offsets_[node]; nedge < end; ++nedge)
+			visit(targets_[nedge], lengths_[nedge]);
+	}
+};
+
+/* former layout: route nodes with pointers into chunks of 32 byte
+ * edges which also carry geometry data, allocated node by node */
+class PointerGraph {
+private:
+	struct RouteEdge {
+		osmid_t osmid;
+		unsigned short start_pos;
+		unsigned short end_pos;
+		int node;
+		float direction;
+		double length;
+	};
+
+	struct RouteNode {
+		osmid_t osmid;
+		int nedges;
+		RouteEdge* edges;
+	};
+
+	std::vector<RouteNode> nodes_;
+	std::vector<std::vector<RouteEdge> > chunks_;
+
+private:
+	PointerGraph(const PointerGraph&);
+	PointerGraph& operator=(const PointerGraph&);
+
+public:
+	PointerGraph(const CsrGraph& graph) {
+		const size_t chunk_size = 1024;
+		size_t chunk_free = 0;
+		for (size_t node = 0; node < graph.size(); ++node) {
+			const uint32_t begin = graph.GetOffsets()[node], end = graph.GetOffsets()[node + 1];
+			if (chunks_.empty() || end - begin > chunk_free) {
+				chunks_.push_back(std::vector<RouteEdge>(std::max<size_t>(chunk_size, end - begin)));
+				chunk_free = chunks_.back().size();
+			}
+
+			RouteNode route_node = { (osmid_t)node, (int)(end - begin), chunks_.back().data() + chunks_.back().size() - chunk_free };
+			for (uint32_t nedge = begin; nedge < end; ++nedge) {
+				RouteEdge& edge = route_node.edges[nedge - begin];
+				edge.osmid = nedge;
+				edge.start_pos = edge.end_pos = 0;
+				edge.node = graph.GetTargets()[nedge];
+				edge.direction = 0.0f;
+				edge.length = graph.GetLengths()[nedge];
+			}
+			chunk_free -= end - begin;
+			nodes_.push_back(route_node);
+		}
+	}
+
+	size_t size() const {
+		return nodes_.size();
+	}
+
+	template <class Visitor>
+	void VisitEdges(int node, Visitor& visit) const {
+		const RouteNode& route_node = nodes_[node];
+		for (int nedge = 0; nedge < route_node.nedges; ++nedge)
+			visit(route_node.edges[nedge].node, route_node.edges[nedge].length);
+	}
+};
+
+/* Dijkstra search between two nodes, same for both layouts */
+class Search {
+private:
+	typedef std::pair<double, int> QueueEntry;
+	typedef std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > Queue;
+
+	std::vector<double> lengths_;
+	std::vector<int> touched_;
+	Queue queue_;
+
+	struct Relax {
+		Search& search;
+		double length;
+
+		Relax(Search& s, double l) : search(s), length(l) {
+		}
+
+		void operator()(int node, double edge_length) {
+			const double new_length = length + edge_length;
+			if (new_length < search.lengths_[node]) {
+				if (search.lengths_[node] == std::numeric_limits<double>::infinity())
+					search.touched_.push_back(node);
+				search.lengths_[node] = new_length;
+				search.queue_.push(QueueEntry(new_length, node));
+			}
+		}
+	};
+
+public:
+	/* returns route length, or -1 if there's no route */
+	template <class Graph>
+	double Run(const Graph& graph, int from, int to, size_t& settled) {
+		lengths_.resize(graph.size(), std::numeric_limits<double>::infinity());
+
+		lengths_[from] = 0.0;
+		touched_.push_back(from);
+		queue_.push(QueueEntry(0.0, from));
+
+		double result = -1.0;
+		settled = 0;
+		while (!queue_.empty()) {
+			const QueueEntry current = queue_.top();
+			queue_.pop();
+
+			if (lengths_[current.second] < current.first)
+				continue;
+
+			settled++;
+			if (current.second == to) {
+				result = current.first;
+				break;
+			}
+
+			Relax relax(*this, current.first);
+			graph.VisitEdges(current.second, relax);
+		}
+
+		for (size_t i = 0; i < touched_.size(); ++i)
+			lengths_[touched_[i]] = std::numeric_limits<double>::infinity();
+		touched_.clear();
+		while (!queue_.empty())
+			queue_.pop();
+
+		return result;
+	}
+};
+
+static void PrintStats(const char* name, const std::vector<double>& latencies, double settled) {
+	LatencyStats stats(latencies);
+	std::cout << "  " << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(3)
+		<< " mean " << std::setw(9) << stats.mean << " ms"
+		<< "  p50 " << std::setw(9) << stats.p50 << " ms"
+		<< "  p99 " << std::setw(9) << stats.p99 << " ms"
+		<< "  settled " << std::setprecision(0) << settled << std::endl;
+}
+
+template <class Graph>
+static void BenchLayout(const char* name, const Graph& graph, const std::vector<std::pair<int, int> >& pairs, std::vector<double>& distances) {
+	Search search;
+	std::vector<double> latencies;
+	double settled_total = 0.0;
+	size_t settled;
+
+	distances.clear();
+
+	/* warm up search arrays */
+	if (!pairs.empty())
+		search.Run(graph, pairs[0].first, pairs[0].second, settled);
+
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		BenchClock::time_point start = BenchClock::now();
+		distances.push_back(search.Run(graph, pairs[i].first, pairs[i].second, settled));
+		latencies.push_back(SecondsSince(start));
+		settled_total += settled;
+	}
+
+	PrintStats(name, latencies, pairs.empty() ? 0.0 : settled_total / pairs.size());
+}
+
+/* returns false if layouts found routes of different length */
+static bool BenchNetwork(const std::string& label, const RailRouting& routing, size_t nqueries) {
+	CsrGraph csr(routing);
+	PointerGraph pointers(csr);
+
+	std::cout << label << ": " << csr.size() << " route nodes, " << csr.GetEdgesCount() << " edges, " << nqueries << " queries" << std::endl;
+	std::cout << "  edge data: pointers " << csr.GetEdgesCount() * 32 / 1024 << " KiB, csr " << csr.GetEdgesCount() * 12 / 1024 << " KiB" << std::endl;
+
+	bool consistent = true;
+	if (csr.size() >= 2) {
+		std::vector<std::pair<int, int> > pairs;
+		std::mt19937 random(42);
+		std::uniform_int_distribution<int> pick(0, csr.size() - 1);
+		while (pairs.size() < nqueries) {
+			int a = pick(random), b = pick(random);
+			if (a != b)
+				pairs.push_back(std::make_pair(a, b));
+		}
+
+		std::vector<double> pointer_distances, csr_distances;
+		BenchLayout("pointers", pointers, pairs, pointer_distances);
+		BenchLayout("csr", csr, pairs, csr_distances);
+
+		/* same edges are visited in the same order */
+		consistent = pointer_distances == csr_distances;
+	}
+
+	std::vector<std::string> names;
+	routing.CompleteStations("", (size_t)-1, names);
+
+	std::vector<std::pair<std::string, std::string> > station_pairs;
+	RandomPairs(names, nqueries, station_pairs);
+
+	RailRouting::QueryContext context;
+	RailRouting::FindRouteResult result;
+	std::vector<double> latencies;
+	double settled = 0.0;
+
+	if (!station_pairs.empty())
+		routing.FindRoute(context, station_pairs[0].first, station_pairs[0].second, result);
+
+	for (size_t i = 0; i < station_pairs.size(); ++i) {
+		BenchClock::time_point start = BenchClock::now();
+		routing.FindRoute(context, station_pairs[i].first, station_pairs[i].second, result);
+		latencies.push_back(SecondsSince(start));
+		settled += result.settled_count;
+	}
+
+	PrintStats("FindRoute", latencies, station_pairs.empty() ? 0.0 : settled / station_pairs.size());
+
+	if (!consistent)
+		std::cout << "  ERROR: layouts found routes of different length" << std::endl;
+
+	return consistent;
+}
+
+void usage(const char* progname) {
+	std::cerr << "Usage: " << progname << " [-g size] [-n queries] [file.osm]" << std::endl;
+	std::cerr << "  -g  size of synthetic grid network (default 300, 0 to skip)" << std::endl;
+	std::cerr << "  -n  number of random node and station pairs to query (default 200)" << std::endl;
+	std::cerr << "  file.osm defaults to raildemo.osm" << std::endl;
+}
+
+int main(int argc, char** argv) {
+	int grid_size = 300;
+	size_t nqueries = 200;
+
+	int c;
+	while ((c = getopt(argc, argv, "g:n:h")) != -1) {
+		switch (c) {
+		case 'g':
+			grid_size = atoi(optarg);
+			break;
+		case 'n':
+			nqueries = atol(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind > 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	const char* filename = argc - optind == 1 ? argv[optind] : "raildemo.osm";
+
+	try {
+		bool consistent = true;
+
+		{
+			RailRouting routing;
+			routing.Parse(filename);
+			consistent = BenchNetwork(filename, routing, nqueries) && consistent;
+		}
+
+		if (grid_size > 0) {
+			SyntheticGrid grid(grid_size);
+			RailRouting routing;
+			routing.Parse(grid.GetFilename());
+
+			std::stringstream label;
+			label << grid_size << "x" << grid_size << " grid";
+			consistent = BenchNetwork(label.str(), routing, nqueries) && consistent;
+		}
+
+		return consistent ? 0 : 1;
+	} catch (std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+}
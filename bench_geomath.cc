@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include <cmath>
+
+#include "geomath.hh"
+#include "bench.hh"
+
+/*
+ * Checks batch Distances() and Bearings() kernels of every lanes type
+ * available against exact formulae within error bounds documented in
+ * geomath.hh, then compares their speed with scalar Distance() and
+ * Bearing()
+ */
+
+/* documented error bounds */
+static const double distance_bound = 2.1e-15;  /* relative, batch and Distance() */
+static const double bearing_bound = 1e-12;     /* radians, batch */
+static const double scalar_bearing_bound = 5e-9; /* radians, Bearing() on 1 m segments, more on shorter */
+
+typedef void (*PolylineFn)(const LonLat* points, size_t count, double* out);
+
+struct Implementation {
+	const char* name;
+	PolylineFn distances;
+	PolylineFn bearings;
+	bool scalar;
+};
+
+static void ScalarDistances(const LonLat* points, size_t count, double* distances) {
+	for (size_t i = 0; i + 1 < count; ++i)
+		distances[i] = Distance(points[i], points[i + 1]);
+}
+
+static void ScalarBearings(const LonLat* points, size_t count, double* bearings) {
+	for (size_t i = 0; i + 1 < count; ++i)
+		bearings[i] = Bearing(points[i], points[i + 1]);
+}
+
+template <class L>
+static void LanesDistances(const LonLat* points, size_t count, double* distances) {
+	for (size_t first = 0; first + 1 < count; first += batch_block)
+		DistancesKernel<L>(points + first, std::min(batch_block, count - 1 - first), distances + first);
+}
+
+template <class L>
+static void LanesBearings(const LonLat* points, size_t count, double* bearings) {
+	for (size_t first = 0; first + 1 < count; first += batch_block)
+		BearingsKernel<L>(points + first, std::min(batch_block, count - 1 - first), bearings + first);
+}
+
+static const Implementation implementations[] = {
+	{ "Distance()/Bearing()", ScalarDistances, ScalarBearings, true },
+	{ "scalar lanes", LanesDistances<ScalarLanes>, LanesBearings<ScalarLanes>, false },
+#if defined(__SSE2__)
+	{ "SSE2 lanes", LanesDistances<SseLanes>, LanesBearings<SseLanes>, false },
+#endif
+#if defined(__AVX__)
+	{ "AVX lanes", LanesDistances<AvxLanes>, LanesBearings<AvxLanes>, false },
+#endif
+	{ "Distances()/Bearings()", Distances<LonLat>, Bearings<LonLat>, false },
+};
+
+static const size_t nimplementations = sizeof(implementations)/sizeof(implementations[0]);
+
+/* exact formulae over the same radian coordinates of points as batch
+ * kernels use, bearing one rearranged as in BearingsKernel to avoid
+ * cancellation */
+static long double ExactDistance(const LonLat& a, const LonLat& b) {
+	long double alat = a.GetLatD() / 180.0 * M_PI, blat = b.GetLatD() / 180.0 * M_PI;
+	long double alon = a.GetLonD() / 180.0 * M_PI, blon = b.GetLonD() / 180.0 * M_PI;
+
+	long double sin1 = sinl((blat - alat) / 2.0L);
+	long double sin2 = sinl((blon - alon) / 2.0L);
+
+	return 2.0L * 6378137.0L * asinl(sqrtl(sin1 * sin1 + cosl(alat) * cosl(blat) * sin2 * sin2));
+}
+
+static long double ExactBearing(const LonLat& a, const LonLat& b) {
+	long double alat = a.GetLatD() / 180.0 * M_PI, blat = b.GetLatD() / 180.0 * M_PI;
+	long double alon = a.GetLonD() / 180.0 * M_PI, blon = b.GetLonD() / 180.0 * M_PI;
+	long double dlon = blon - alon;
+
+	long double sinhalf = sinl(dlon / 2.0L);
+	long double y = sinl(dlon) * cosl(blat);
+	long double x = sinl(blat - alat) + sinl(alat) * cosl(blat) * 2.0L * sinhalf * sinhalf;
+
+	return atan2l(y, x);
+}
+
+/* random walk like rail track, with segments from centimeters to
+ * tens of kilometers, and rare long jumps which take scalar path */
+static void RandomPolyline(std::mt19937& random, size_t count, std::vector<LonLat>& points) {
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+	double lon = uniform(random) * 360.0 - 180.0;
+	double lat = uniform(random) * 170.0 - 85.0;
+	double direction = uniform(random) * 2.0 * M_PI;
+
+	points.clear();
+	while (points.size() < count) {
+		points.push_back(LonLat(lrint(lon * 10000000.0), lrint(lat * 10000000.0)));
+
+		double step;
+		double kind = uniform(random);
+		if (kind < 0.3)
+			step = 1e-7 * pow(100.0, uniform(random));  /* up to a meter */
+		else if (kind < 0.9)
+			step = 1e-5 * pow(1000.0, uniform(random)); /* up to a kilometer */
+		else if (kind < 0.99)
+			step = 1e-2 * pow(50.0, uniform(random));   /* up to 50 km */
+		else
+			step = uniform(random) * 60.0;
+
+		direction += (uniform(random) - 0.5) * 0.5;
+		lat += step * cos(direction);
+		lon += step * sin(direction);
+
+		if (lat > 89.0 || lat < -89.0) {
+			lat = std::max(-89.0, std::min(89.0, lat));
+			direction += M_PI;
+		}
+		if (lon >= 180.0)
+			lon -= 360.0;
+		if (lon < -180.0)
+			lon += 360.0;
+	}
+}
+
+/* whether segment takes fast path of batch kernels */
+static bool IsShort(const LonLat& a, const LonLat& b) {
+	return fabs(b.GetLatD() / 180.0 * M_PI - a.GetLatD() / 180.0 * M_PI) <= batch_short_delta &&
+		fabs(b.GetLonD() / 180.0 * M_PI - a.GetLonD() / 180.0 * M_PI) <= batch_short_delta;
+}
+
+/*
+ * Error bounds are checked on segments taking fast path; longer ones
+ * (including short ones crossing antimeridian), which fall back to
+ * scalar functions, must give exactly their results. Returns false if
+ * any implementation fails.
+ */
+static bool Check(size_t npolylines, size_t count) {
+	std::mt19937 random(1);
+	std::vector<LonLat> points;
+	std::vector<long double> exact_distances(count), exact_bearings(count);
+	std::vector<double> scalar_distances(count), scalar_bearings(count);
+	std::vector<char> fast(count);
+	std::vector<double> out(count);
+	std::vector<double> max_distance_error(nimplementations, 0.0);
+	std::vector<double> max_bearing_error(nimplementations, 0.0);
+	std::vector<size_t> mismatches(nimplementations, 0);
+	size_t nfast = 0, nsegments = 0;
+
+	for (size_t npolyline = 0; npolyline < npolylines; ++npolyline) {
+		/* vary length to cover partially filled blocks and lanes */
+		size_t npoints = 2 + random() % (count - 1);
+		RandomPolyline(random, npoints, points);
+
+		ScalarDistances(points.data(), npoints, scalar_distances.data());
+		ScalarBearings(points.data(), npoints, scalar_bearings.data());
+		for (size_t i = 0; i + 1 < npoints; ++i) {
+			exact_distances[i] = ExactDistance(points[i], points[i + 1]);
+			exact_bearings[i] = ExactBearing(points[i], points[i + 1]);
+			fast[i] = IsShort(points[i], points[i + 1]);
+			nfast += fast[i];
+		}
+		nsegments += npoints - 1;
+
+		for (size_t nimpl = 0; nimpl < nimplementations; ++nimpl) {
+			const Implementation& impl = implementations[nimpl];
+
+			impl.distances(points.data(), npoints, out.data());
+			for (size_t i = 0; i + 1 < npoints; ++i) {
+				if (!fast[i]) {
+					mismatches[nimpl] += out[i] != scalar_distances[i];
+					continue;
+				}
+				double error = exact_distances[i] == 0.0L ? fabs(out[i]) : (double)(fabsl(out[i] - exact_distances[i]) / exact_distances[i]);
+				max_distance_error[nimpl] = std::max(max_distance_error[nimpl], error);
+			}
+
+			impl.bearings(points.data(), npoints, out.data());
+			for (size_t i = 0; i + 1 < npoints; ++i) {
+				if (!fast[i]) {
+					mismatches[nimpl] += out[i] != scalar_bearings[i];
+					continue;
+				}
+				/* bearing of zero length segment is meaningless */
+				if (exact_distances[i] == 0.0L)
+					continue;
+				double error = fabs(remainder((double)(out[i] - exact_bearings[i]), 2.0 * M_PI));
+				if (impl.scalar)
+					error *= std::min(1.0L, exact_distances[i]);
+				max_bearing_error[nimpl] = std::max(max_bearing_error[nimpl], error);
+			}
+		}
+	}
+
+	bool ok = true;
+	std::cout << "Max errors against exact formulae on " << nfast << " of " << nsegments << " segments taking fast path:" << std::endl;
+	for (size_t nimpl = 0; nimpl < nimplementations; ++nimpl) {
+		const Implementation& impl = implementations[nimpl];
+		double bound = impl.scalar ? scalar_bearing_bound : bearing_bound;
+		bool passed = max_distance_error[nimpl] <= distance_bound && max_bearing_error[nimpl] <= bound && mismatches[nimpl] == 0;
+		ok = ok && passed;
+
+		std::cout << "  " << std::left << std::setw(24) << impl.name << std::right << std::scientific << std::setprecision(2)
+			<< " distance " << max_distance_error[nimpl] << " (bound " << distance_bound << ")"
+			<< "  bearing " << max_bearing_error[nimpl] << " rad (bound " << bound << (impl.scalar ? " x 1 m / length" : "") << ")";
+		if (mismatches[nimpl] != 0)
+			std::cout << "  " << mismatches[nimpl] << " fallback results differ from scalar";
+		std::cout << (passed ? "" : "  FAILED") << std::endl;
+	}
+
+	return ok;
+}
+
+static void Bench(size_t count, int repeat) {
+	std::mt19937 random(2);
+	std::vector<LonLat> points;
+	RandomPolyline(random, count, points);
+	std::vector<double> out(count);
+
+	double sink = 0.0;
+	double scalar_distance_time = 0.0, scalar_bearing_time = 0.0;
+
+	std::cout << "Time per segment, " << count - 1 << " segments x " << repeat << ":" << std::endl;
+	for (size_t nimpl = 0; nimpl < nimplementations; ++nimpl) {
+		const Implementation& impl = implementations[nimpl];
+
+		BenchClock::time_point start = BenchClock::now();
+		for (int i = 0; i < repeat; ++i) {
+			impl.distances(points.data(), count, out.data());
+			sink += out[i % (count - 1)];
+		}
+		double distance_time = SecondsSince(start);
+
+		start = BenchClock::now();
+		for (int i = 0; i < repeat; ++i) {
+			impl.bearings(points.data(), count, out.data());
+			sink += out[i % (count - 1)];
+		}
+		double bearing_time = SecondsSince(start);
+
+		if (impl.scalar) {
+			scalar_distance_time = distance_time;
+			scalar_bearing_time = bearing_time;
+		}
+
+		double nsegments = (double)(count - 1) * repeat;
+		std::cout << "  " << std::left << std::setw(24) << impl.name << std::right << std::fixed << std::setprecision(2)
+			<< " distance " << std::setw(6) << distance_time / nsegments * 1e9 << " ns (x" << scalar_distance_time / distance_time << ")"
+			<< "  bearing " << std::setw(6) << bearing_time / nsegments * 1e9 << " ns (x" << scalar_bearing_time / bearing_time << ")" << std::endl;
+	}
+
+	/* keeps results from being optimized out */
+	if (sink == 0.123)
+		std::cout << std::endl;
+}
+
+void usage(const char* progname) {
+	std::cerr << "Usage: " << progname << " [-c] [-n points] [-r repeat]" << std::endl;
+	std::cerr << "  -c  only check error bounds, exiting with 1 if exceeded" << std::endl;
+	std::cerr << "  -n  number of polyline points for benchmark (default 100000)" << std::endl;
+	std::cerr << "  -r  number of benchmark repetitions (default 100)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+	bool check_only = false;
+	size_t count = 100000;
+	int repeat = 100;
+
+	int c;
+	while ((c = getopt(argc, argv, "cn:r:h")) != -1) {
+		switch (c) {
+		case 'c':
+			check_only = true;
+			break;
+		case 'n':
+			count = std::max(2L, atol(optarg));
+			break;
+		case 'r':
+			repeat = std::max(1, atoi(optarg));
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!Check(2000, 300))
+		return 1;
+
+	if (!check_only)
+		Bench(count, repeat);
+
+	return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <exception>
+#include <stdexcept>
+#include <cstdlib>
+
+#include "ParserBase.hh"
+#include "parallel.hh"
+#include "railrouting.hh"
+#include "bench.hh"
+
+/*
+ * Compares input ingest time with read(2) and mmap(2) input modes,
+ * both for bare parsing and for loading of routing data
+ */
+
+/* parser which only counts objects and checksums their contents */
+class CountingParser : public ParserBase<CountingParser> {
+public:
+	size_t nnodes;
+	size_t nways;
+	int64_t checksum;
+
+public:
+	CountingParser() : nnodes(0), nways(0), checksum(0) {
+		AddViewPass(&CountingParser::ProcessNode, &CountingParser::ProcessWay, NULL, NULL, false, "counting");
+	}
+
+	void ProcessNode(const NodeView& node) {
+		nnodes++;
+		checksum += node.id + node.lon + node.lat;
+	}
+
+	void ProcessWay(const WayView& way) {
+		nways++;
+		for (size_t i = 0; i < way.nrefs; ++i)
+			checksum += way.refs[i];
+	}
+};
+
+static const char* mode_names[] = { "read", "mmap", "mmap+parallel" };
+
+template <class P>
+static void SetupMode(P& parser, int nmode, int nthreads) {
+	parser.SetThreads(nthreads);
+	parser.SetInputMode(nmode == 0 ? P::READ_INPUT : P::MMAP_INPUT);
+	parser.SetParallelXml(nmode == 2);
+}
+
+static void PrintTimes(const char* what, const char* mode, const std::vector<double>& times, double megabytes) {
+	LatencyStats stats(times);
+	std::cout << "  " << std::left << std::setw(8) << what << std::setw(14) << mode << std::right << std::fixed << std::setprecision(1)
+		<< " mean " << std::setw(8) << stats.mean << " ms"
+		<< "  p50 " << std::setw(8) << stats.p50 << " ms"
+		<< "  " << std::setw(7) << (stats.p50 > 0.0 ? megabytes / stats.p50 * 1000.0 : 0.0) << " MB/s" << std::endl;
+}
+
+/* returns false if modes produced different data */
+static bool BenchInput(const std::string& label, const char* filename, int nthreads, int repeat) {
+	struct stat st;
+	if (stat(filename, &st) != 0)
+		throw std::runtime_error("cannot stat input file");
+	const double megabytes = st.st_size / 1048576.0;
+
+	std::cout << label << ": " << std::fixed << std::setprecision(1) << megabytes << " MB, " << nthreads << " threads" << std::endl;
+
+	/* parallel parsing needs more than one thread */
+	const int nmodes = nthreads > 1 ? 3 : 2;
+
+	bool consistent = true;
+	int64_t reference = 0;
+	for (int nmode = 0; nmode < nmodes; ++nmode) {
+		std::vector<double> times;
+		/* first run warms up page cache and is not counted */
+		for (int i = 0; i <= repeat; ++i) {
+			CountingParser parser;
+			SetupMode(parser, nmode, nthreads);
+
+			BenchClock::time_point start = BenchClock::now();
+			parser.Parse(filename);
+			if (i > 0)
+				times.push_back(SecondsSince(start));
+
+			int64_t checksum = parser.checksum + parser.nnodes + parser.nways;
+			if (nmode == 0 && i == 0)
+				reference = checksum;
+			else if (checksum != reference)
+				consistent = false;
+		}
+		PrintTimes("parse", mode_names[nmode], times, megabytes);
+	}
+
+	for (int nmode = 0; nmode < nmodes; ++nmode) {
+		std::vector<double> times;
+		for (int i = 0; i < repeat; ++i) {
+			RailRouting routing;
+			SetupMode(routing, nmode, nthreads);
+
+			BenchClock::time_point start = BenchClock::now();
+			routing.Parse(filename);
+			times.push_back(SecondsSince(start));
+		}
+		PrintTimes("load", mode_names[nmode], times, megabytes);
+	}
+
+	if (!consistent)
+		std::cout << "  ERROR: input modes produced different data" << std::endl;
+
+	return consistent;
+}
+
+void usage(const char* progname) {
+	std::cerr << "Usage: " << progname << " [-g size] [-j threads] [-r repeat] [file.osm]" << std::endl;
+	std::cerr << "  -g  size of synthetic grid network (default 200, 0 to skip)" << std::endl;
+	std::cerr << "  -j  number of threads for parallel parsing (default: number of CPUs)" << std::endl;
+	std::cerr << "  -r  number of timed runs of each mode (default 5)" << std::endl;
+	std::cerr << "  file.osm defaults to raildemo.osm" << std::endl;
+	std::cerr << "Progress is reported to stderr, which you may want to redirect." << std::endl;
+}
+
+int main(int argc, char** argv) {
+	int grid_size = 200;
+	int nthreads = DefaultThreads();
+	int repeat = 5;
+
+	int c;
+	while ((c = getopt(argc, argv, "g:j:r:h")) != -1) {
+		switch (c) {
+		case 'g':
+			grid_size = atoi(optarg);
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind > 1 || repeat < 1 || nthreads < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	const char* filename = argc - optind == 1 ? argv[optind] : "raildemo.osm";
+
+	try {
+		bool consistent = BenchInput(filename, filename, nthreads, repeat);
+
+		if (grid_size > 0) {
+			SyntheticGrid grid(grid_size);
+
+			std::stringstream label;
+			label << grid_size << "x" << grid_size << " grid";
+			consistent = BenchInput(label.str(), grid.GetFilename(), nthreads, repeat) && consistent;
+		}
+
+		return consistent ? 0 : 1;
+	} catch (std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+}
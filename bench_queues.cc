@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <exception>
+#include <cstdlib>
+#include <cmath>
+
+#include "railrouting.hh"
+#include "bench.hh"
+
+/*
+ * Compares search priority queues by FindRoute latency on the same
+ * random station pairs, on given OSM file and on synthetic grid
+ */
+
+struct QueueInfo {
+	RailRouting::QueueType type;
+	const char* name;
+};
+
+static const QueueInfo queues[] = {
+	{ RailRouting::MULTIMAP_QUEUE, "multimap" },
+	{ RailRouting::BINARY_HEAP_QUEUE, "binary" },
+	{ RailRouting::QUATERNARY_HEAP_QUEUE, "4ary" },
+	{ RailRouting::RADIX_HEAP_QUEUE, "radix" },
+};
+
+/* returns false if queues found routes of different length */
+static bool BenchNetwork(const std::string& label, const RailRouting& routing, RailRouting::SearchMode mode, size_t nqueries) {
+	std::vector<std::string> names;
+	routing.CompleteStations("", (size_t)-1, names);
+
+	std::vector<std::pair<std::string, std::string> > pairs;
+	RandomPairs(names, nqueries, pairs);
+
+	std::cout << label << ": " << names.size() << " stations, " << pairs.size() << " queries" << std::endl;
+
+	std::vector<double> reference;
+	bool consistent = true;
+	for (size_t nqueue = 0; nqueue < sizeof(queues)/sizeof(queues[0]); ++nqueue) {
+		RailRouting::QueryContext context;
+		RailRouting::FindRouteResult result;
+		std::vector<double> latencies;
+		std::vector<double> distances;
+		double settled = 0.0;
+
+		/* warm up context arrays */
+		if (!pairs.empty())
+			routing.FindRoute(context, pairs[0].first, pairs[0].second, result, mode, queues[nqueue].type);
+
+		for (size_t i = 0; i < pairs.size(); ++i) {
+			BenchClock::time_point start = BenchClock::now();
+			routing.FindRoute(context, pairs[i].first, pairs[i].second, result, mode, queues[nqueue].type);
+			latencies.push_back(SecondsSince(start));
+			distances.push_back(result.status == RailRouting::FindRouteResult::OK ? result.distance : -1.0);
+			settled += result.settled_count;
+		}
+
+		/* radix heap quantizes lengths, so allow for rounding */
+		if (reference.empty())
+			reference = distances;
+		for (size_t i = 0; i < distances.size(); ++i)
+			if (std::fabs(distances[i] - reference[i]) > 0.01)
+				consistent = false;
+
+		LatencyStats stats(latencies);
+		std::cout << "  " << std::left << std::setw(10) << queues[nqueue].name << std::right << std::fixed << std::setprecision(3)
+			<< " mean " << std::setw(9) << stats.mean << " ms"
+			<< "  p50 " << std::setw(9) << stats.p50 << " ms"
+			<< "  p99 " << std::setw(9) << stats.p99 << " ms"
+			<< "  settled " << std::setprecision(0) << (pairs.empty() ? 0.0 : settled / pairs.size()) << std::endl;
+	}
+
+	if (!consistent)
+		std::cout << "  ERROR: queues found routes of different length" << std::endl;
+
+	return consistent;
+}
+
+void usage(const char* progname) {
+	std::cerr << "Usage: " << progname << " [-a] [-g size] [-n queries] [file.osm]" << std::endl;
+	std::cerr << "  -a  use A* search instead of Dijkstra" << std::endl;
+	std::cerr << "  -g  size of synthetic grid network (default 200, 0 to skip)" << std::endl;
+	std::cerr << "  -n  number of random station pairs to query (default 200)" << std::endl;
+	std::cerr << "  file.osm defaults to raildemo.osm" << std::endl;
+}
+
+int main(int argc, char** argv) {
+	RailRouting::SearchMode mode = RailRouting::DIJKSTRA_SEARCH;
+	int grid_size = 200;
+	size_t nqueries = 200;
+
+	int c;
+	while ((c = getopt(argc, argv, "ag:n:h")) != -1) {
+		switch (c) {
+		case 'a':
+			mode = RailRouting::ASTAR_SEARCH;
+			break;
+		case 'g':
+			grid_size = atoi(optarg);
+			break;
+		case 'n':
+			nqueries = atol(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind > 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	const char* filename = argc - optind == 1 ? argv[optind] : "raildemo.osm";
+
+	try {
+		bool consistent = true;
+
+		{
+			RailRouting routing;
+			routing.Parse(filename);
+			consistent = BenchNetwork(filename, routing, mode, nqueries) && consistent;
+		}
+
+		if (grid_size > 0) {
+			SyntheticGrid grid(grid_size);
+			RailRouting routing;
+			routing.Parse(grid.GetFilename());
+
+			std::stringstream label;
+			label << grid_size << "x" << grid_size << " grid";
+			consistent = BenchNetwork(label.str(), routing, mode, nqueries) && consistent;
+		}
+
+		return consistent ? 0 : 1;
+	} catch (std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+}
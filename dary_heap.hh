@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DARY_HEAP_HH
+#define DARY_HEAP_HH
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * Indexed d-ary min-heap of items with priorities
+ *
+ * Items are integers in range [0, size), and each one is present
+ * in the heap at most once: pushing an item which is already there
+ * decreases its priority in place (increases are ignored). Larger
+ * D makes the heap shallower, which makes pushes and decreases
+ * cheaper at the cost of pops.
+ */
+template <int D, typename Priority = double>
+class dary_heap {
+private:
+	struct Entry {
+		Priority priority;
+		int item;
+	};
+
+private:
+	std::vector<Entry> heap_;
+
+	/* position of each item in heap, -1 if it's not there */
+	std::vector<int> positions_;
+
+private:
+	void Place(size_t pos, const Entry& entry) {
+		heap_[pos] = entry;
+		positions_[entry.item] = pos;
+	}
+
+	void SiftUp(size_t pos, const Entry& entry) {
+		while (pos > 0) {
+			const size_t parent = (pos - 1) / D;
+			if (!(entry.priority < heap_[parent].priority))
+				break;
+			Place(pos, heap_[parent]);
+			pos = parent;
+		}
+		Place(pos, entry);
+	}
+
+	void SiftDown(size_t pos, const Entry& entry) {
+		for (;;) {
+			const size_t first = pos * D + 1;
+			if (first >= heap_.size())
+				break;
+
+			const size_t last = first + D < heap_.size() ? first + D : heap_.size();
+			size_t best = first;
+			for (size_t child = first + 1; child < last; ++child)
+				if (heap_[child].priority < heap_[best].priority)
+					best = child;
+
+			if (!(heap_[best].priority < entry.priority))
+				break;
+			Place(pos, heap_[best]);
+			pos = best;
+		}
+		Place(pos, entry);
+	}
+
+	dary_heap(const dary_heap&);
+	dary_heap& operator=(const dary_heap&);
+
+public:
+	dary_heap(size_t size = 0) : positions_(size, -1) {
+	}
+
+	/* empties the heap and makes it accept items in range [0, size);
+	 * takes time proportional to number of items left in the heap
+	 * unless size changes */
+	void reset(size_t size) {
+		if (size != positions_.size()) {
+			positions_.assign(size, -1);
+		} else {
+			for (typename std::vector<Entry>::const_iterator entry = heap_.begin(); entry != heap_.end(); ++entry)
+				positions_[entry->item] = -1;
+		}
+		heap_.clear();
+	}
+
+	bool empty() const {
+		return heap_.empty();
+	}
+
+	size_t size() const {
+		return heap_.size();
+	}
+
+	int top() const {
+		return heap_.front().item;
+	}
+
+	Priority top_priority() const {
+		return heap_.front().priority;
+	}
+
+	void push(int item, Priority priority) {
+		Entry entry = { priority, item };
+
+		const int pos = positions_[item];
+		if (pos == -1) {
+			heap_.push_back(entry);
+			SiftUp(heap_.size() - 1, entry);
+		} else if (priority < heap_[pos].priority) {
+			SiftUp(pos, entry);
+		}
+	}
+
+	void pop() {
+		positions_[heap_.front().item] = -1;
+
+		const Entry last = heap_.back();
+		heap_.pop_back();
+		if (!heap_.empty())
+			SiftDown(0, last);
+	}
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FROZEN_ARRAY_HH
+#define FROZEN_ARRAY_HH
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * Immutable array which either owns its data, or references
+ * external memory, such as mmap()ed file
+ */
+template <typename T>
+class frozen_array {
+private:
+	std::vector<T> storage_;
+
+	const T* data_;
+	size_t size_;
+
+private:
+	frozen_array(const frozen_array&);
+	frozen_array& operator=(const frozen_array&);
+
+public:
+	typedef const T* const_iterator;
+
+public:
+	frozen_array() : data_(NULL), size_(0) {
+	}
+
+	/* takes ownership of vector contents */
+	void assign(std::vector<T>& data) {
+		storage_.swap(data);
+		std::vector<T>().swap(data);
+		data_ = storage_.data();
+		size_ = storage_.size();
+	}
+
+	/* references external data, which must outlive the array */
+	void assign(const T* data, size_t size) {
+		std::vector<T>().swap(storage_);
+		data_ = data;
+		size_ = size;
+	}
+
+	void clear() {
+		std::vector<T>().swap(storage_);
+		data_ = NULL;
+		size_ = 0;
+	}
+
+	const T& operator[](size_t n) const {
+		return data_[n];
+	}
+
+	const T* data() const {
+		return data_;
+	}
+
+	size_t size() const {
+		return size_;
+	}
+
+	bool empty() const {
+		return size_ == 0;
+	}
+
+	const_iterator begin() const {
+		return data_;
+	}
+
+	const_iterator end() const {
+		return data_ + size_;
+	}
+};
+
+#endif
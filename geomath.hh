@@ -20,7 +20,14 @@
 #ifndef GEOMATH_HH
 #define GEOMATH_HH
 
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#	include <immintrin.h>
+#endif
 
 #include "ObjectBases.hh"
 
@@ -51,4 +58,306 @@ static inline double Bearing(const LonLat& a, const LonLat& b) {
 	return atan2(y, x);
 }
 
+/*
+ * Batch versions of Distance() and Bearing() which process whole
+ * polylines with SIMD kernels.
+ *
+ * Kernels are written once over lanes type which wraps a set of
+ * vector (or scalar) operations; AVX (4 lanes) is used if enabled at
+ * compile time, SSE2 (2 lanes) otherwise, and plain doubles on other
+ * architectures.
+ *
+ * Trigonometry of segments is replaced with series in angular
+ * deltas: equirectangular approximation refined with sin and asin
+ * terms up to 7th order. For deltas within batch_short_delta
+ * truncation error is below 1e-18 relative, so distances stay
+ * within 2.1e-15 relative of exact formula, same as Distance(),
+ * and well within 1e-9 margin A* lower bounds keep below it.
+ * Bearings stay within 1e-12 rad, which is better than Bearing()
+ * itself gives on short segments (up to 5e-9 rad lost to
+ * cancellation on 1 m segments, and inversely proportional to
+ * length on shorter ones). Longer segments, rare on rail tracks,
+ * fall back to scalar functions. bench_geomath checks these bounds.
+ *
+ * Remaining per point trigonometry (sin and cos of latitude) and
+ * atan2 of bearings use Cephes polynomial approximations, which
+ * are accurate within 2 ulp.
+ */
+
+/* max angular delta (lon or lat, in radians) of fast path segment */
+static const double batch_short_delta = 1.0 / 128.0;
+
+/* number of points converted to radians at once */
+static const size_t batch_block = 64;
+
+struct ScalarLanes {
+	typedef double Vec;
+	typedef bool Mask;
+
+	static const int width = 1;
+
+	static Vec Splat(double x) { return x; }
+	static Vec Load(const double* p) { return *p; }
+	static void Store(double* p, Vec v) { *p = v; }
+
+	static Vec Sqrt(Vec v) { return sqrt(v); }
+	static Vec Abs(Vec v) { return fabs(v); }
+	static Vec CopySign(Vec mag, Vec sign) { return copysign(mag, sign); }
+
+	static Mask Greater(Vec a, Vec b) { return a > b; }
+	static Mask Or(Mask a, Mask b) { return a || b; }
+	static Vec Select(Mask m, Vec a, Vec b) { return m ? a : b; }
+	static int Bits(Mask m) { return m ? 1 : 0; }
+};
+
+#if defined(__SSE2__)
+struct SseLanes {
+	typedef __m128d Vec;
+	typedef __m128d Mask;
+
+	static const int width = 2;
+
+	static Vec Splat(double x) { return _mm_set1_pd(x); }
+	static Vec Load(const double* p) { return _mm_loadu_pd(p); }
+	static void Store(double* p, Vec v) { _mm_storeu_pd(p, v); }
+
+	static Vec Sqrt(Vec v) { return _mm_sqrt_pd(v); }
+	static Vec Abs(Vec v) { return _mm_andnot_pd(_mm_set1_pd(-0.0), v); }
+	static Vec CopySign(Vec mag, Vec sign) { return _mm_or_pd(Abs(mag), _mm_and_pd(_mm_set1_pd(-0.0), sign)); }
+
+	static Mask Greater(Vec a, Vec b) { return _mm_cmpgt_pd(a, b); }
+	static Mask Or(Mask a, Mask b) { return _mm_or_pd(a, b); }
+	static Vec Select(Mask m, Vec a, Vec b) { return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+	static int Bits(Mask m) { return _mm_movemask_pd(m); }
+};
+#endif
+
+#if defined(__AVX__)
+struct AvxLanes {
+	typedef __m256d Vec;
+	typedef __m256d Mask;
+
+	static const int width = 4;
+
+	static Vec Splat(double x) { return _mm256_set1_pd(x); }
+	static Vec Load(const double* p) { return _mm256_loadu_pd(p); }
+	static void Store(double* p, Vec v) { _mm256_storeu_pd(p, v); }
+
+	static Vec Sqrt(Vec v) { return _mm256_sqrt_pd(v); }
+	static Vec Abs(Vec v) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), v); }
+	static Vec CopySign(Vec mag, Vec sign) { return _mm256_or_pd(Abs(mag), _mm256_and_pd(_mm256_set1_pd(-0.0), sign)); }
+
+	static Mask Greater(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+	static Mask Or(Mask a, Mask b) { return _mm256_or_pd(a, b); }
+	static Vec Select(Mask m, Vec a, Vec b) { return _mm256_blendv_pd(b, a, m); }
+	static int Bits(Mask m) { return _mm256_movemask_pd(m); }
+};
+
+typedef AvxLanes BatchLanes;
+#elif defined(__SSE2__)
+typedef SseLanes BatchLanes;
+#else
+typedef ScalarLanes BatchLanes;
+#endif
+
+/* sin and cos of latitude (|x| <= pi/2); argument is reduced to
+ * [0, pi/4] by symmetry around pi/4 */
+template <class L>
+static inline void SinCosLat(typename L::Vec x, typename L::Vec& s, typename L::Vec& c) {
+	typedef typename L::Vec Vec;
+
+	const Vec ax = L::Abs(x);
+	const typename L::Mask big = L::Greater(ax, L::Splat(M_PI / 4.0));
+	const Vec r = L::Select(big, (L::Splat(1.57079632679489655800e+00) - ax) + L::Splat(6.12323399573676603587e-17), ax);
+	const Vec z = r * r;
+
+	Vec ps = L::Splat(1.58962301576546568060e-10);
+	ps = ps * z + L::Splat(-2.50507477628578072866e-08);
+	ps = ps * z + L::Splat(2.75573136213857245213e-06);
+	ps = ps * z + L::Splat(-1.98412698295895385996e-04);
+	ps = ps * z + L::Splat(8.33333333332211858878e-03);
+	ps = ps * z + L::Splat(-1.66666666666666307295e-01);
+	ps = r + r * z * ps;
+
+	Vec pc = L::Splat(-1.13585365213876817300e-11);
+	pc = pc * z + L::Splat(2.08757008419747316778e-09);
+	pc = pc * z + L::Splat(-2.75573141792967388112e-07);
+	pc = pc * z + L::Splat(2.48015872888517045348e-05);
+	pc = pc * z + L::Splat(-1.38888888888730564116e-03);
+	pc = pc * z + L::Splat(4.16666666666665929218e-02);
+	pc = L::Splat(1.0) - L::Splat(0.5) * z + z * z * pc;
+
+	s = L::CopySign(L::Select(big, pc, ps), x);
+	c = L::Select(big, ps, pc);
+}
+
+/* atan2(y, x); argument of atan is reduced to [0, 0.66] */
+template <class L>
+static inline typename L::Vec Atan2(typename L::Vec y, typename L::Vec x) {
+	typedef typename L::Vec Vec;
+
+	const Vec zero = L::Splat(0.0);
+	const Vec one = L::Splat(1.0);
+
+	const Vec ax = L::Abs(x);
+	const Vec ay = L::Abs(y);
+
+	const typename L::Mask swap = L::Greater(ay, ax);
+	const Vec num = L::Select(swap, ax, ay);
+	const Vec den = L::Select(swap, ay, ax);
+
+	/* (0, 0) gives 0 */
+	Vec t = num / L::Select(L::Greater(den, zero), den, one);
+
+	const typename L::Mask mid = L::Greater(t, L::Splat(0.66));
+	t = L::Select(mid, (t - one) / (t + one), t);
+
+	const Vec z = t * t;
+
+	Vec p = L::Splat(-8.750608600031904122785e-01);
+	p = p * z + L::Splat(-1.615753718733365076637e+01);
+	p = p * z + L::Splat(-7.500855792314704667340e+01);
+	p = p * z + L::Splat(-1.228866684490136173410e+02);
+	p = p * z + L::Splat(-6.485021904942025371773e+01);
+
+	Vec q = z + L::Splat(2.485846490142306297962e+01);
+	q = q * z + L::Splat(1.650270098316988542046e+02);
+	q = q * z + L::Splat(4.328810604912902668951e+02);
+	q = q * z + L::Splat(4.853903996359136964868e+02);
+	q = q * z + L::Splat(1.945506571482613964425e+02);
+
+	Vec r = L::Select(mid, L::Splat(M_PI / 4.0), zero) + (t * z * p / q + t + L::Select(mid, L::Splat(3.061616997868382943065e-17), zero));
+	r = L::Select(swap, (L::Splat(1.57079632679489655800e+00) - r) + L::Splat(6.12323399573676603587e-17), r);
+	r = L::Select(L::Greater(zero, x), (L::Splat(3.14159265358979311600e+00) - r) + L::Splat(1.22464679914735320717e-16), r);
+
+	return L::CopySign(r, y);
+}
+
+/* converts points to radians, padding arrays with the last point
+ * up to batch_block + 4 entries */
+template <class Point>
+static inline void BatchRadians(const Point* points, size_t count, double* lon, double* lat) {
+	for (size_t i = 0; i < count; ++i) {
+		lon[i] = points[i].GetLonD() / 180.0 * M_PI;
+		lat[i] = points[i].GetLatD() / 180.0 * M_PI;
+	}
+	for (size_t i = count; i < batch_block + 4; ++i) {
+		lon[i] = lon[count - 1];
+		lat[i] = lat[count - 1];
+	}
+}
+
+template <class L, class Point>
+static inline void DistancesKernel(const Point* points, size_t nsegments, double* distances) {
+	typedef typename L::Vec Vec;
+
+	double lon[batch_block + 4], lat[batch_block + 4], coslat[batch_block + 4], out[batch_block];
+
+	BatchRadians(points, nsegments + 1, lon, lat);
+
+	for (size_t i = 0; i <= nsegments; i += L::width) {
+		Vec s, c;
+		SinCosLat<L>(L::Load(lat + i), s, c);
+		L::Store(coslat + i, c);
+	}
+
+	const Vec one = L::Splat(1.0);
+	const Vec limit = L::Splat(batch_short_delta / 2.0);
+
+	for (size_t i = 0; i < nsegments; i += L::width) {
+		/* half deltas */
+		const Vec a = (L::Load(lat + i + 1) - L::Load(lat + i)) * L::Splat(0.5);
+		const Vec b = (L::Load(lon + i + 1) - L::Load(lon + i)) * L::Splat(0.5);
+
+		/* sin of half deltas */
+		const Vec a2 = a * a;
+		const Vec b2 = b * b;
+		const Vec sina = a * (one - a2 * L::Splat(1.0 / 6.0) * (one - a2 * L::Splat(1.0 / 20.0)));
+		const Vec sinb = b * (one - b2 * L::Splat(1.0 / 6.0) * (one - b2 * L::Splat(1.0 / 20.0)));
+
+		/* haversine of central angle and its asin */
+		const Vec h = sina * sina + L::Load(coslat + i) * L::Load(coslat + i + 1) * sinb * sinb;
+		const Vec asin = L::Sqrt(h) * (one + h * (L::Splat(1.0 / 6.0) + h * (L::Splat(3.0 / 40.0) + h * L::Splat(5.0 / 112.0))));
+
+		L::Store(out + i, asin * L::Splat(2.0 * 6378137.0));
+
+		int longs = L::Bits(L::Or(L::Greater(L::Abs(a), limit), L::Greater(L::Abs(b), limit)));
+		for (int lane = 0; longs != 0; ++lane, longs >>= 1)
+			if (longs & 1 && i + lane < nsegments)
+				out[i + lane] = Distance(points[i + lane], points[i + lane + 1]);
+	}
+
+	memcpy(distances, out, nsegments * sizeof(double));
+}
+
+template <class L, class Point>
+static inline void BearingsKernel(const Point* points, size_t nsegments, double* bearings) {
+	typedef typename L::Vec Vec;
+
+	double lon[batch_block + 4], lat[batch_block + 4], sinlat[batch_block + 4], coslat[batch_block + 4], out[batch_block];
+
+	BatchRadians(points, nsegments + 1, lon, lat);
+
+	for (size_t i = 0; i <= nsegments; i += L::width) {
+		Vec s, c;
+		SinCosLat<L>(L::Load(lat + i), s, c);
+		L::Store(sinlat + i, s);
+		L::Store(coslat + i, c);
+	}
+
+	const Vec one = L::Splat(1.0);
+	const Vec limit = L::Splat(batch_short_delta);
+
+	for (size_t i = 0; i < nsegments; i += L::width) {
+		const Vec dlat = L::Load(lat + i + 1) - L::Load(lat + i);
+		const Vec dlon = L::Load(lon + i + 1) - L::Load(lon + i);
+
+		const Vec z = dlat * dlat;
+		const Vec w = dlon * dlon;
+		const Vec sindlat = dlat * (one - z * L::Splat(1.0 / 6.0) * (one - z * L::Splat(1.0 / 20.0) * (one - z * L::Splat(1.0 / 42.0))));
+		const Vec sindlon = dlon * (one - w * L::Splat(1.0 / 6.0) * (one - w * L::Splat(1.0 / 20.0) * (one - w * L::Splat(1.0 / 42.0))));
+		const Vec versdlon = w * L::Splat(0.5) * (one - w * L::Splat(1.0 / 12.0) * (one - w * L::Splat(1.0 / 30.0) * (one - w * L::Splat(1.0 / 56.0))));
+
+		/* same as in Bearing(), but x is expanded as
+		 * sin(dlat) + sin(alat) cos(blat) (1 - cos(dlon))
+		 * to avoid cancellation on short segments */
+		const Vec coslatb = L::Load(coslat + i + 1);
+		const Vec y = sindlon * coslatb;
+		const Vec x = sindlat + L::Load(sinlat + i) * coslatb * versdlon;
+
+		L::Store(out + i, Atan2<L>(y, x));
+
+		int longs = L::Bits(L::Or(L::Greater(L::Abs(dlat), limit), L::Greater(L::Abs(dlon), limit)));
+		for (int lane = 0; longs != 0; ++lane, longs >>= 1)
+			if (longs & 1 && i + lane < nsegments)
+				out[i + lane] = Bearing(points[i + lane], points[i + lane + 1]);
+	}
+
+	memcpy(bearings, out, nsegments * sizeof(double));
+}
+
+/**
+ * Calculates distances between consecutive points of a polyline
+ *
+ * Writes count - 1 values, same as Distance() of each pair of
+ * points within a few ulp.
+ */
+template <class Point>
+static inline void Distances(const Point* points, size_t count, double* distances) {
+	for (size_t first = 0; first + 1 < count; first += batch_block)
+		DistancesKernel<BatchLanes>(points + first, std::min(batch_block, count - 1 - first), distances + first);
+}
+
+/**
+ * Calculates bearings of consecutive segments of a polyline
+ *
+ * Writes count - 1 values, same as Bearing() of each pair of
+ * points within a few ulp.
+ */
+template <class Point>
+static inline void Bearings(const Point* points, size_t count, double* bearings) {
+	for (size_t first = 0; first + 1 < count; first += batch_block)
+		BearingsKernel<BatchLanes>(points + first, std::min(batch_block, count - 1 - first), bearings + first);
+}
+
 #endif
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ID_BITMAP_HH
+#define ID_BITMAP_HH
+
+#include <vector>
+#include <set>
+#include <cstring>
+#include <stdint.h>
+
+#include "osmtypes.h"
+
+/**
+ * Set of object ids, stored as bitmap
+ *
+ * Bitmap is split into pages which are allocated on first use, so
+ * memory used is proportional to range of ids actually present
+ * (8KB per 64K ids) rather than to maximal id. Negative ids, which
+ * editors such as JOSM use for objects not uploaded yet, are few
+ * and are kept in a std::set aside of the bitmap.
+ */
+class id_bitmap {
+private:
+	static const int page_bits_ = 16;
+	static const size_t page_words_ = (1 << page_bits_) / 64;
+
+	typedef std::vector<uint64_t*> PageVector;
+
+private:
+	PageVector pages_;
+	std::set<osmid_t> negative_;
+	size_t count_;
+
+private:
+	id_bitmap(const id_bitmap&);
+	id_bitmap& operator=(const id_bitmap&);
+
+public:
+	id_bitmap() : count_(0) {
+	}
+
+	~id_bitmap() {
+		clear();
+	}
+
+	void set(osmid_t id) {
+		if (id < 0) {
+			if (negative_.insert(id).second)
+				count_++;
+			return;
+		}
+
+		size_t page = id >> page_bits_;
+		if (page >= pages_.size())
+			pages_.resize(page + 1, NULL);
+		if (pages_[page] == NULL) {
+			pages_[page] = new uint64_t[page_words_];
+			memset(pages_[page], 0, page_words_ * sizeof(uint64_t));
+		}
+
+		uint64_t& word = pages_[page][(id >> 6) & (page_words_ - 1)];
+		uint64_t bit = (uint64_t)1 << (id & 63);
+		if (!(word & bit)) {
+			word |= bit;
+			count_++;
+		}
+	}
+
+	bool test(osmid_t id) const {
+		if (id < 0)
+			return negative_.find(id) != negative_.end();
+
+		size_t page = id >> page_bits_;
+		if (page >= pages_.size() || pages_[page] == NULL)
+			return false;
+		return pages_[page][(id >> 6) & (page_words_ - 1)] & ((uint64_t)1 << (id & 63));
+	}
+
+	/* finds first id >= from which is in the set; returns false if
+	 * there's none */
+	bool next(osmid_t from, osmid_t& id) const {
+		if (from < 0) {
+			std::set<osmid_t>::const_iterator negative = negative_.lower_bound(from);
+			if (negative != negative_.end()) {
+				id = *negative;
+				return true;
+			}
+			from = 0;
+		}
+
+		for (size_t page = from >> page_bits_; page < pages_.size(); ++page) {
+			if (pages_[page] == NULL)
+				continue;
+
+			size_t start = (osmid_t)page << page_bits_ < from ? from & ((1 << page_bits_) - 1) : 0;
+			for (size_t word = start / 64; word < page_words_; ++word) {
+				uint64_t bits = pages_[page][word];
+				/* drop bits below start in the first word */
+				if (word == start / 64)
+					bits &= ~(uint64_t)0 << (start & 63);
+				if (bits != 0) {
+					id = ((osmid_t)page << page_bits_) + word * 64 + __builtin_ctzll(bits);
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	size_t count() const {
+		return count_;
+	}
+
+	bool empty() const {
+		return count_ == 0;
+	}
+
+	void clear() {
+		for (PageVector::iterator page = pages_.begin(); page != pages_.end(); ++page)
+			delete[] *page;
+		PageVector().swap(pages_);
+		negative_.clear();
+		count_ = 0;
+	}
+};
+
+#endif
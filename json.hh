@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JSON_HH
+#define JSON_HH
+
+#include <map>
+#include <string>
+#include <ostream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+
+/**
+ * Minimal reader of JSON objects, enough for lines of JSONL files
+ *
+ * Parses object with string, number, boolean and null values into
+ * map from key to value; strings are unescaped, other values are
+ * kept as is. Nested objects and arrays are not supported. Throws
+ * std::runtime_error on invalid input.
+ */
+class JsonObjectParser {
+private:
+	const std::string& text_;
+	size_t pos_;
+
+private:
+	void Fail() {
+		throw std::runtime_error("invalid JSON object");
+	}
+
+	void SkipSpace() {
+		while (pos_ < text_.size() && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\r' || text_[pos_] == '\n'))
+			pos_++;
+	}
+
+	void Expect(char c) {
+		SkipSpace();
+		if (pos_ >= text_.size() || text_[pos_] != c)
+			Fail();
+		pos_++;
+	}
+
+	unsigned int ParseHex4() {
+		if (pos_ + 4 > text_.size())
+			Fail();
+
+		unsigned int code = 0;
+		for (int i = 0; i < 4; ++i) {
+			const char c = text_[pos_++];
+			code <<= 4;
+			if (c >= '0' && c <= '9')
+				code |= c - '0';
+			else if (c >= 'a' && c <= 'f')
+				code |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				code |= c - 'A' + 10;
+			else
+				Fail();
+		}
+		return code;
+	}
+
+	static void AppendUtf8(std::string& out, uint32_t code) {
+		if (code < 0x80) {
+			out += (char)code;
+		} else if (code < 0x800) {
+			out += (char)(0xC0 | (code >> 6));
+			out += (char)(0x80 | (code & 0x3F));
+		} else if (code < 0x10000) {
+			out += (char)(0xE0 | (code >> 12));
+			out += (char)(0x80 | ((code >> 6) & 0x3F));
+			out += (char)(0x80 | (code & 0x3F));
+		} else {
+			out += (char)(0xF0 | (code >> 18));
+			out += (char)(0x80 | ((code >> 12) & 0x3F));
+			out += (char)(0x80 | ((code >> 6) & 0x3F));
+			out += (char)(0x80 | (code & 0x3F));
+		}
+	}
+
+	std::string ParseString() {
+		Expect('"');
+
+		std::string out;
+		for (;;) {
+			if (pos_ >= text_.size())
+				Fail();
+
+			const char c = text_[pos_++];
+			if (c == '"')
+				return out;
+			if ((unsigned char)c < 0x20)
+				Fail();
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+
+			if (pos_ >= text_.size())
+				Fail();
+
+			switch (text_[pos_++]) {
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '/': out += '/'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u': {
+				uint32_t code = ParseHex4();
+				/* characters outside BMP are escaped as surrogate pairs */
+				if (code >= 0xD800 && code < 0xDC00) {
+					if (pos_ + 2 > text_.size() || text_[pos_] != '\\' || text_[pos_ + 1] != 'u')
+						Fail();
+					pos_ += 2;
+					const uint32_t low = ParseHex4();
+					if (low < 0xDC00 || low >= 0xE000)
+						Fail();
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				} else if (code >= 0xDC00 && code < 0xE000) {
+					Fail();
+				}
+				AppendUtf8(out, code);
+				break;
+			}
+			default:
+				Fail();
+			}
+		}
+	}
+
+	std::string ParseLiteral() {
+		SkipSpace();
+
+		const size_t start = pos_;
+		while (pos_ < text_.size() && text_[pos_] != ',' && text_[pos_] != '}' && text_[pos_] != ' ' && text_[pos_] != '\t' && text_[pos_] != '\r' && text_[pos_] != '\n')
+			pos_++;
+
+		const std::string literal = text_.substr(start, pos_ - start);
+		if (literal != "true" && literal != "false" && literal != "null") {
+			char* end;
+			strtod(literal.c_str(), &end);
+			if (literal.empty() || *end != '\0')
+				Fail();
+		}
+		return literal;
+	}
+
+public:
+	JsonObjectParser(const std::string& text) : text_(text), pos_(0) {
+	}
+
+	void Parse(std::map<std::string, std::string>& fields) {
+		fields.clear();
+
+		Expect('{');
+		SkipSpace();
+		if (pos_ < text_.size() && text_[pos_] == '}') {
+			pos_++;
+		} else {
+			for (;;) {
+				const std::string key = ParseString();
+				Expect(':');
+				SkipSpace();
+				if (pos_ < text_.size() && text_[pos_] == '"')
+					fields[key] = ParseString();
+				else
+					fields[key] = ParseLiteral();
+
+				SkipSpace();
+				if (pos_ < text_.size() && text_[pos_] == ',') {
+					pos_++;
+					continue;
+				}
+				Expect('}');
+				break;
+			}
+		}
+
+		SkipSpace();
+		if (pos_ != text_.size())
+			Fail();
+	}
+};
+
+/**
+ * Writes string as JSON string literal
+ */
+static inline void WriteJsonString(std::ostream& stream, const std::string& str) {
+	stream << '"';
+	for (std::string::const_iterator c = str.begin(); c != str.end(); ++c) {
+		switch (*c) {
+		case '"': stream << "\\\""; break;
+		case '\\': stream << "\\\\"; break;
+		case '\n': stream << "\\n"; break;
+		case '\r': stream << "\\r"; break;
+		case '\t': stream << "\\t"; break;
+		default:
+			if ((unsigned char)*c < 0x20) {
+				char escape[8];
+				snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)*c);
+				stream << escape;
+			} else {
+				stream << *c;
+			}
+		}
+	}
+	stream << '"';
+}
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LRU_CACHE_HH
+#define LRU_CACHE_HH
+
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+
+/**
+ * Thread safe size-bounded LRU cache of immutable values
+ *
+ * Entries are distributed between independently locked shards by
+ * key hash, so concurrent lookups rarely contend. Each shard holds
+ * its part of capacity and evicts its least recently used entries.
+ * Values are shared, so lookups don't copy them, and values stay
+ * valid while used even if they are evicted.
+ */
+template <class Key, class Value, class Hash = std::hash<Key> >
+class lru_cache {
+public:
+	typedef std::shared_ptr<const Value> ValuePtr;
+
+private:
+	typedef std::list<std::pair<Key, ValuePtr> > EntryList;
+	typedef std::unordered_map<Key, typename EntryList::iterator, Hash> EntryMap;
+
+	struct Shard {
+		std::mutex mutex;
+
+		/* entries from most to least recently used */
+		EntryList entries;
+		EntryMap index;
+	};
+
+private:
+	std::unique_ptr<Shard[]> shards_;
+	const size_t nshards_;
+	const size_t shard_capacity_;
+
+	Hash hash_;
+
+	std::atomic<size_t> hits_;
+	std::atomic<size_t> misses_;
+
+private:
+	Shard& ShardOf(const Key& key) const {
+		const size_t hash = hash_(key);
+		/* hash maps use low bits too, so mix in high ones */
+		return shards_[(hash ^ (hash >> 16)) % nshards_];
+	}
+
+	lru_cache(const lru_cache&);
+	lru_cache& operator=(const lru_cache&);
+
+public:
+	lru_cache(size_t capacity, size_t nshards = 16)
+		: shards_(new Shard[nshards]),
+		  nshards_(nshards),
+		  shard_capacity_(capacity > nshards ? (capacity + nshards - 1) / nshards : 1),
+		  hits_(0),
+		  misses_(0) {
+	}
+
+	/* returns cached value, or null pointer if there's none */
+	ValuePtr get(const Key& key) {
+		Shard& shard = ShardOf(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		typename EntryMap::const_iterator found = shard.index.find(key);
+		if (found == shard.index.end()) {
+			misses_++;
+			return ValuePtr();
+		}
+
+		hits_++;
+		shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+		return found->second->second;
+	}
+
+	void put(const Key& key, const ValuePtr& value) {
+		Shard& shard = ShardOf(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		typename EntryMap::iterator found = shard.index.find(key);
+		if (found != shard.index.end()) {
+			found->second->second = value;
+			shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+			return;
+		}
+
+		shard.entries.push_front(std::make_pair(key, value));
+		shard.index.insert(std::make_pair(key, shard.entries.begin()));
+
+		if (shard.entries.size() > shard_capacity_) {
+			shard.index.erase(shard.entries.back().first);
+			shard.entries.pop_back();
+		}
+	}
+
+	void clear() {
+		for (size_t n = 0; n < nshards_; ++n) {
+			std::lock_guard<std::mutex> lock(shards_[n].mutex);
+			shards_[n].entries.clear();
+			shards_[n].index.clear();
+		}
+	}
+
+	size_t size() const {
+		size_t size = 0;
+		for (size_t n = 0; n < nshards_; ++n) {
+			std::lock_guard<std::mutex> lock(shards_[n].mutex);
+			size += shards_[n].entries.size();
+		}
+		return size;
+	}
+
+	size_t hits() const {
+		return hits_;
+	}
+
+	size_t misses() const {
+		return misses_;
+	}
+};
+
+#endif
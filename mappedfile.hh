@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAPPEDFILE_HH
+#define MAPPEDFILE_HH
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+
+/**
+ * Read-only memory mapping of a whole file
+ */
+class MappedFile {
+private:
+	const char* data_;
+	size_t size_;
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+	MappedFile() : data_(NULL), size_(0) {
+	}
+
+	~MappedFile() {
+		Unmap();
+	}
+
+	/**
+	 * Maps file opened as fd; returns false if it is not a regular
+	 * file or cannot be mapped, so caller may fall back to read()
+	 */
+	bool Map(int fd, int advice = MADV_NORMAL) {
+		Unmap();
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+			return false;
+
+		void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED)
+			return false;
+
+		data_ = static_cast<const char*>(map);
+		size_ = st.st_size;
+
+		madvise(map, size_, advice);
+
+		return true;
+	}
+
+	void Unmap() {
+		if (data_ != NULL)
+			munmap(const_cast<char*>(data_), size_);
+		data_ = NULL;
+		size_ = 0;
+	}
+
+	const char* data() const {
+		return data_;
+	}
+
+	size_t size() const {
+		return size_;
+	}
+};
+
+#endif
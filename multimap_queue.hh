@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MULTIMAP_QUEUE_HH
+#define MULTIMAP_QUEUE_HH
+
+#include <map>
+#include <cstddef>
+
+/**
+ * Priority queue of items based on std::multimap
+ *
+ * Has the same interface as dary_heap and radix_heap. The same item
+ * may be pushed multiple times.
+ */
+template <typename Priority = double>
+class multimap_queue {
+private:
+	typedef std::multimap<Priority, int> Map;
+	Map map_;
+
+private:
+	multimap_queue(const multimap_queue&);
+	multimap_queue& operator=(const multimap_queue&);
+
+public:
+	/* number of items is not needed, but is accepted for
+	 * compatibility with dary_heap */
+	multimap_queue(size_t = 0) {
+	}
+
+	void reset(size_t) {
+		map_.clear();
+	}
+
+	bool empty() const {
+		return map_.empty();
+	}
+
+	size_t size() const {
+		return map_.size();
+	}
+
+	int top() const {
+		return map_.begin()->second;
+	}
+
+	Priority top_priority() const {
+		return map_.begin()->first;
+	}
+
+	void push(int item, Priority priority) {
+		map_.insert(std::make_pair(priority, item));
+	}
+
+	void pop() {
+		map_.erase(map_.begin());
+	}
+};
+
+#endif
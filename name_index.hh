@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NAME_INDEX_HH
+#define NAME_INDEX_HH
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <utility>
+#include <cstddef>
+#include <stdint.h>
+
+/**
+ * Index of names for lookups tolerant to spelling variations
+ *
+ * Names are normalized: case is folded (simple folding for Latin,
+ * Greek and Cyrillic scripts, which covers railway station names),
+ * ё is replaced with е, and whitespace is collapsed. Normalized
+ * names are stored in a trie in compressed sparse row form, which
+ * supports exact lookup, prefix completion and lookup within
+ * bounded edit distance, all visiting only nodes relevant to query.
+ */
+class name_index {
+public:
+	typedef std::u32string Key;
+
+	struct Match {
+		std::string name;
+		int distance;
+
+		Match(const std::string& n, int d) : name(n), distance(d) {
+		}
+
+		bool operator<(const Match& other) const {
+			return distance < other.distance || (distance == other.distance && name < other.name);
+		}
+	};
+
+private:
+	/* children of trie node n are [child_offsets_[n], child_offsets_
+	 * [n+1]) in child arrays, sorted by label, and names ending at it
+	 * are [name_offsets_[n], name_offsets_[n+1]) in name_ids_; node 0
+	 * is root */
+	std::vector<uint32_t> child_offsets_;
+	std::vector<char32_t> child_labels_;
+	std::vector<uint32_t> child_nodes_;
+	std::vector<uint32_t> name_offsets_;
+	std::vector<uint32_t> name_ids_;
+
+	std::vector<std::string> names_;
+
+private:
+	static char32_t Fold(char32_t c) {
+		if (c < 0x80)
+			return (c >= 'A' && c <= 'Z') ? c + 32 : c;
+
+		/* Latin-1 Supplement and Latin Extended-A */
+		if ((c >= 0xC0 && c <= 0xDE && c != 0xD7))
+			return c + 32;
+		if (c == 0x130)
+			return 'i';
+		if (c == 0x178)
+			return 0xFF;
+		if (c == 0x17F)
+			return 's';
+		if ((c >= 0x100 && c <= 0x137) || (c >= 0x14A && c <= 0x177))
+			return c | 1;
+		if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E))
+			return (c & 1) ? c + 1 : c;
+
+		/* Greek */
+		if (c >= 0x391 && c <= 0x3AB && c != 0x3A2)
+			return c + 32;
+		if (c == 0x386)
+			return 0x3AC;
+		if (c >= 0x388 && c <= 0x38A)
+			return c + 37;
+		if (c == 0x38C)
+			return 0x3CC;
+		if (c == 0x38E || c == 0x38F)
+			return c + 63;
+		if (c == 0x3C2)
+			return 0x3C3;
+
+		/* Cyrillic */
+		if (c >= 0x410 && c <= 0x42F)
+			return c + 32;
+		if (c >= 0x400 && c <= 0x40F)
+			return c + 80;
+		if ((c >= 0x460 && c <= 0x481) || (c >= 0x48A && c <= 0x4BF) || (c >= 0x4D0 && c <= 0x52F))
+			return c | 1;
+		if (c == 0x4C0)
+			return 0x4CF;
+		if (c >= 0x4C1 && c <= 0x4CE)
+			return (c & 1) ? c + 1 : c;
+
+		return c;
+	}
+
+	static bool IsSpace(char32_t c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == 0xA0;
+	}
+
+	/* decodes next UTF-8 character, invalid sequences give U+FFFD */
+	static char32_t Decode(const std::string& str, size_t& pos) {
+		const unsigned char first = str[pos++];
+		if (first < 0x80)
+			return first;
+
+		int length;
+		char32_t c;
+		if ((first & 0xE0) == 0xC0) {
+			length = 1;
+			c = first & 0x1F;
+		} else if ((first & 0xF0) == 0xE0) {
+			length = 2;
+			c = first & 0x0F;
+		} else if ((first & 0xF8) == 0xF0) {
+			length = 3;
+			c = first & 0x07;
+		} else {
+			return 0xFFFD;
+		}
+
+		for (int i = 0; i < length; ++i) {
+			if (pos >= str.size() || ((unsigned char)str[pos] & 0xC0) != 0x80)
+				return 0xFFFD;
+			c = (c << 6) | ((unsigned char)str[pos++] & 0x3F);
+		}
+		return c;
+	}
+
+	/* finds child of node with given label, or returns 0 */
+	uint32_t Child(uint32_t node, char32_t label) const {
+		const char32_t* begin = child_labels_.data() + child_offsets_[node];
+		const char32_t* end = child_labels_.data() + child_offsets_[node + 1];
+		const char32_t* child = std::lower_bound(begin, end, label);
+		if (child == end || *child != label)
+			return 0;
+		return child_nodes_[child - child_labels_.data()];
+	}
+
+	/* walks down the trie along key, returns 0 if there's no path */
+	uint32_t Walk(const Key& key) const {
+		if (child_offsets_.empty())
+			return 0;
+
+		uint32_t node = 0;
+		for (Key::const_iterator c = key.begin(); c != key.end(); ++c)
+			if ((node = Child(node, *c)) == 0)
+				return 0;
+		return node;
+	}
+
+	/* collects names in subtree of node in lexicographic order */
+	void Collect(uint32_t node, size_t limit, std::vector<std::string>& result) const {
+		for (uint32_t nname = name_offsets_[node]; nname < name_offsets_[node + 1] && result.size() < limit; ++nname)
+			result.push_back(names_[name_ids_[nname]]);
+		for (uint32_t nchild = child_offsets_[node]; nchild < child_offsets_[node + 1] && result.size() < limit; ++nchild)
+			Collect(child_nodes_[nchild], limit, result);
+	}
+
+	/* depth first search for names within edit distance; rows[depth]
+	 * holds edit distances between query prefixes and key of the
+	 * node, deeper rows are reused between branches */
+	void CollectSimilar(uint32_t node, size_t depth, const Key& query, std::vector<std::vector<int> >& rows, int max_distance, std::vector<Match>& result) const {
+		if (rows[depth].back() <= max_distance)
+			for (uint32_t nname = name_offsets_[node]; nname < name_offsets_[node + 1]; ++nname)
+				result.push_back(Match(names_[name_ids_[nname]], rows[depth].back()));
+
+		if (child_offsets_[node] == child_offsets_[node + 1])
+			return;
+
+		if (rows.size() <= depth + 1)
+			rows.push_back(std::vector<int>(query.size() + 1));
+
+		for (uint32_t nchild = child_offsets_[node]; nchild < child_offsets_[node + 1]; ++nchild) {
+			const char32_t label = child_labels_[nchild];
+			const std::vector<int>& row = rows[depth];
+			std::vector<int>& next = rows[depth + 1];
+
+			next[0] = row[0] + 1;
+			int min_distance = next[0];
+			for (size_t i = 1; i < row.size(); ++i) {
+				next[i] = std::min(std::min(next[i - 1], row[i]) + 1, row[i - 1] + (query[i - 1] == label ? 0 : 1));
+				min_distance = std::min(min_distance, next[i]);
+			}
+
+			/* distances only grow deeper in the trie */
+			if (min_distance <= max_distance)
+				CollectSimilar(child_nodes_[nchild], depth + 1, query, rows, max_distance, result);
+		}
+	}
+
+public:
+	/**
+	 * Normalizes UTF-8 string, appending result to key
+	 */
+	static void Normalize(const std::string& str, Key& key) {
+		const size_t start = key.size();
+
+		bool space = false;
+		for (size_t pos = 0; pos < str.size(); ) {
+			char32_t c = Decode(str, pos);
+			if (IsSpace(c)) {
+				space = key.size() > start;
+				continue;
+			}
+
+			if (space)
+				key.push_back(' ');
+			space = false;
+
+			c = Fold(c);
+			if (c == 0x451) /* ё */
+				c = 0x435; /* е */
+			else if (c == 0xDF) { /* ß */
+				key.push_back('s');
+				c = 's';
+			}
+			key.push_back(c);
+		}
+	}
+
+	static Key Normalize(const std::string& str) {
+		Key key;
+		Normalize(str, key);
+		return key;
+	}
+
+	void Build(const std::vector<std::string>& names) {
+		clear();
+		names_ = names;
+
+		/* normalized names are kept in a single buffer */
+		Key buffer;
+		std::vector<uint32_t> key_offsets;
+		key_offsets.reserve(names.size() + 1);
+		for (size_t nname = 0; nname < names.size(); ++nname) {
+			key_offsets.push_back(buffer.size());
+			Normalize(names[nname], buffer);
+		}
+		key_offsets.push_back(buffer.size());
+
+		std::vector<uint32_t> order(names.size());
+		for (size_t nname = 0; nname < names.size(); ++nname)
+			order[nname] = nname;
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return std::lexicographical_compare(&buffer[key_offsets[a]], &buffer[key_offsets[a + 1]], &buffer[key_offsets[b]], &buffer[key_offsets[b + 1]]);
+		});
+
+		/* nodes are built breadth first, so children of each node
+		 * are contiguous; each node covers range of sorted keys with
+		 * the same prefix of length depth */
+		struct Range {
+			uint32_t begin;
+			uint32_t end;
+			uint32_t depth;
+		};
+
+		std::vector<Range> nodes;
+		Range root = { 0, (uint32_t)order.size(), 0 };
+		nodes.push_back(root);
+
+		for (size_t nnode = 0; nnode < nodes.size(); ++nnode) {
+			const Range range = nodes[nnode];
+
+			child_offsets_.push_back(child_labels_.size());
+			name_offsets_.push_back(name_ids_.size());
+
+			/* keys ending here sort first */
+			uint32_t pos = range.begin;
+			for (; pos < range.end && key_offsets[order[pos] + 1] - key_offsets[order[pos]] == range.depth; ++pos)
+				name_ids_.push_back(order[pos]);
+
+			while (pos < range.end) {
+				const char32_t label = buffer[key_offsets[order[pos]] + range.depth];
+				Range child = { pos, pos, range.depth + 1 };
+				while (child.end < range.end && buffer[key_offsets[order[child.end]] + range.depth] == label)
+					child.end++;
+
+				child_labels_.push_back(label);
+				child_nodes_.push_back(nodes.size());
+				nodes.push_back(child);
+
+				pos = child.end;
+			}
+		}
+
+		child_offsets_.push_back(child_labels_.size());
+		name_offsets_.push_back(name_ids_.size());
+	}
+
+	void clear() {
+		child_offsets_.clear();
+		child_labels_.clear();
+		child_nodes_.clear();
+		name_offsets_.clear();
+		name_ids_.clear();
+		names_.clear();
+	}
+
+	/**
+	 * Finds names equal to query after normalization
+	 */
+	void Find(const std::string& query, std::vector<std::string>& result) const {
+		result.clear();
+
+		const uint32_t node = Walk(Normalize(query));
+		if (node != 0)
+			for (uint32_t nname = name_offsets_[node]; nname < name_offsets_[node + 1]; ++nname)
+				result.push_back(names_[name_ids_[nname]]);
+	}
+
+	/**
+	 * Finds up to limit names starting with prefix after
+	 * normalization, in lexicographic order of normalized names
+	 */
+	void Complete(const std::string& prefix, size_t limit, std::vector<std::string>& result) const {
+		result.clear();
+
+		const Key key = Normalize(prefix);
+		const uint32_t node = key.empty() ? 0 : Walk(key);
+		if (!child_offsets_.empty() && (node != 0 || key.empty()))
+			Collect(node, limit, result);
+	}
+
+	/**
+	 * Finds up to limit names within given Levenshtein distance
+	 * from query after normalization, closest first
+	 */
+	void FindSimilar(const std::string& query, int max_distance, size_t limit, std::vector<Match>& result) const {
+		result.clear();
+		if (child_offsets_.empty())
+			return;
+
+		const Key key = Normalize(query);
+
+		std::vector<std::vector<int> > rows(1, std::vector<int>(key.size() + 1));
+		for (size_t i = 0; i <= key.size(); ++i)
+			rows[0][i] = i;
+
+		CollectSimilar(0, 0, key, rows, max_distance, result);
+
+		std::sort(result.begin(), result.end());
+		if (result.size() > limit)
+			result.erase(result.begin() + limit, result.end());
+	}
+
+	size_t size() const {
+		return names_.size();
+	}
+};
+
+#endif
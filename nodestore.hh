@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NODESTORE_HH
+#define NODESTORE_HH
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vector>
+#include <map>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "ObjectBases.hh"
+
+/**
+ * Interface of node location store
+ *
+ * Locations are added with Set(), then Finalize() is called, after
+ * which they may be looked up with Get().
+ */
+class NodeStore {
+public:
+	virtual ~NodeStore() {
+	}
+
+	virtual void Set(osmid_t id, const LonLat& pos) = 0;
+	virtual void Finalize() = 0;
+	virtual bool Get(osmid_t id, LonLat& pos) const = 0;
+	virtual size_t size() const = 0;
+	virtual void Clear() = 0;
+
+protected:
+	/* creates unlinked temporary file in $TMPDIR */
+	static int CreateTempFile() {
+		const char* tmpdir = getenv("TMPDIR");
+		std::string path = std::string(tmpdir ? tmpdir : "/tmp") + "/nodestore.XXXXXX";
+
+		int fd = mkstemp(&path[0]);
+		if (fd == -1)
+			throw std::runtime_error("cannot create node store file");
+		unlink(path.c_str());
+		return fd;
+	}
+};
+
+/**
+ * Compact store of node locations, sorted by id
+ *
+ * Locations are appended in any order, then Finalize() is called,
+ * after which they may be looked up. When number of stored
+ * locations exceeds given limit, they are spilled into unlinked
+ * temporary file, which is mmap()ed on finalization, so the store
+ * may hold more locations than fits into memory.
+ */
+class SparseNodeStore : public NodeStore {
+private:
+	struct Entry {
+		osmid_t id;
+		osmint_t lon;
+		osmint_t lat;
+
+		Entry(osmid_t i, osmint_t ln, osmint_t lt) : id(i), lon(ln), lat(lt) {
+		}
+
+		bool operator<(const Entry& other) const {
+			return id < other.id;
+		}
+	};
+
+	typedef std::vector<Entry> EntryVector;
+
+private:
+	/* in-memory entries which are not yet spilled */
+	EntryVector buffer_;
+
+	/* max number of entries to keep in memory */
+	const size_t buffer_limit_;
+
+	/* spill file and number of entries in it */
+	int spill_fd_;
+	size_t spilled_;
+
+	/* mapping of spill file */
+	Entry* mapped_;
+
+	/* finalized data */
+	const Entry* entries_;
+	size_t size_;
+
+	osmid_t last_id_;
+	bool sorted_;
+	bool finalized_;
+
+private:
+	void Spill() {
+		if (spill_fd_ == -1)
+			spill_fd_ = CreateTempFile();
+
+		const char* data = reinterpret_cast<const char*>(buffer_.data());
+		size_t left = buffer_.size() * sizeof(Entry);
+		while (left > 0) {
+			ssize_t written = write(spill_fd_, data, left);
+			if (written < 0)
+				throw std::runtime_error("node store spill file write error");
+			data += written;
+			left -= written;
+		}
+
+		spilled_ += buffer_.size();
+		buffer_.clear();
+	}
+
+	SparseNodeStore(const SparseNodeStore&);
+	SparseNodeStore& operator=(const SparseNodeStore&);
+
+public:
+	SparseNodeStore(size_t buffer_limit = 64*1024*1024 / sizeof(Entry))
+		: buffer_limit_(buffer_limit),
+		  spill_fd_(-1),
+		  spilled_(0),
+		  mapped_(NULL),
+		  entries_(NULL),
+		  size_(0),
+		  last_id_(0),
+		  sorted_(true),
+		  finalized_(false) {
+	}
+
+	~SparseNodeStore() {
+		Clear();
+	}
+
+	void Set(osmid_t id, const LonLat& pos) {
+		if (finalized_)
+			throw std::logic_error("node store is already finalized");
+
+		if (id < last_id_)
+			sorted_ = false;
+		last_id_ = id;
+
+		buffer_.push_back(Entry(id, pos.GetLonI(), pos.GetLatI()));
+
+		if (buffer_.size() >= buffer_limit_)
+			Spill();
+	}
+
+	void Finalize() {
+		if (finalized_)
+			return;
+
+		if (spill_fd_ != -1) {
+			Spill();
+			EntryVector().swap(buffer_);
+
+			if (spilled_ > 0) {
+				void* map = mmap(NULL, spilled_ * sizeof(Entry), PROT_READ | PROT_WRITE, MAP_SHARED, spill_fd_, 0);
+				if (map == MAP_FAILED)
+					throw std::runtime_error("cannot mmap node store spill file");
+				mapped_ = static_cast<Entry*>(map);
+
+				madvise(mapped_, spilled_ * sizeof(Entry), MADV_RANDOM);
+			}
+
+			if (!sorted_)
+				std::sort(mapped_, mapped_ + spilled_);
+
+			entries_ = mapped_;
+			size_ = spilled_;
+		} else {
+			if (!sorted_)
+				std::sort(buffer_.begin(), buffer_.end());
+
+			entries_ = buffer_.data();
+			size_ = buffer_.size();
+		}
+
+		finalized_ = true;
+	}
+
+	bool Get(osmid_t id, LonLat& pos) const {
+		const Entry* entry = std::lower_bound(entries_, entries_ + size_, Entry(id, 0, 0));
+		if (entry == entries_ + size_ || entry->id != id)
+			return false;
+
+		pos.SetLonI(entry->lon);
+		pos.SetLatI(entry->lat);
+		return true;
+	}
+
+	size_t size() const {
+		return finalized_ ? size_ : spilled_ + buffer_.size();
+	}
+
+	void Clear() {
+		if (mapped_ != NULL)
+			munmap(mapped_, spilled_ * sizeof(Entry));
+		if (spill_fd_ != -1)
+			close(spill_fd_);
+
+		EntryVector().swap(buffer_);
+		spill_fd_ = -1;
+		spilled_ = 0;
+		mapped_ = NULL;
+		entries_ = NULL;
+		size_ = 0;
+		last_id_ = 0;
+		sorted_ = true;
+		finalized_ = false;
+	}
+};
+
+/**
+ * Store of node locations in array indexed by node id
+ *
+ * The array lives in unlinked temporary file which is mmap()ed and
+ * grown as needed. Pages which are never written are not allocated
+ * by the file system, and memory used for the rest is managed by the
+ * kernel, so this is suitable for planet-sized inputs, where sparse
+ * store would be both larger and slower. Negative ids, which editors
+ * such as JOSM use for objects not uploaded yet, are few and are kept
+ * in a std::map aside of the array. Ids above given maximum are
+ * rejected, so a single bogus id can't blow the file up.
+ */
+class DenseNodeStore : public NodeStore {
+private:
+	/* coordinates are stored xored with this value, so zero filled
+	 * entries which were never set decode into invalid location */
+	static const uint32_t empty_mark_ = 0x80000000;
+
+	struct Entry {
+		uint32_t lon;
+		uint32_t lat;
+	};
+
+public:
+	/* default maximal id, well above ids used by OSM so far; array
+	 * for it takes 128GB of address space and file size */
+	static const osmid_t default_max_id = ((osmid_t)1 << 34) - 1;
+
+private:
+	int fd_;
+	Entry* entries_;
+	size_t capacity_;
+	size_t size_;
+	osmid_t max_id_;
+
+	std::map<osmid_t, LonLat> negative_;
+
+private:
+	void Grow(size_t min_capacity) {
+		/* grow by at least 1M entries and at least twice */
+		size_t capacity = capacity_ * 2;
+		if (capacity < min_capacity)
+			capacity = min_capacity;
+		capacity = (capacity + 1024*1024 - 1) / (1024*1024) * (1024*1024);
+
+		if (fd_ == -1)
+			fd_ = CreateTempFile();
+
+		if (ftruncate(fd_, capacity * sizeof(Entry)) != 0)
+			throw std::runtime_error("cannot grow dense node store file");
+
+		if (entries_ != NULL)
+			munmap(entries_, capacity_ * sizeof(Entry));
+		entries_ = NULL;
+
+		void* map = mmap(NULL, capacity * sizeof(Entry), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+		if (map == MAP_FAILED)
+			throw std::runtime_error("cannot mmap dense node store file");
+
+		entries_ = static_cast<Entry*>(map);
+		capacity_ = capacity;
+	}
+
+	DenseNodeStore(const DenseNodeStore&);
+	DenseNodeStore& operator=(const DenseNodeStore&);
+
+public:
+	DenseNodeStore(osmid_t max_id = default_max_id) : fd_(-1), entries_(NULL), capacity_(0), size_(0), max_id_(max_id) {
+	}
+
+	~DenseNodeStore() {
+		Clear();
+	}
+
+	void Set(osmid_t id, const LonLat& pos) {
+		if (id < 0) {
+			std::pair<std::map<osmid_t, LonLat>::iterator, bool> inserted = negative_.insert(std::make_pair(id, pos));
+			if (inserted.second)
+				size_++;
+			else
+				inserted.first->second = pos;
+			return;
+		}
+
+		if (id > max_id_) {
+			std::stringstream ss;
+			ss << "node id " << id << " exceeds maximal id " << max_id_ << " of dense node store";
+			throw std::out_of_range(ss.str());
+		}
+
+		if ((size_t)id >= capacity_)
+			Grow(id + 1);
+
+		Entry& entry = entries_[id];
+		if (entry.lon == 0)
+			size_++;
+		entry.lon = (uint32_t)pos.GetLonI() ^ empty_mark_;
+		entry.lat = (uint32_t)pos.GetLatI() ^ empty_mark_;
+	}
+
+	void Finalize() {
+		if (entries_ != NULL)
+			madvise(entries_, capacity_ * sizeof(Entry), MADV_RANDOM);
+	}
+
+	bool Get(osmid_t id, LonLat& pos) const {
+		if (id < 0) {
+			std::map<osmid_t, LonLat>::const_iterator negative = negative_.find(id);
+			if (negative == negative_.end())
+				return false;
+			pos = negative->second;
+			return true;
+		}
+
+		if ((size_t)id >= capacity_ || entries_[id].lon == 0)
+			return false;
+
+		pos.SetLonI((osmint_t)(entries_[id].lon ^ empty_mark_));
+		pos.SetLatI((osmint_t)(entries_[id].lat ^ empty_mark_));
+		return true;
+	}
+
+	size_t size() const {
+		return size_;
+	}
+
+	void Clear() {
+		if (entries_ != NULL)
+			munmap(entries_, capacity_ * sizeof(Entry));
+		if (fd_ != -1)
+			close(fd_);
+
+		fd_ = -1;
+		entries_ = NULL;
+		capacity_ = 0;
+		size_ = 0;
+		negative_.clear();
+	}
+};
+
+#endif
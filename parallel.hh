@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLEL_HH
+#define PARALLEL_HH
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <exception>
+
+/**
+ * Returns number of threads to use by default
+ */
+static inline int DefaultThreads() {
+	unsigned int n = std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+/**
+ * Calls fn(i) for each i in [0; count) using up to nthreads threads
+ *
+ * Items are handed out one by one, so uneven work is balanced
+ * between threads. First exception thrown by fn is rethrown in
+ * the calling thread after all workers finish.
+ */
+template<class Fn>
+void ParallelFor(size_t count, int nthreads, Fn fn) {
+	if (nthreads > (int)count)
+		nthreads = count;
+
+	if (nthreads <= 1) {
+		for (size_t i = 0; i < count; ++i)
+			fn(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	std::exception_ptr error;
+	std::mutex error_mutex;
+
+	std::vector<std::thread> threads;
+	threads.reserve(nthreads);
+	for (int n = 0; n < nthreads; ++n) {
+		threads.push_back(std::thread([&]() {
+			size_t i;
+			while ((i = next++) < count) {
+				try {
+					fn(i);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(error_mutex);
+					if (!error)
+						error = std::current_exception();
+					next = count;
+				}
+			}
+		}));
+	}
+
+	for (std::vector<std::thread>::iterator thread = threads.begin(); thread != threads.end(); ++thread)
+		thread->join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+#endif
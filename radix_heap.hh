@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_HEAP_HH
+#define RADIX_HEAP_HH
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+/**
+ * Monotone radix min-heap of items with priorities
+ *
+ * Priorities are quantized into integers by multiplying by scale,
+ * and entries are kept in buckets by highest bit in which their
+ * quantized priority differs from that of the last popped entry,
+ * so each entry is moved between buckets at most 64 times. Pushed
+ * priorities must not be less than the last popped one, as is the
+ * case in Dijkstra search, otherwise they are treated as equal to
+ * it. Entries with equal quantized priorities are ordered exactly.
+ *
+ * Unlike dary_heap, the same item may be pushed multiple times.
+ */
+template <typename Priority = double>
+class radix_heap {
+private:
+	static const int nbuckets_ = 65;
+
+	struct Entry {
+		uint64_t key;
+		Priority priority;
+		int item;
+	};
+
+	typedef std::vector<Entry> Bucket;
+
+private:
+	Bucket buckets_[nbuckets_];
+
+	/* quantized priority of the last popped entry */
+	uint64_t last_;
+
+	/* index of the top entry in the first bucket */
+	size_t top_;
+
+	size_t size_;
+	Priority scale_;
+
+private:
+	static int BucketOf(uint64_t key, uint64_t last) {
+		return key == last ? 0 : 64 - __builtin_clzll(key ^ last);
+	}
+
+	/* finds the top entry in the first bucket, refilling it from
+	 * the next nonempty bucket if needed */
+	void Normalize() {
+		if (buckets_[0].empty()) {
+			int nbucket = 1;
+			while (buckets_[nbucket].empty())
+				nbucket++;
+
+			Bucket& bucket = buckets_[nbucket];
+
+			last_ = bucket.front().key;
+			for (typename Bucket::const_iterator entry = bucket.begin(); entry != bucket.end(); ++entry)
+				if (entry->key < last_)
+					last_ = entry->key;
+
+			for (typename Bucket::const_iterator entry = bucket.begin(); entry != bucket.end(); ++entry)
+				buckets_[BucketOf(entry->key, last_)].push_back(*entry);
+			bucket.clear();
+		}
+
+		top_ = 0;
+		for (size_t i = 1; i < buckets_[0].size(); ++i)
+			if (buckets_[0][i].priority < buckets_[0][top_].priority)
+				top_ = i;
+	}
+
+	radix_heap(const radix_heap&);
+	radix_heap& operator=(const radix_heap&);
+
+public:
+	/* number of items is not needed, but is accepted for
+	 * compatibility with dary_heap */
+	radix_heap(size_t = 0, Priority scale = 1024) : last_(0), top_(0), size_(0), scale_(scale) {
+	}
+
+	void reset(size_t) {
+		for (int nbucket = 0; nbucket < nbuckets_; ++nbucket)
+			buckets_[nbucket].clear();
+		last_ = 0;
+		top_ = 0;
+		size_ = 0;
+	}
+
+	bool empty() const {
+		return size_ == 0;
+	}
+
+	size_t size() const {
+		return size_;
+	}
+
+	int top() const {
+		return buckets_[0][top_].item;
+	}
+
+	Priority top_priority() const {
+		return buckets_[0][top_].priority;
+	}
+
+	void push(int item, Priority priority) {
+		uint64_t key = (uint64_t)(priority * scale_);
+		if (key < last_)
+			key = last_;
+
+		Entry entry = { key, priority, item };
+
+		const int nbucket = BucketOf(key, last_);
+		buckets_[nbucket].push_back(entry);
+		size_++;
+
+		if (size_ == 1)
+			Normalize();
+		else if (nbucket == 0 && priority < buckets_[0][top_].priority)
+			top_ = buckets_[0].size() - 1;
+	}
+
+	void pop() {
+		Bucket& first = buckets_[0];
+		first[top_] = first.back();
+		first.pop_back();
+
+		if (--size_ > 0)
+			Normalize();
+	}
+};
+
+#endif
@@ -17,36 +17,404 @@
  * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <unistd.h>
+
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <exception>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
 
 #include "railrouting.hh"
+#include "parallel.hh"
+#include "json.hh"
+
+/**
+ * Runner of route queries from JSONL input
+ *
+ * Each input line is an object with from and to station names, and
+ * a line with result is written for each one, in input order. Queries
+ * run on a number of threads, each taking the next line as soon as
+ * it's done with the previous one and using its own query context.
+ * Results which are ready before preceding ones wait in a reorder
+ * buffer.
+ */
+class BatchRunner {
+private:
+	typedef std::chrono::steady_clock Clock;
+
+private:
+	const RailRouting& routing_;
+	const RailRouting::SearchMode mode_;
+	const RailRouting::QueueType queue_;
+
+	std::istream& input_;
+	std::mutex input_mutex_;
+	size_t nread_;
+
+	std::ostream& output_;
+	std::mutex output_mutex_;
+	size_t nwritten_;
+	std::map<size_t, std::string> pending_;
+
+	/* latency of each query, in milliseconds */
+	std::vector<double> latencies_;
+
+	/* first error thrown by a worker, which stops all of them */
+	std::exception_ptr error_;
+
+private:
+	bool ReadRequest(std::string& line, size_t& nline) {
+		std::lock_guard<std::mutex> lock(input_mutex_);
+		if (error_ || !std::getline(input_, line))
+			return false;
+		nline = nread_++;
+		return true;
+	}
+
+	void WriteResult(size_t nline, const std::string& result, double latency) {
+		std::lock_guard<std::mutex> lock(output_mutex_);
+		if (latency >= 0.0)
+			latencies_.push_back(latency);
+
+		pending_[nline] = result;
+		for (std::map<size_t, std::string>::iterator ready = pending_.begin(); ready != pending_.end() && ready->first == nwritten_; ready = pending_.begin()) {
+			output_ << ready->second;
+			pending_.erase(ready);
+			nwritten_++;
+		}
+	}
+
+	/* returns JSON line with result, or empty string for blank
+	 * input line; latency is negative if no query was run */
+	std::string ProcessRequest(const std::string& line, RailRouting::QueryContext& context, double& latency) {
+		latency = -1.0;
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			return std::string();
+
+		std::ostringstream out;
+		out << std::setiosflags(std::ios::fixed) << std::setprecision(3);
+
+		std::map<std::string, std::string> request;
+		try {
+			JsonObjectParser(line).Parse(request);
+		} catch (std::runtime_error&) {
+			request.clear();
+		}
+
+		std::map<std::string, std::string>::const_iterator from = request.find("from");
+		std::map<std::string, std::string>::const_iterator to = request.find("to");
+		if (from == request.end() || to == request.end()) {
+			out << "{\"status\":\"Invalid request\"}" << std::endl;
+			return out.str();
+		}
+
+		RailRouting::FindRouteResult result;
+
+		Clock::time_point start = Clock::now();
+		const bool found = routing_.FindRoute(context, from->second, to->second, result, mode_, queue_);
+		latency = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		out << "{\"from\":";
+		WriteJsonString(out, from->second);
+		out << ",\"to\":";
+		WriteJsonString(out, to->second);
+		out << ",\"status\":";
+		WriteJsonString(out, result.StatusString());
+		if (found) {
+			out << ",\"distance\":" << result.distance;
+			out << ",\"start_node\":" << result.start_node.GetId();
+			out << ",\"end_node\":" << result.end_node.GetId();
+			out << ",\"route_nodes\":" << result.route_nodes.size();
+			out << ",\"sharp_turns\":" << result.sharp_turns.size();
+		}
+		out << ",\"settled\":" << result.settled_count << "}" << std::endl;
+
+		return out.str();
+	}
+
+	void Worker() {
+		RailRouting::QueryContext context;
+		std::string line;
+		size_t nline;
+
+		try {
+			while (ReadRequest(line, nline)) {
+				double latency;
+				const std::string result = ProcessRequest(line, context, latency);
+				WriteResult(nline, result, latency);
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(input_mutex_);
+			if (!error_)
+				error_ = std::current_exception();
+		}
+	}
+
+	static double Percentile(const std::vector<double>& sorted, double fraction) {
+		size_t n = (size_t)(fraction * sorted.size());
+		return sorted[n < sorted.size() ? n : sorted.size() - 1];
+	}
+
+public:
+	BatchRunner(const RailRouting& routing, RailRouting::SearchMode mode, RailRouting::QueueType queue, std::istream& input, std::ostream& output)
+		: routing_(routing),
+		  mode_(mode),
+		  queue_(queue),
+		  input_(input),
+		  nread_(0),
+		  output_(output),
+		  nwritten_(0) {
+	}
+
+	void Run(int nthreads) {
+		Clock::time_point start = Clock::now();
+
+		std::vector<std::thread> threads;
+		for (int n = 0; n < nthreads; ++n)
+			threads.push_back(std::thread(&BatchRunner::Worker, this));
+		for (std::vector<std::thread>::iterator thread = threads.begin(); thread != threads.end(); ++thread)
+			thread->join();
+
+		if (error_)
+			std::rethrow_exception(error_);
+
+		const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		std::cerr << latencies_.size() << " queries in " << seconds << " s on " << nthreads << " threads, " << latencies_.size() / seconds << " queries/s" << std::endl;
+
+		if (!latencies_.empty()) {
+			std::sort(latencies_.begin(), latencies_.end());
+			std::cerr << "Latency, ms: p50 " << Percentile(latencies_, 0.5) << ", p90 " << Percentile(latencies_, 0.9) << ", p99 " << Percentile(latencies_, 0.99) << ", p99.9 " << Percentile(latencies_, 0.999) << ", max " << latencies_.back() << std::endl;
+		}
+	}
+};
+
+void usage(const char* progname) {
+	std::cerr << "Usage: " << progname << " [-1] [-a algorithm] [-c] [-d] [-j threads] [-l landmarks] [-m] [-o snapshot] [-q queue] [-b requests.jsonl [-C entries]|-p lon,lat,lon,lat|-r km] file.osm|file.osm.pbf" << std::endl;
+	std::cerr << "       " << progname << " [-a algorithm] [-j threads] [-q queue] [-b requests.jsonl [-C entries]|-p lon,lat,lon,lat|-r km] -s snapshot" << std::endl;
+	std::cerr << "  -1  read input in a single pass (allows - for stdin)" << std::endl;
+	std::cerr << "  -a  search algorithm: dijkstra (default), astar, bidir, ch, alt or turns" << std::endl;
+	std::cerr << "  -b  run route queries from JSONL file (- for stdin), writing results to stdout" << std::endl;
+	std::cerr << "  -C  cache results for given number of station pairs" << std::endl;
+	std::cerr << "  -c  build contraction hierarchy (needed for -a ch)" << std::endl;
+	std::cerr << "  -d  keep node locations in file-backed array indexed by id (for huge inputs)" << std::endl;
+	std::cerr << "  -j  number of threads for input decoding and batch queries" << std::endl;
+	std::cerr << "  -l  select given number of landmarks (needed for -a alt)" << std::endl;
+	std::cerr << "  -m  mmap input file instead of reading it (with -j, XML is parsed in parallel)" << std::endl;
+	std::cerr << "  -o  save prepared graph into snapshot file" << std::endl;
+	std::cerr << "  -p  find route between given locations instead of stations" << std::endl;
+	std::cerr << "  -q  search queue: multimap, binary, 4ary (default) or radix" << std::endl;
+	std::cerr << "  -r  list stops reachable from start station within given distance instead" << std::endl;
+	std::cerr << "  -s  load graph from snapshot file instead of parsing OSM data" << std::endl;
+}
 
 int main(int argc, char** argv) {
-	if (argc != 2) {
-		std::cerr << "Usage: " << argv[0] << " file.osm" << std::endl;
+	bool single_pass = false;
+	bool dense_store = false;
+	bool build_hierarchy = false;
+	int nlandmarks = 0;
+	RailRouting::SearchMode search_mode = RailRouting::DIJKSTRA_SEARCH;
+	RailRouting::QueueType queue_type = RailRouting::QUATERNARY_HEAP_QUEUE;
+	int nthreads = 0;
+	bool use_mmap = false;
+	bool load_snapshot = false;
+	const char* save_snapshot = NULL;
+	double reach_distance = -1.0;
+	const char* batch_file = NULL;
+	size_t cache_size = 0;
+	const char* points = NULL;
+
+	int c;
+	while ((c = getopt(argc, argv, "1a:b:C:cdj:l:mo:p:q:r:sh")) != -1) {
+		switch (c) {
+		case '1':
+			single_pass = true;
+			break;
+		case 'a':
+			if (strcmp(optarg, "dijkstra") == 0) {
+				search_mode = RailRouting::DIJKSTRA_SEARCH;
+			} else if (strcmp(optarg, "astar") == 0) {
+				search_mode = RailRouting::ASTAR_SEARCH;
+			} else if (strcmp(optarg, "bidir") == 0) {
+				search_mode = RailRouting::BIDIRECTIONAL_SEARCH;
+			} else if (strcmp(optarg, "ch") == 0) {
+				search_mode = RailRouting::HIERARCHY_SEARCH;
+			} else if (strcmp(optarg, "alt") == 0) {
+				search_mode = RailRouting::LANDMARK_SEARCH;
+			} else if (strcmp(optarg, "turns") == 0) {
+				search_mode = RailRouting::TURN_AWARE_SEARCH;
+			} else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'b':
+			batch_file = optarg;
+			break;
+		case 'C':
+			cache_size = atol(optarg);
+			break;
+		case 'c':
+			build_hierarchy = true;
+			break;
+		case 'd':
+			dense_store = true;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'l':
+			nlandmarks = atoi(optarg);
+			break;
+		case 'm':
+			use_mmap = true;
+			break;
+		case 'o':
+			save_snapshot = optarg;
+			break;
+		case 'p':
+			points = optarg;
+			break;
+		case 'q':
+			if (strcmp(optarg, "multimap") == 0) {
+				queue_type = RailRouting::MULTIMAP_QUEUE;
+			} else if (strcmp(optarg, "binary") == 0) {
+				queue_type = RailRouting::BINARY_HEAP_QUEUE;
+			} else if (strcmp(optarg, "4ary") == 0) {
+				queue_type = RailRouting::QUATERNARY_HEAP_QUEUE;
+			} else if (strcmp(optarg, "radix") == 0) {
+				queue_type = RailRouting::RADIX_HEAP_QUEUE;
+			} else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'r':
+			reach_distance = atof(optarg) * 1000.0;
+			break;
+		case 's':
+			load_snapshot = true;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage(argv[0]);
 		return 1;
 	}
 
-	RailRouting routing;
-	routing.Parse(argv[1]);
+	RailRouting routing(single_pass);
+	if (dense_store)
+		routing.SetNodeStore(RailRouting::DENSE_NODE_STORE);
+	if (nthreads > 0) {
+		routing.SetThreads(nthreads);
+		routing.SetParallelXml(true);
+	}
+	if (use_mmap)
+		routing.SetInputMode(RailRouting::MMAP_INPUT);
+
+	if (load_snapshot)
+		routing.LoadSnapshot(argv[optind]);
+	else
+		routing.Parse(argv[optind]);
+
+	if (build_hierarchy)
+		routing.BuildHierarchy();
+
+	if (nlandmarks > 0)
+		routing.BuildLandmarks(nlandmarks);
+
+	if (save_snapshot)
+		routing.SaveSnapshot(save_snapshot);
+
+	if (batch_file) {
+		std::ifstream file;
+		if (strcmp(batch_file, "-") != 0) {
+			file.open(batch_file);
+			if (!file) {
+				std::cerr << "Cannot open " << batch_file << std::endl;
+				return 1;
+			}
+		}
+
+		routing.SetRouteCache(cache_size);
+
+		BatchRunner runner(routing, search_mode, queue_type, file.is_open() ? file : std::cin, std::cout);
+		runner.Run(nthreads > 0 ? nthreads : DefaultThreads());
+
+		if (cache_size > 0) {
+			RailRouting::RouteCacheStats stats = routing.GetRouteCacheStats();
+			std::cerr << "Route cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.size << " entries" << std::endl;
+		}
+		return 0;
+	}
+
+	if (reach_distance >= 0.0) {
+		RailRouting::FindReachableResult reachable;
+
+		if (!routing.FindReachable("Лосиноостровская", reach_distance, reachable)) {
+			std::cerr << "Start station not found" << std::endl;
+			return 1;
+		}
+
+		std::cerr << reachable.route_nodes.size() << " route nodes reached" << std::endl;
+
+		std::cout << "Reachable stops:" << std::endl;
+		for (std::vector<RailRouting::ReachedStop>::const_iterator stop = reachable.stops.begin(); stop != reachable.stops.end(); ++stop)
+			std::cout << "  " << stop->distance/1000.0 << " km: " << stop->name << " (node id " << stop->GetId() << ")" << std::endl;
+
+		return 0;
+	}
 
 	RailRouting::FindRouteResult result;
 
-	if (!routing.FindRoute("Лосиноостровская", "Лось", result)) {
+	bool found;
+	if (points) {
+		double lon_a, lat_a, lon_b, lat_b;
+		if (sscanf(points, "%lf,%lf,%lf,%lf", &lon_a, &lat_a, &lon_b, &lat_b) != 4) {
+			usage(argv[0]);
+			return 1;
+		}
+
+		LonLat from(lround(lon_a * 10000000.0), lround(lat_a * 10000000.0));
+		LonLat to(lround(lon_b * 10000000.0), lround(lat_b * 10000000.0));
+		found = routing.FindRoute(from, to, result, search_mode, queue_type);
+	} else {
+		found = routing.FindRoute("Лосиноостровская", "Лось", result, search_mode, queue_type);
+	}
+
+	if (!found) {
 		std::cerr << "Unable to find route: " << result.StatusString() << std::endl;
 		return 1;
 	}
 
+	std::cerr << result.settled_count << " route nodes settled" << std::endl;
+
 	std::cout << "Route found, distance = " << result.distance/1000.0 << " km" << std::endl;
-	std::cout << "Start node id: " << result.start_node->GetId() << ", name: " << result.start_node->GetTag("name") << std::endl;
-	std::cout << "End node id: " << result.end_node->GetId() << ", name: " << result.end_node->GetTag("name") << std::endl;
+	std::cout << "Start node id: " << result.start_node.GetId() << ", name: " << result.start_name << std::endl;
+	std::cout << "End node id: " << result.end_node.GetId() << ", name: " << result.end_name << std::endl;
 
 	std::cout << "Route:" << std::endl;
 
 	std::cout << std::setiosflags(std::ios::fixed) << std::setprecision(7);
 
-	for (std::vector<const Node*>::const_iterator node = result.route_nodes.begin(); node != result.route_nodes.end(); ++node)
-		std::cout << "  " << (*node)->GetLonD() << ", " << (*node)->GetLatD() << std::endl;
+	for (std::vector<RailRouting::RoutePoint>::const_iterator node = result.route_nodes.begin(); node != result.route_nodes.end(); ++node)
+		std::cout << "  " << node->GetLonD() << ", " << node->GetLatD() << std::endl;
 
 	return 0;
 }
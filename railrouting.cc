@@ -18,40 +18,165 @@
  */
 
 #include <unordered_map>
+#include <algorithm>
 #include <limits>
 #include <cassert>
+#include <stdexcept>
 
 #include "railrouting.hh"
 
-#include "lazyinit_array.hh"
-
 #include "geomath.hh"
 
-RailRouting::RailRouting() {
-	AddPass(NULL, &RailRouting::ProcessWay, NULL, NULL, false, "loading ways");
-	AddPass(&RailRouting::ProcessNode, NULL, NULL, NULL, false, "loading nodes");
+namespace {
+
+StringTable& strings = StringTable::Instance();
+
+/* interned keys and values of tags used by router */
+const strid_t key_railway = strings.Intern("railway");
+const strid_t key_public_transport = strings.Intern("public_transport");
+const strid_t key_train = strings.Intern("train");
+const strid_t key_name = strings.Intern("name");
+const strid_t key_alt_name = strings.Intern("alt_name");
+const strid_t key_official_name = strings.Intern("official_name");
+const strid_t key_oneway = strings.Intern("oneway");
+const strid_t key_designated_direction = strings.Intern("designated_direction");
+
+const strid_t val_station = strings.Intern("station");
+const strid_t val_halt = strings.Intern("halt");
+const strid_t val_stop_position = strings.Intern("stop_position");
+const strid_t val_yes = strings.Intern("yes");
+const strid_t val_minus_one = strings.Intern("-1");
+const strid_t val_forward = strings.Intern("forward");
+const strid_t val_backward = strings.Intern("backward");
+
+/* locations farther than this from track are not snapped to it, and
+ * segments this much farther than the closest one are considered
+ * equally close, which catches both directions of the same track */
+const double max_snap_distance = 1000.0;
+const double snap_tolerance = 1.0e-3;
+
+/* offset of n-th start or fin node of query context */
+inline double NodeOffset(const std::vector<double>& offsets, size_t n) {
+	return offsets.empty() ? 0.0 : offsets[n];
+}
+
+/* route node through which route from or to a point on track goes,
+ * with distance from the point and edge the point is on */
+struct TrackNode {
+	int node;
+	double offset;
+	uint32_t edge;
+
+	bool operator<(const TrackNode& other) const {
+		return node < other.node || (node == other.node && offset < other.offset);
+	}
+};
+
+/* whether direction changes by more than 90 degrees between given
+ * bearings, which trains can't do */
+inline bool IsSharpTurn(double from, double to) {
+	double delta = std::fabs(to - from);
+	if (delta > M_PI)
+		delta = 2.0 * M_PI - delta;
+	return delta > M_PI / 2.0;
+}
+
+}
+
+RailRouting::RailRouting(bool single_pass) {
+	AddTagKey("railway");
+	AddTagKey("name");
+	AddTagKey("alt_name");
+	AddTagKey("official_name");
+	AddTagKey("oneway");
+	AddTagKey("designated_direction");
+	AddTagKey("public_transport");
+	AddTagKey("train");
+
+	node_locations_.reset(new SparseNodeStore);
+
+	if (single_pass) {
+		AddViewPass(&RailRouting::StoreNode, &RailRouting::ProcessWay, NULL, &RailRouting::FinalizeNodes, false, "loading data");
+	} else {
+		AddViewPass(NULL, &RailRouting::ProcessWay, NULL, NULL, false, "loading ways");
+		AddViewPass(&RailRouting::ProcessNode, NULL, NULL, &RailRouting::FinalizeNodes, false, "loading nodes");
+		SetPassFilter(&RailRouting::IsNeededNode);
+	}
 	AddPass(NULL, NULL, NULL, &RailRouting::Prepare, false, "preparing");
 }
 
-void RailRouting::ProcessNode(Node& node) {
-	if (needed_nodes_.find(node.GetId()) != needed_nodes_.end())
-		nodes_.insert(std::make_pair(node.GetId(), node));
+void RailRouting::SetNodeStore(NodeStoreType type, osmid_t max_dense_id) {
+	switch (type) {
+	case SPARSE_NODE_STORE:
+		node_locations_.reset(new SparseNodeStore);
+		break;
+	case DENSE_NODE_STORE:
+		node_locations_.reset(new DenseNodeStore(max_dense_id));
+		break;
+	}
+}
+
+bool RailRouting::IsStop(const Node& node) {
+	return node.IsTag(key_railway, val_station) || node.IsTag(key_railway, val_halt) ||
+		(node.IsTag(key_public_transport, val_stop_position) && node.IsTag(key_train, val_yes));
 }
 
-void RailRouting::ProcessWay(Way& way) {
-	std::string railway;
-	if (way.GetTag("railway", railway) && (railway == "rail" || railway == "abandoned" || railway == "disused" || railway == "narrow_gauge")) {
-		for (int i = 0; i < way.GetNodesCount(); ++i)
-			needed_nodes_.insert(way.NodeAt(i));
-		ways_.insert(std::make_pair(way.GetId(), way));
+bool RailRouting::IsStop(const NodeView& node) {
+	return node.tags.Is("railway", "station") || node.tags.Is("railway", "halt") ||
+		(node.tags.Is("public_transport", "stop_position") && node.tags.Is("train", "yes"));
+}
+
+bool RailRouting::IsNeededNode(TagType type, osmid_t id) const {
+	return type != NODE || needed_nodes_.test(id);
+}
+
+void RailRouting::ProcessNode(const NodeView& node) {
+	if (needed_nodes_.test(node.id))
+		StoreNode(node);
+}
+
+void RailRouting::StoreNode(const NodeView& node) {
+	node_locations_->Set(node.id, node.GetLonLat());
+
+	/* tags of stops are needed later, other nodes are reduced to locations */
+	if (IsStop(node)) {
+		NodeMap::iterator stored = stop_nodes_.insert(std::make_pair(node.id, Node(node.id, node.lat, node.lon))).first;
+		node.tags.CopyTo(stored->second);
 	}
 }
 
-void RailRouting::Prepare() {
-	/* drop unused */
-	needed_nodes_.clear();
+void RailRouting::FinalizeNodes() {
+	node_locations_->Finalize();
+}
 
-	std::cerr << nodes_.size() << " nodes" << std::endl;
+bool RailRouting::LocateNode(osmid_t id, RoutePoint& point) const {
+	if (!needed_nodes_.test(id) || !node_locations_->Get(id, point))
+		return false;
+	point.osmid = id;
+	return true;
+}
+
+void RailRouting::ProcessWay(const WayView& way) {
+	const StrView* railway = way.tags.Find("railway");
+	if (railway == NULL || (*railway != "rail" && *railway != "abandoned" && *railway != "disused" && *railway != "narrow_gauge"))
+		return;
+
+	std::pair<WayMap::iterator, bool> stored = ways_.insert(std::make_pair(way.id, Way(way.id)));
+	if (!stored.second)
+		return;
+
+	Way& stored_way = stored.first->second;
+	stored_way.ReserveNodes(way.nrefs);
+	for (size_t i = 0; i < way.nrefs; ++i)
+		stored_way.AddNode(way.refs[i]);
+	way.tags.CopyTo(stored_way);
+
+	for (size_t i = 0; i < way.nrefs; ++i)
+		needed_nodes_.set(way.refs[i]);
+}
+
+void RailRouting::Prepare() {
+	std::cerr << node_locations_->size() << " nodes" << std::endl;
 	std::cerr << ways_.size() << " ways" << std::endl;
 
 	typedef std::unordered_map<osmid_t, ConnectivityInfo> NodeConnectivityMap;
@@ -63,22 +188,24 @@ void RailRouting::Prepare() {
 	typedef std::multimap<std::string, osmid_t> TempStopMap;
 	TempStopMap temp_stops_;
 
+	typedef std::unordered_map<osmid_t, std::string> TempStopNameMap;
+	TempStopNameMap temp_stop_names;
+
 	/* find stops */
-	for (NodeMap::const_iterator node = nodes_.begin(); node != nodes_.end(); node++) {
-		if (node->second.IsTag("railway", "station") || node->second.IsTag("railway", "halt") ||
-					(node->second.IsTag("public_transport", "stop_position") && node->second.IsTag("train", "yes"))
-				) {
-			std::string name;
-			if (node->second.GetTag("name", name)) {
-				temp_stops_.insert(std::make_pair(name, node->second.GetId()));
+	for (NodeMap::const_iterator node = stop_nodes_.begin(); node != stop_nodes_.end(); node++) {
+		if (needed_nodes_.test(node->first)) {
+			strid_t name;
+			if ((name = node->second.GetTagId(key_name)) != 0) {
+				temp_stops_.insert(std::make_pair(strings.Get(name), node->second.GetId()));
+				temp_stop_names.insert(std::make_pair(node->second.GetId(), strings.Get(name)));
 				node_connectivity[node->second.GetId()].isstop = true;
 			}
-			if (node->second.GetTag("alt_name", name)) {
-				temp_stops_.insert(std::make_pair(name, node->second.GetId()));
+			if ((name = node->second.GetTagId(key_alt_name)) != 0) {
+				temp_stops_.insert(std::make_pair(strings.Get(name), node->second.GetId()));
 				node_connectivity[node->second.GetId()].isstop = true;
 			}
-			if (node->second.GetTag("official_name", name)) {
-				temp_stops_.insert(std::make_pair(name, node->second.GetId()));
+			if ((name = node->second.GetTagId(key_official_name)) != 0) {
+				temp_stops_.insert(std::make_pair(strings.Get(name), node->second.GetId()));
 				node_connectivity[node->second.GetId()].isstop = true;
 			}
 		}
@@ -95,21 +222,40 @@ void RailRouting::Prepare() {
 		}
 	}
 
-	/* create route nodes */
-	for (NodeMap::const_iterator node = nodes_.begin(); node != nodes_.end(); node++) {
-		NodeConnectivityMap::const_iterator connectivity = node_connectivity.find(node->first);
+	/* create route nodes; edges are first collected into slots
+	 * reserved for each node, which are packed afterwards */
+	std::vector<osmid_t> route_node_ids;
+	std::vector<LonLat> route_node_pos;
+	std::vector<uint32_t> slot_offsets(1, 0);
+
+	RoutePoint point;
+	osmid_t id = std::numeric_limits<osmid_t>::min();
+	for (bool found = needed_nodes_.next(id, id); found; found = needed_nodes_.next(id + 1, id)) {
+		if (!node_locations_->Get(id, point))
+			continue;
+
+		NodeConnectivityMap::const_iterator connectivity = node_connectivity.find(id);
 		assert(connectivity != node_connectivity.end());
 
 		if (connectivity->second.nways > 1 || connectivity->second.nedges != 2 || connectivity->second.isstop) {
-			route_nodes_.push_back(RouteNode(node->first, connectivity->second.nedges, route_edge_pool_.alloc(connectivity->second.nedges)));
-			id_to_routenode.insert(std::make_pair(node->first, route_nodes_.size() - 1));
+			route_node_ids.push_back(id);
+			route_node_pos.push_back(point);
+			slot_offsets.push_back(slot_offsets.back() + connectivity->second.nedges);
+			id_to_routenode.insert(std::make_pair(id, route_node_ids.size() - 1));
 		}
 	}
 
-	std::cerr << route_nodes_.size() << " routing nodes" << std::endl;
+	std::cerr << route_node_ids.size() << " routing nodes" << std::endl;
+
+	std::vector<uint32_t> slot_targets(slot_offsets.back());
+	std::vector<double> slot_lengths(slot_offsets.back());
+	std::vector<EdgeInfo> slot_info(slot_offsets.back());
+	std::vector<uint32_t> slots_used(route_node_ids.size(), 0);
 
 	/* split real edges to route edges */
 	int nedges = 0;
+	std::vector<RoutePoint> way_nodes;
+	std::vector<double> segment_lengths;
 	for (WayMap::const_iterator way = ways_.begin(); way != ways_.end(); way++) {
 		if (way->second.GetNodesCount() < 2) {
 			std::cerr << "way #" << way->first << ": has only " << way->second.GetNodesCount() << " nodes, skipping" << std::endl;
@@ -117,46 +263,56 @@ void RailRouting::Prepare() {
 		}
 
 		/* find first node */
-		NodeMap::const_iterator start_node = nodes_.find(way->second.NodeAt(0));
-		if (start_node == nodes_.end()) {
+		RoutePoint start_node;
+		if (!LocateNode(way->second.NodeAt(0), start_node)) {
 			std::cerr << "way #" << way->first << ": missing node[0] #" << way->second.NodeAt(0) << ", skipping" << std::endl;
 			continue;
 		}
 
-		NodeMap::const_iterator prev_node = start_node;
+		/* find the rest of nodes up to the first missing one, and
+		 * calculate segment lengths in a batch */
+		way_nodes.assign(1, start_node);
+		for (int node_pos = 1; node_pos < way->second.GetNodesCount(); ++node_pos) {
+			RoutePoint this_node;
+			if (!LocateNode(way->second.NodeAt(node_pos), this_node)) {
+				std::cerr << "way #" << way->first << ": missing node[" << node_pos << "] #" << way->second.NodeAt(node_pos) << ", skipping rest" << std::endl;
+				break;
+			}
+			way_nodes.push_back(this_node);
+		}
+
+		segment_lengths.resize(way_nodes.size() - 1);
+		Distances(way_nodes.data(), way_nodes.size(), segment_lengths.data());
+
+		RoutePoint prev_node = start_node;
 		int start_route_node = -1;
 		int start_node_pos = 0;
 
-		NodeMap::const_iterator second_node = nodes_.end();
+		/* second node of current edge, which gives its direction */
+		RoutePoint second_node;
 
 		/* find route node index for first node */
 		{
-			IdToRouteNodeMap::const_iterator routeidx = id_to_routenode.find(prev_node->first);
+			IdToRouteNodeMap::const_iterator routeidx = id_to_routenode.find(prev_node.osmid);
 			assert(routeidx != id_to_routenode.end());
 
 			start_route_node = routeidx->second;
 		}
 
 		double dist = 0.0;
-		for (int node_pos = 1; node_pos < way->second.GetNodesCount(); ++node_pos) {
-			/* find current node */
-			NodeMap::const_iterator this_node = nodes_.find(way->second.NodeAt(node_pos));
-			if (this_node == nodes_.end()) {
-				std::cerr << "way #" << way->first << ": missing node[" << node_pos << "] #" << way->second.NodeAt(node_pos) << ", skipping rest" << std::endl;
-				node_pos = way->second.GetNodesCount();
-				continue;
-			}
+		for (int node_pos = 1; node_pos < (int)way_nodes.size(); ++node_pos) {
+			const RoutePoint& this_node = way_nodes[node_pos];
 
-			if (node_pos == 1)
+			if (node_pos == start_node_pos + 1)
 				second_node = this_node;
 
 			/* add distance of last segment */
-			dist += Distance(prev_node->second, this_node->second);
+			dist += segment_lengths[node_pos - 1];
 
 			/* check whether this is a routing node */
 			int this_route_node = -1;
 			{
-				IdToRouteNodeMap::const_iterator routeidx = id_to_routenode.find(this_node->first);
+				IdToRouteNodeMap::const_iterator routeidx = id_to_routenode.find(this_node.osmid);
 				if (routeidx != id_to_routenode.end())
 					this_route_node = routeidx->second;
 
@@ -170,40 +326,28 @@ void RailRouting::Prepare() {
 
 			/* if we're at routing node, add routing edge */
 			if (this_route_node != -1) {
-				int edge_pos;
-
 				/* add forward edge, taking oneway into account */
-				if (!way->second.IsTag("oneway", "-1") && !way->second.IsTag("designated_direction", "backward")) {
-					for (edge_pos = 0; edge_pos < route_nodes_[start_route_node].nedges; edge_pos++) {
-						if (route_nodes_[start_route_node].edges[edge_pos].osmid == 0) {
-							route_nodes_[start_route_node].edges[edge_pos].osmid = way->first;
-							route_nodes_[start_route_node].edges[edge_pos].start_pos = start_node_pos;
-							route_nodes_[start_route_node].edges[edge_pos].end_pos = node_pos;
-							route_nodes_[start_route_node].edges[edge_pos].node = this_route_node;
-							route_nodes_[start_route_node].edges[edge_pos].direction = Bearing(start_node->second, second_node->second);;
-							route_nodes_[start_route_node].edges[edge_pos].length = dist;
-							nedges++;
-							break;
-						}
-					}
-					assert(edge_pos != route_nodes_[start_route_node].nedges);
+				if (!way->second.IsTag(key_oneway, val_minus_one) && !way->second.IsTag(key_designated_direction, val_backward)) {
+					assert(slots_used[start_route_node] < slot_offsets[start_route_node + 1] - slot_offsets[start_route_node]);
+					uint32_t slot = slot_offsets[start_route_node] + slots_used[start_route_node]++;
+
+					EdgeInfo info = { way->first, (uint16_t)start_node_pos, (uint16_t)node_pos, (float)Bearing(start_node, second_node), (float)Bearing(prev_node, this_node) };
+					slot_targets[slot] = this_route_node;
+					slot_lengths[slot] = dist;
+					slot_info[slot] = info;
+					nedges++;
 				}
 
 				/* add backward edge, taking oneway into account */
-				if (!way->second.IsTag("oneway", "yes") && !way->second.IsTag("designated_direction", "forward")) {
-					for (edge_pos = 0; edge_pos < route_nodes_[this_route_node].nedges; edge_pos++) {
-						if (route_nodes_[this_route_node].edges[edge_pos].osmid == 0) {
-							route_nodes_[this_route_node].edges[edge_pos].osmid = way->first;
-							route_nodes_[this_route_node].edges[edge_pos].start_pos = node_pos;
-							route_nodes_[this_route_node].edges[edge_pos].end_pos = start_node_pos;
-							route_nodes_[this_route_node].edges[edge_pos].node = start_route_node;
-							route_nodes_[this_route_node].edges[edge_pos].direction = Bearing(this_node->second, prev_node->second);
-							route_nodes_[this_route_node].edges[edge_pos].length = dist;
-							nedges++;
-							break;
-						}
-					}
-					assert(edge_pos != route_nodes_[this_route_node].nedges);
+				if (!way->second.IsTag(key_oneway, val_yes) && !way->second.IsTag(key_designated_direction, val_forward)) {
+					assert(slots_used[this_route_node] < slot_offsets[this_route_node + 1] - slot_offsets[this_route_node]);
+					uint32_t slot = slot_offsets[this_route_node] + slots_used[this_route_node]++;
+
+					EdgeInfo info = { way->first, (uint16_t)node_pos, (uint16_t)start_node_pos, (float)Bearing(this_node, prev_node), (float)Bearing(second_node, start_node) };
+					slot_targets[slot] = start_route_node;
+					slot_lengths[slot] = dist;
+					slot_info[slot] = info;
+					nedges++;
 				}
 
 				dist = 0.0;
@@ -216,7 +360,59 @@ void RailRouting::Prepare() {
 		}
 	}
 
-	std::cerr << nedges << " routing edges" << std::endl;
+	/* pack used slots; unused ones remain for oneway and incomplete ways */
+	std::vector<uint32_t> edge_offsets;
+	std::vector<uint32_t> edge_targets;
+	std::vector<double> edge_lengths;
+	std::vector<EdgeInfo> edge_info;
+
+	edge_offsets.reserve(route_node_ids.size() + 1);
+	edge_targets.reserve(nedges);
+	edge_lengths.reserve(nedges);
+	edge_info.reserve(nedges);
+
+	for (size_t node = 0; node < route_node_ids.size(); ++node) {
+		edge_offsets.push_back(edge_targets.size());
+		for (uint32_t slot = slot_offsets[node]; slot < slot_offsets[node] + slots_used[node]; ++slot) {
+			edge_targets.push_back(slot_targets[slot]);
+			edge_lengths.push_back(slot_lengths[slot]);
+			edge_info.push_back(slot_info[slot]);
+		}
+	}
+	edge_offsets.push_back(edge_targets.size());
+
+	route_node_ids_.assign(route_node_ids);
+	route_node_pos_.assign(route_node_pos);
+	edge_offsets_.assign(edge_offsets);
+	edge_targets_.assign(edge_targets);
+	edge_lengths_.assign(edge_lengths);
+	edge_info_.assign(edge_info);
+
+	std::cerr << edge_targets_.size() << " routing edges" << std::endl;
+
+	/* build reverse graph, keeping order of forward edges */
+	std::vector<uint32_t> rev_edge_offsets(route_node_ids_.size() + 1, 0);
+	for (uint32_t nedge = 0; nedge < edge_targets_.size(); ++nedge)
+		rev_edge_offsets[edge_targets_[nedge] + 1]++;
+	for (size_t node = 0; node < route_node_ids_.size(); ++node)
+		rev_edge_offsets[node + 1] += rev_edge_offsets[node];
+
+	std::vector<uint32_t> rev_edge_sources(edge_targets_.size());
+	std::vector<double> rev_edge_lengths(edge_targets_.size());
+	std::vector<uint32_t> rev_slots_used(route_node_ids_.size(), 0);
+
+	for (size_t node = 0; node < route_node_ids_.size(); ++node) {
+		for (uint32_t nedge = edge_offsets_[node]; nedge < edge_offsets_[node + 1]; ++nedge) {
+			const uint32_t target = edge_targets_[nedge];
+			const uint32_t slot = rev_edge_offsets[target] + rev_slots_used[target]++;
+			rev_edge_sources[slot] = node;
+			rev_edge_lengths[slot] = edge_lengths_[nedge];
+		}
+	}
+
+	rev_edge_offsets_.assign(rev_edge_offsets);
+	rev_edge_sources_.assign(rev_edge_sources);
+	rev_edge_lengths_.assign(rev_edge_lengths);
 
 	/* postprocess stops */
 	for (TempStopMap::const_iterator stop = temp_stops_.begin(); stop != temp_stops_.end(); ++stop) {
@@ -225,186 +421,1180 @@ void RailRouting::Prepare() {
 
 		stops_.insert(std::make_pair(stop->first, routeidx->second));
 	}
+
+	for (TempStopNameMap::const_iterator stop = temp_stop_names.begin(); stop != temp_stop_names.end(); ++stop) {
+		IdToRouteNodeMap::const_iterator routeidx = id_to_routenode.find(stop->first);
+		assert(routeidx != id_to_routenode.end());
+
+		stop_names_.insert(std::make_pair(routeidx->second, stop->second));
+	}
+
+	BuildStationIndex();
+
+	/* OSM data is no longer needed after geometry is compiled */
+	CompileGeometry();
+	BuildTrackIndex();
+
+	ways_.clear();
+	needed_nodes_.clear();
+	node_locations_->Clear();
+	stop_nodes_.clear();
+
+	InvalidateRouteCache();
 }
 
-bool RailRouting::FindRoute(const std::string& name_a, const std::string& name_b, FindRouteResult& result) const {
-	typedef std::multimap<double, int> NodeQueue;
-	NodeQueue queue;
+void RailRouting::CompileGeometry() {
+	std::vector<EdgePolyline> polylines(edge_targets_.size());
+	std::vector<RoutePoint> points;
+
+	for (uint32_t nedge = 0; nedge < edge_targets_.size(); ++nedge) {
+		/* reverse edge goes over the same points backwards */
+		const uint32_t reverse = ReverseEdge(nedge);
+		if (reverse < nedge) {
+			polylines[nedge].first = polylines[reverse].last;
+			polylines[nedge].last = polylines[reverse].first;
+			continue;
+		}
 
-	typedef std::set<int> NodeSet;
-	NodeSet start_nodes;
-	NodeSet fin_nodes;
+		const EdgeInfo& edge = edge_info_[nedge];
+		WayMap::const_iterator way = ways_.find(edge.way);
+		assert(way != ways_.end());
 
-	result.start_count = result.end_count = 0;
+		/* missing nodes are never referenced by route edges */
+		const int step = edge.start_pos < edge.end_pos ? 1 : -1;
+		polylines[nedge].first = points.size();
+		for (int pos = edge.start_pos; pos != edge.end_pos + step; pos += step) {
+			RoutePoint point;
+			bool found = LocateNode(way->second.NodeAt(pos), point);
+			assert(found);
+			(void)found;
+			points.push_back(point);
+		}
+		polylines[nedge].last = points.size() - 1;
+	}
 
-	lazyinit_array<int> starts(route_nodes_.size(), -1);
-	lazyinit_array<int> prevs(route_nodes_.size(), -1);
-	lazyinit_array<double> lengths(route_nodes_.size(), std::numeric_limits<double>::infinity());
+	edge_polylines_.assign(polylines);
+	edge_points_.assign(points);
+}
 
-	/* find stops for station A */
-	std::pair<StopMap::const_iterator, StopMap::const_iterator> stops = stops_.equal_range(name_a);
-	for (StopMap::const_iterator stop = stops.first; stop != stops.second; stop++) {
-		start_nodes.insert(stop->second);
-		prevs[stop->second] = -1;
-		starts[stop->second] = stop->second;
-		lengths[stop->second] = 0.0;
-		queue.insert(std::make_pair(0.0, stop->second));
-		result.start_count++;
+void RailRouting::Clear() {
+	ways_.clear();
+	needed_nodes_.clear();
+	node_locations_->Clear();
+	stop_nodes_.clear();
+	stops_.clear();
+	station_index_.clear();
+	route_node_ids_.clear();
+	route_node_pos_.clear();
+	edge_offsets_.clear();
+	edge_targets_.clear();
+	edge_lengths_.clear();
+	edge_info_.clear();
+	rev_edge_offsets_.clear();
+	rev_edge_sources_.clear();
+	rev_edge_lengths_.clear();
+	ch_up_offsets_.clear();
+	ch_up_targets_.clear();
+	ch_up_lengths_.clear();
+	ch_up_arcs_.clear();
+	ch_down_offsets_.clear();
+	ch_down_sources_.clear();
+	ch_down_lengths_.clear();
+	ch_down_arcs_.clear();
+	ch_shortcuts_.clear();
+	landmarks_.clear();
+	landmark_from_.clear();
+	landmark_to_.clear();
+	stop_names_.clear();
+	edge_polylines_.clear();
+	edge_points_.clear();
+	track_grid_.clear();
+	track_segment_edges_.clear();
+	track_segment_positions_.clear();
+	track_segment_offsets_.clear();
+	snapshot_.Close();
+
+	InvalidateRouteCache();
+}
+
+void RailRouting::BuildStationIndex() {
+	std::vector<std::string> names;
+	for (StopMap::const_iterator stop = stops_.begin(); stop != stops_.end(); stop = stops_.upper_bound(stop->first))
+		names.push_back(stop->first);
+
+	station_index_.Build(names);
+}
+
+void RailRouting::BuildTrackIndex() {
+	std::vector<uint32_t> segment_edges;
+	std::vector<uint16_t> segment_positions;
+	std::vector<double> segment_offsets;
+
+	track_grid_.clear();
+
+	/* geometry shared by edges in both directions is indexed once,
+	 * for the first of them */
+	std::vector<RoutePoint> nodes;
+	std::vector<double> lengths;
+	for (uint32_t nedge = 0; nedge < edge_targets_.size(); ++nedge) {
+		if (ReverseEdge(nedge) < nedge)
+			continue;
+
+		nodes.clear();
+		AppendEdgeNodes(nedge, 0, EdgeSegments(nedge), nodes);
+
+		lengths.resize(nodes.size() - 1);
+		Distances(nodes.data(), nodes.size(), lengths.data());
+
+		double offset = 0.0;
+		for (size_t i = 1; i < nodes.size(); ++i) {
+			track_grid_.Add(nodes[i - 1], nodes[i], segment_edges.size());
+			segment_edges.push_back(nedge);
+			segment_positions.push_back(i - 1);
+			segment_offsets.push_back(offset);
+			offset += lengths[i - 1];
+		}
 	}
 
-	/* fin stop for station B */
-	stops = stops_.equal_range(name_b);
-	for (StopMap::const_iterator stop = stops.first; stop != stops.second; stop++) {
-		fin_nodes.insert(stop->second);
-		result.end_count++;
+	track_grid_.Finalize();
+	track_segment_edges_.assign(segment_edges);
+	track_segment_positions_.assign(segment_positions);
+	track_segment_offsets_.assign(segment_offsets);
+}
+
+bool RailRouting::SnapToEdges(const LonLat& pos, std::vector<segment_grid::Hit>& hits, std::vector<TrackPosition>& positions) const {
+	positions.clear();
+	track_grid_.FindNearest(pos, max_snap_distance, snap_tolerance, hits);
+
+	for (std::vector<segment_grid::Hit>::const_iterator hit = hits.begin(); hit != hits.end(); ++hit) {
+		const uint32_t nedge = track_segment_edges_[hit->id];
+
+		/* last segment of edge ends at its full length */
+		double segment_end = edge_lengths_[nedge];
+		if (hit->id + 1 < track_segment_edges_.size() && track_segment_edges_[hit->id + 1] == nedge)
+			segment_end = track_segment_offsets_[hit->id + 1];
+
+		const double segment_start = track_segment_offsets_[hit->id];
+
+		TrackPosition position = { nedge, track_segment_positions_[hit->id], segment_start + (segment_end - segment_start) * hit->fraction, hit->point };
+		positions.push_back(position);
+
+		/* the same position on reverse edge */
+		const uint32_t reverse = ReverseEdge(nedge);
+		if (reverse != edge_targets_.size()) {
+			TrackPosition reverse_position = { reverse, EdgeSegments(nedge) - 1 - position.segment, std::max(edge_lengths_[reverse] - position.offset, 0.0), hit->point };
+			positions.push_back(reverse_position);
+		}
 	}
 
-	if (start_nodes.empty() && fin_nodes.empty()) {
-		result.status = FindRouteResult::BOTH_STATIONS_NOT_FOUND;
-		return false;
-	} else if (start_nodes.empty()) {
-		result.status = FindRouteResult::START_STATION_NOT_FOUND;
-		return false;
-	} else if (fin_nodes.empty()) {
-		result.status = FindRouteResult::END_STATION_NOT_FOUND;
+	return !positions.empty();
+}
+
+void RailRouting::SetTrackNodes(const std::vector<TrackPosition>& positions, bool at_end, NodeSet& nodes, std::vector<double>& offsets, std::vector<uint32_t>& edges) const {
+	/* route continues from target of edge the start position is on,
+	 * and arrives to source of edge the fin one is on; the same node
+	 * may be reached through several edges, of which the closest one
+	 * is taken */
+	std::vector<TrackNode> candidates;
+	for (std::vector<TrackPosition>::const_iterator position = positions.begin(); position != positions.end(); ++position) {
+		if (at_end) {
+			TrackNode candidate = { (int)edge_targets_[position->edge], std::max(edge_lengths_[position->edge] - position->offset, 0.0), position->edge };
+			candidates.push_back(candidate);
+		} else {
+			TrackNode candidate = { EdgeSource(position->edge), position->offset, position->edge };
+			candidates.push_back(candidate);
+		}
+	}
+
+	std::stable_sort(candidates.begin(), candidates.end());
+
+	nodes.clear();
+	offsets.clear();
+	edges.clear();
+	for (std::vector<TrackNode>::const_iterator candidate = candidates.begin(); candidate != candidates.end(); ++candidate) {
+		if (nodes.empty() || nodes.back() != candidate->node) {
+			nodes.push_back(candidate->node);
+			offsets.push_back(candidate->offset);
+			edges.push_back(candidate->edge);
+		}
+	}
+}
+
+bool RailRouting::SnapToTrack(const LonLat& pos, double max_distance, RoutePoint& point, double& distance) const {
+	std::vector<segment_grid::Hit> hits;
+	if (!track_grid_.FindNearest(pos, max_distance, snap_tolerance, hits))
 		return false;
+
+	point = RoutePoint(0, hits.front().point);
+	distance = hits.front().distance;
+	return true;
+}
+
+void RailRouting::FindStations(const std::string& query, std::vector<std::string>& names) const {
+	station_index_.Find(query, names);
+}
+
+void RailRouting::CompleteStations(const std::string& prefix, size_t limit, std::vector<std::string>& names) const {
+	station_index_.Complete(prefix, limit, names);
+}
+
+void RailRouting::FindSimilarStations(const std::string& query, int max_distance, size_t limit, std::vector<StationMatch>& matches) const {
+	station_index_.FindSimilar(query, max_distance, limit, matches);
+}
+
+void RailRouting::InvalidateRouteCache() {
+	if (route_cache_)
+		route_cache_->clear();
+}
+
+void RailRouting::SetRouteCache(size_t capacity) {
+	if (capacity > 0)
+		route_cache_.reset(new RouteCache(capacity));
+	else
+		route_cache_.reset();
+}
+
+RailRouting::RouteCacheStats RailRouting::GetRouteCacheStats() const {
+	RouteCacheStats stats = { 0, 0, 0 };
+	if (route_cache_) {
+		stats.hits = route_cache_->hits();
+		stats.misses = route_cache_->misses();
+		stats.size = route_cache_->size();
+	}
+	return stats;
+}
+
+void RailRouting::ExportGraph(std::vector<uint32_t>& offsets, std::vector<uint32_t>& targets, std::vector<double>& lengths) const {
+	offsets.assign(edge_offsets_.begin(), edge_offsets_.end());
+	targets.assign(edge_targets_.begin(), edge_targets_.end());
+	lengths.assign(edge_lengths_.begin(), edge_lengths_.end());
+}
+
+double RailRouting::LandmarkBound(int node, int fin) const {
+	/* distances in tables are floats, so bounds are reduced by their
+	 * possible rounding error, which is below 2^-24 of distance */
+	static const double table_error = 1.0e-7;
+
+	const size_t nlandmarks = landmarks_.size();
+	const float* node_from = &landmark_from_[node * nlandmarks];
+	const float* node_to = &landmark_to_[node * nlandmarks];
+	const float* fin_from = &landmark_from_[fin * nlandmarks];
+	const float* fin_to = &landmark_to_[fin * nlandmarks];
+
+	/* by triangle inequality, d(v,t) >= d(L,t) - d(L,v) and
+	 * d(v,t) >= d(v,L) - d(t,L) for any landmark L; landmarks
+	 * which can't reach or be reached from nodes give no bounds */
+	double bound = 0.0;
+	for (size_t landmark = 0; landmark < nlandmarks; ++landmark) {
+		const double from_diff = (double)fin_from[landmark] - node_from[landmark];
+		const double to_diff = (double)node_to[landmark] - fin_to[landmark];
+
+		if (from_diff > bound && fin_from[landmark] != std::numeric_limits<float>::infinity())
+			bound = std::max(bound, from_diff - ((double)fin_from[landmark] + node_from[landmark]) * table_error);
+		if (to_diff > bound && node_to[landmark] != std::numeric_limits<float>::infinity())
+			bound = std::max(bound, to_diff - ((double)node_to[landmark] + fin_to[landmark]) * table_error);
+	}
+
+	return bound;
+}
+
+double RailRouting::LowerBound(int node, SearchMode mode, const NodeSet& fins, const std::vector<double>& fin_offsets, stamped_array<double>& bounds) const {
+	if (bounds[node] >= 0.0)
+		return bounds[node];
+
+	/* bound of distance to the closest fin node, plus what remains
+	 * from it; no fins are given for plain Dijkstra */
+	double bound = std::numeric_limits<double>::infinity();
+	for (size_t nfin = 0; nfin < fins.size(); ++nfin) {
+		if (mode == LANDMARK_SEARCH) {
+			bound = std::min(bound, LandmarkBound(node, fins[nfin]) + NodeOffset(fin_offsets, nfin));
+		} else {
+			/* route lengths are sums of great circle distances
+			 * between way nodes, so this never overestimates, and
+			 * is reduced slightly so rounding errors can't make it
+			 * do so either */
+			bound = std::min(bound, Distance(route_node_pos_[node], route_node_pos_[fins[nfin]]) * (1.0 - 1.0e-9) + NodeOffset(fin_offsets, nfin));
+		}
+	}
+
+	if (bound == std::numeric_limits<double>::infinity())
+		bound = 0.0;
+
+	return bounds[node] = bound;
+}
+
+RailRouting::QueryContext::SearchSpace::SearchSpace()
+	: links(-1),
+	  link_edges(-1),
+	  lengths(std::numeric_limits<double>::infinity()),
+	  bounds(-1.0) {
+}
+
+void RailRouting::QueryContext::SearchSpace::Reset(size_t nnodes) {
+	links.reset(nnodes);
+	link_edges.reset(nnodes);
+	lengths.reset(nnodes);
+	bounds.reset(nnodes);
+
+	multimap.reset(nnodes);
+	binary_heap.reset(nnodes);
+	quaternary_heap.reset(nnodes);
+	radix.reset(nnodes);
+}
+
+template <>
+multimap_queue<double>& RailRouting::QueryContext::SearchSpace::GetQueue<multimap_queue<double> >() {
+	return multimap;
+}
+
+template <>
+dary_heap<2, double>& RailRouting::QueryContext::SearchSpace::GetQueue<dary_heap<2, double> >() {
+	return binary_heap;
+}
+
+template <>
+dary_heap<4, double>& RailRouting::QueryContext::SearchSpace::GetQueue<dary_heap<4, double> >() {
+	return quaternary_heap;
+}
+
+template <>
+radix_heap<double>& RailRouting::QueryContext::SearchSpace::GetQueue<radix_heap<double> >() {
+	return radix;
+}
+
+template <class Queue>
+bool RailRouting::SearchForward(QueryContext& context, SearchMode mode, int& settled) const {
+	const NodeSet& start_nodes = context.start_nodes_;
+	const NodeSet& fin_nodes = context.fin_nodes_;
+	const std::vector<double>& fin_offsets = context.fin_offsets_;
+
+	QueryContext::SearchSpace& space = context.forward_;
+	space.Reset(route_node_ids_.size());
+
+	Queue& queue = space.GetQueue<Queue>();
+	stamped_array<int>& prevs = space.links;
+	stamped_array<double>& lengths = space.lengths;
+
+	/* lower bounds of remaining distance, computed once per reached
+	 * node; with plain Dijkstra these are all zero */
+	stamped_array<double>& bounds = space.bounds;
+
+	static const NodeSet no_fins;
+	const NodeSet& fins = mode == DIJKSTRA_SEARCH ? no_fins : fin_nodes;
+
+	for (size_t nstart = 0; nstart < start_nodes.size(); ++nstart) {
+		const int start = start_nodes[nstart];
+		lengths[start] = NodeOffset(context.start_offsets_, nstart);
+		queue.push(start, lengths[start] + LowerBound(start, mode, fins, fin_offsets, bounds));
 	}
 
-	/* Dijkstra */
+	/* Dijkstra, or A* if lower bounds are nonzero: queue is ordered
+	 * by length plus lower bound of the rest of the route */
 	double shortest_length = std::numeric_limits<double>::infinity();
 	while (!queue.empty()) {
 		/* take first node from queue */
-		const int current_node = queue.begin()->second;
-		const double current_length = queue.begin()->first;
+		const int current_node = queue.top();
+		const double current_estimate = queue.top_priority();
+
+		/* no route through this or remaining nodes may be shorter
+		 * than already found one */
+		if (current_estimate > shortest_length)
+			break;
 
-		queue.erase(queue.begin());
+		queue.pop();
 
 		/* if it's length has changed, it was visited earlier, so we
 		 * don't need to revisit it (1) */
-		if (lengths[current_node] < current_length)
+		if (lengths[current_node] + bounds[current_node] < current_estimate)
 			continue;
 
+		settled++;
+
 		/* if it's fin node, remember route length */
-		if (fin_nodes.find(current_node) != fin_nodes.end())
-			shortest_length = std::min(shortest_length, lengths[current_node]);
+		const NodeSet::const_iterator fin = std::lower_bound(fin_nodes.begin(), fin_nodes.end(), current_node);
+		if (fin != fin_nodes.end() && *fin == current_node)
+			shortest_length = std::min(shortest_length, lengths[current_node] + NodeOffset(fin_offsets, fin - fin_nodes.begin()));
 
-		for (int nedge = 0; nedge < route_nodes_[current_node].nedges; nedge++) {
-			const double new_length = lengths[current_node] + route_nodes_[current_node].edges[nedge].length;
+		const uint32_t edges_end = edge_offsets_[current_node + 1];
+		for (uint32_t nedge = edge_offsets_[current_node]; nedge < edges_end; nedge++) {
+			const double new_length = lengths[current_node] + edge_lengths_[nedge];
 
 			/* we may just ignore longer routes that already found ones */
 			if (new_length > shortest_length)
-				break;
-
-			const int other_node = route_nodes_[current_node].edges[nedge].node;
-			if (other_node == -1) {
-				/* may happen if we've dropped some incomplete ways in Prepare() */
 				continue;
-			}
+
+			const int other_node = edge_targets_[nedge];
 
 			if (new_length < lengths[other_node]) {
-				starts[other_node] = starts[current_node];
 				prevs[other_node] = current_node;
 				lengths[other_node] = new_length;
 
-				queue.insert(std::make_pair(new_length, other_node));
+				queue.push(other_node, new_length + LowerBound(other_node, mode, fins, fin_offsets, bounds));
 			}
 		}
 	}
 
 	/* find closest final node */
-	int best_fin = *fin_nodes.begin();
-	double best_length = lengths[best_fin];
-	for (NodeSet::const_iterator fin = ++fin_nodes.begin(); fin != fin_nodes.end(); ++fin) {
-		if (lengths[*fin] < best_length) {
-			best_length = lengths[*fin];
-			best_fin = *fin;
+	int best_fin = fin_nodes.front();
+	double best_length = lengths[best_fin] + NodeOffset(fin_offsets, 0);
+	for (size_t nfin = 1; nfin < fin_nodes.size(); ++nfin) {
+		const double length = lengths[fin_nodes[nfin]] + NodeOffset(fin_offsets, nfin);
+		if (length < best_length) {
+			best_length = length;
+			best_fin = fin_nodes[nfin];
 		}
 	}
 
-	if (best_length == std::numeric_limits<double>::infinity()) {
-		result.status = FindRouteResult::NO_ROUTE_FOUND;
+	if (best_length == std::numeric_limits<double>::infinity())
 		return false;
+
+	/* recover route */
+	std::vector<int>& path = context.path_;
+	path.clear();
+	for (int node = best_fin; node != -1; node = prevs[node])
+		path.push_back(node);
+	std::reverse(path.begin(), path.end());
+
+	return true;
+}
+
+namespace {
+
+/* state of search in one direction of bidirectional search, which
+ * lives in search space of query context */
+template <class Queue>
+struct SearchFront {
+	Queue& queue;
+
+	/* previous node of route for forward search, next one for
+	 * backward search, and index of edge leading to it */
+	stamped_array<int>& links;
+	stamped_array<int>& link_edges;
+	stamped_array<double>& lengths;
+
+	/* adjacency for this direction */
+	const frozen_array<uint32_t>& offsets;
+	const frozen_array<uint32_t>& neighbours;
+	const frozen_array<double>& edge_lengths;
+
+	SearchFront(Queue& q, stamped_array<int>& ln, stamped_array<int>& le, stamped_array<double>& ls, const frozen_array<uint32_t>& o, const frozen_array<uint32_t>& n, const frozen_array<double>& l)
+		: queue(q),
+		  links(ln),
+		  link_edges(le),
+		  lengths(ls),
+		  offsets(o),
+		  neighbours(n),
+		  edge_lengths(l) {
 	}
 
-	/* fill rest of RouteResult */
-	NodeMap::const_iterator start_node = nodes_.find(route_nodes_[starts[best_fin]].osmid);
-	NodeMap::const_iterator end_node = nodes_.find(route_nodes_[best_fin].osmid);
+	void AddSource(int node, double length) {
+		lengths[node] = length;
+		queue.push(node, length);
+	}
+};
 
-	assert(start_node != nodes_.end());
-	assert(end_node != nodes_.end());
+}
 
-	result.start_node = &start_node->second;
-	result.end_node = &end_node->second;
-	result.distance = best_length;
-	result.status = FindRouteResult::OK;
+template <class Queue>
+bool RailRouting::SearchBidirectional(QueryContext& context, int& settled) const {
+	const NodeSet& start_nodes = context.start_nodes_;
+	const NodeSet& fin_nodes = context.fin_nodes_;
 
-	/* recover route */
-	std::vector<const Node*> temp_nodes;
-
-	int current_route_node = best_fin;
-	int prev_route_node = prevs[current_route_node];
-	while (prev_route_node != -1) {
-		const RouteEdge* edge;
-		/* find edge from prev to current node*/
-		for (edge = route_nodes_[prev_route_node].edges; edge != route_nodes_[prev_route_node].edges + route_nodes_[prev_route_node].nedges; edge++)
-			if (edge->node == current_route_node)
-				break;
+	QueryContext::SearchSpace& forward_space = context.forward_;
+	QueryContext::SearchSpace& backward_space = context.backward_;
+	forward_space.Reset(route_node_ids_.size());
+	backward_space.Reset(route_node_ids_.size());
 
-		assert(edge != route_nodes_[prev_route_node].edges + route_nodes_[prev_route_node].nedges);
+	SearchFront<Queue> forward(forward_space.GetQueue<Queue>(), forward_space.links, forward_space.link_edges, forward_space.lengths, edge_offsets_, edge_targets_, edge_lengths_);
+	SearchFront<Queue> backward(backward_space.GetQueue<Queue>(), backward_space.links, backward_space.link_edges, backward_space.lengths, rev_edge_offsets_, rev_edge_sources_, rev_edge_lengths_);
 
-		/* find way which forms the edge*/
-		WayMap::const_iterator way = ways_.find(edge->osmid);
-		assert(way != ways_.end());
+	for (size_t nstart = 0; nstart < start_nodes.size(); ++nstart)
+		forward.AddSource(start_nodes[nstart], NodeOffset(context.start_offsets_, nstart));
+	for (size_t nfin = 0; nfin < fin_nodes.size(); ++nfin)
+		backward.AddSource(fin_nodes[nfin], NodeOffset(context.fin_offsets_, nfin));
+
+	/* shortest route found so far goes through meeting node */
+	double shortest_length = std::numeric_limits<double>::infinity();
+	int meeting_node = -1;
+
+	/* stations may share stop */
+	for (size_t nfin = 0; nfin < fin_nodes.size(); ++nfin) {
+		const int fin = fin_nodes[nfin];
+		if (forward.lengths[fin] != std::numeric_limits<double>::infinity() && forward.lengths[fin] + backward.lengths[fin] < shortest_length) {
+			shortest_length = forward.lengths[fin] + backward.lengths[fin];
+			meeting_node = fin;
+		}
+	}
+
+	while (!forward.queue.empty() && !backward.queue.empty()) {
+		/* all nodes closer than queue heads are settled in their
+		 * directions, so any route not found yet is at least that
+		 * long */
+		if (forward.queue.top_priority() + backward.queue.top_priority() >= shortest_length)
+			break;
+
+		/* expand the direction which is closer to its sources */
+		const bool is_forward = forward.queue.top_priority() <= backward.queue.top_priority();
+		SearchFront<Queue>& front = is_forward ? forward : backward;
+		SearchFront<Queue>& other = is_forward ? backward : forward;
+
+		const int current_node = front.queue.top();
+		const double current_length = front.queue.top_priority();
+
+		front.queue.pop();
+
+		/* stale queue entry, see (1) */
+		if (front.lengths[current_node] < current_length)
+			continue;
+
+		settled++;
+
+		const uint32_t edges_end = front.offsets[current_node + 1];
+		for (uint32_t nedge = front.offsets[current_node]; nedge < edges_end; nedge++) {
+			const double new_length = current_length + front.edge_lengths[nedge];
 
-		/* traverse way in correct direction, and get all nodes that belong to this route edge*/
-		if (edge->start_pos < edge->end_pos) {
-			for (int node_pos = edge->end_pos; node_pos > edge->start_pos; --node_pos) {
-				NodeMap::const_iterator node = nodes_.find(way->second.NodeAt(node_pos));
-				assert(node != nodes_.end());
+			if (new_length >= shortest_length)
+				continue;
+
+			const int other_node = front.neighbours[nedge];
+
+			if (new_length < front.lengths[other_node]) {
+				front.links[other_node] = current_node;
+				front.link_edges[other_node] = nedge;
+				front.lengths[other_node] = new_length;
+
+				front.queue.push(other_node, new_length);
+
+				/* node was reached from the other side too: remember
+				 * route through it if it's shorter */
+				if (other.lengths[other_node] != std::numeric_limits<double>::infinity()) {
+					const double route_length = new_length + other.lengths[other_node];
+					if (route_length < shortest_length) {
+						shortest_length = route_length;
+						meeting_node = other_node;
+					}
+				}
+			}
+		}
+	}
+
+	if (meeting_node == -1)
+		return false;
+
+	/* recover route: forward part backwards from meeting node, then
+	 * backward part */
+	std::vector<int>& path = context.path_;
+	path.clear();
+	for (int node = meeting_node; node != -1; node = forward.links[node])
+		path.push_back(node);
+	std::reverse(path.begin(), path.end());
+	for (int node = backward.links[meeting_node]; node != -1; node = backward.links[node])
+		path.push_back(node);
+
+	return true;
+}
+
+template <class Queue>
+bool RailRouting::SearchHierarchy(QueryContext& context, int& settled) const {
+	const NodeSet& start_nodes = context.start_nodes_;
+	const NodeSet& fin_nodes = context.fin_nodes_;
+
+	QueryContext::SearchSpace& forward_space = context.forward_;
+	QueryContext::SearchSpace& backward_space = context.backward_;
+	forward_space.Reset(route_node_ids_.size());
+	backward_space.Reset(route_node_ids_.size());
+
+	SearchFront<Queue> forward(forward_space.GetQueue<Queue>(), forward_space.links, forward_space.link_edges, forward_space.lengths, ch_up_offsets_, ch_up_targets_, ch_up_lengths_);
+	SearchFront<Queue> backward(backward_space.GetQueue<Queue>(), backward_space.links, backward_space.link_edges, backward_space.lengths, ch_down_offsets_, ch_down_sources_, ch_down_lengths_);
+
+	for (size_t nstart = 0; nstart < start_nodes.size(); ++nstart)
+		forward.AddSource(start_nodes[nstart], NodeOffset(context.start_offsets_, nstart));
+	for (size_t nfin = 0; nfin < fin_nodes.size(); ++nfin)
+		backward.AddSource(fin_nodes[nfin], NodeOffset(context.fin_offsets_, nfin));
+
+	double shortest_length = std::numeric_limits<double>::infinity();
+	int meeting_node = -1;
+
+	for (;;) {
+		/* searches only go up in the hierarchy, so stopping rule of
+		 * plain bidirectional search doesn't apply; instead, each
+		 * one stops when its queue head is not closer than the
+		 * shortest route found */
+		const bool forward_active = !forward.queue.empty() && forward.queue.top_priority() < shortest_length;
+		const bool backward_active = !backward.queue.empty() && backward.queue.top_priority() < shortest_length;
+
+		if (!forward_active && !backward_active)
+			break;
+
+		const bool is_forward = forward_active && (!backward_active || forward.queue.top_priority() <= backward.queue.top_priority());
+		SearchFront<Queue>& front = is_forward ? forward : backward;
+		SearchFront<Queue>& other = is_forward ? backward : forward;
+
+		const int current_node = front.queue.top();
+		const double current_length = front.queue.top_priority();
+
+		front.queue.pop();
+
+		/* stale queue entry, see (1) */
+		if (front.lengths[current_node] < current_length)
+			continue;
+
+		settled++;
+
+		/* highest node of the shortest route is settled by both
+		 * searches */
+		if (other.lengths[current_node] != std::numeric_limits<double>::infinity()) {
+			const double route_length = current_length + other.lengths[current_node];
+			if (route_length < shortest_length) {
+				shortest_length = route_length;
+				meeting_node = current_node;
+			}
+		}
+
+		const uint32_t edges_end = front.offsets[current_node + 1];
+		for (uint32_t nedge = front.offsets[current_node]; nedge < edges_end; nedge++) {
+			const double new_length = current_length + front.edge_lengths[nedge];
+
+			if (new_length >= shortest_length)
+				continue;
+
+			const int other_node = front.neighbours[nedge];
+
+			if (new_length < front.lengths[other_node]) {
+				front.links[other_node] = current_node;
+				front.link_edges[other_node] = nedge;
+				front.lengths[other_node] = new_length;
+
+				front.queue.push(other_node, new_length);
+			}
+		}
+	}
+
+	if (meeting_node == -1)
+		return false;
+
+	/* collect arcs of the route: upward part backwards from meeting
+	 * node, then downward part */
+	std::vector<uint32_t>& arcs = context.arcs_;
+	arcs.clear();
+	int start_node = meeting_node;
+	for (; forward.links[start_node] != -1; start_node = forward.links[start_node])
+		arcs.push_back(ch_up_arcs_[forward.link_edges[start_node]]);
+	std::reverse(arcs.begin(), arcs.end());
+	for (int node = meeting_node; backward.links[node] != -1; node = backward.links[node])
+		arcs.push_back(ch_down_arcs_[backward.link_edges[node]]);
+
+	/* unpack shortcuts into graph edges */
+	std::vector<int>& path = context.path_;
+	path.clear();
+	path.push_back(start_node);
+	for (std::vector<uint32_t>::const_iterator arc = arcs.begin(); arc != arcs.end(); ++arc)
+		UnpackArc(*arc, context.unpack_stack_, path);
+
+	return true;
+}
+
+template <class Queue>
+bool RailRouting::SearchTurnAware(QueryContext& context, int& settled) const {
+	const NodeSet& start_nodes = context.start_nodes_;
+	const NodeSet& fin_nodes = context.fin_nodes_;
+	const std::vector<double>& fin_offsets = context.fin_offsets_;
+	const std::vector<uint32_t>& start_edges = context.start_edges_;
+	const std::vector<uint32_t>& fin_edges = context.fin_edges_;
+
+	/* search state is the edge by which route enters a node, as
+	 * that determines which edges it may leave the node by; so it's
+	 * A* over edges, with edges turning sharply from current one
+	 * skipped. There are only as many states as edges, and only
+	 * lengths and previous edges of reached ones are kept. Lower
+	 * bounds are great circle distances, which hold for routes with
+	 * any turns, and are kept by node */
+	QueryContext::SearchSpace& space = context.turn_aware_;
+	space.Reset(std::max(edge_targets_.size(), route_node_ids_.size()));
+
+	Queue& queue = space.GetQueue<Queue>();
+	stamped_array<int>& prevs = space.links;
+	stamped_array<double>& lengths = space.lengths;
+	stamped_array<double>& bounds = space.bounds;
+
+	/* found route is either the one entering fin node by best edge,
+	 * or a single start node which is also a fin one */
+	double shortest_length = std::numeric_limits<double>::infinity();
+	int best_edge = -1;
+	int best_node = -1;
+
+	for (size_t nstart = 0; nstart < start_nodes.size(); ++nstart) {
+		const int start = start_nodes[nstart];
+		const double start_length = NodeOffset(context.start_offsets_, nstart);
+
+		/* route from point on track enters start node by the edge
+		 * the point is on, otherwise it may leave it by any edge */
+		const bool entered = !start_edges.empty();
+		const double arrival = entered ? edge_info_[start_edges[nstart]].arrival : 0.0;
+
+		const NodeSet::const_iterator fin = std::lower_bound(fin_nodes.begin(), fin_nodes.end(), start);
+		if (fin != fin_nodes.end() && *fin == start) {
+			const size_t nfin = fin - fin_nodes.begin();
+			const double length = start_length + NodeOffset(fin_offsets, nfin);
+			if ((!entered || !IsSharpTurn(arrival, edge_info_[fin_edges[nfin]].direction)) && length < shortest_length) {
+				shortest_length = length;
+				best_node = start;
+			}
+		}
 
-				temp_nodes.push_back(&node->second);
+		const uint32_t edges_end = edge_offsets_[start + 1];
+		for (uint32_t nedge = edge_offsets_[start]; nedge < edges_end; nedge++) {
+			if (entered && IsSharpTurn(arrival, edge_info_[nedge].direction))
+				continue;
+
+			const double new_length = start_length + edge_lengths_[nedge];
+			if (new_length < lengths[nedge]) {
+				prevs[nedge] = -1;
+				lengths[nedge] = new_length;
+				queue.push(nedge, new_length + LowerBound(edge_targets_[nedge], ASTAR_SEARCH, fin_nodes, fin_offsets, bounds));
 			}
+		}
+	}
+
+	while (!queue.empty()) {
+		const int current_edge = queue.top();
+		const double current_estimate = queue.top_priority();
+
+		if (current_estimate > shortest_length)
+			break;
+
+		queue.pop();
+
+		const int current_node = edge_targets_[current_edge];
+		const double current_length = lengths[current_edge];
+
+		/* skip edges already visited with shorter length */
+		if (current_length + bounds[current_node] < current_estimate)
+			continue;
+
+		settled++;
+
+		const double arrival = edge_info_[current_edge].arrival;
+
+		/* if it enters fin node, remember route length, unless it
+		 * has to turn sharply onto edge the end point is on */
+		const NodeSet::const_iterator fin = std::lower_bound(fin_nodes.begin(), fin_nodes.end(), current_node);
+		if (fin != fin_nodes.end() && *fin == current_node) {
+			const size_t nfin = fin - fin_nodes.begin();
+			const double length = current_length + NodeOffset(fin_offsets, nfin);
+			if ((fin_edges.empty() || !IsSharpTurn(arrival, edge_info_[fin_edges[nfin]].direction)) && length < shortest_length) {
+				shortest_length = length;
+				best_edge = current_edge;
+				best_node = -1;
+			}
+		}
+
+		const uint32_t edges_end = edge_offsets_[current_node + 1];
+		for (uint32_t nedge = edge_offsets_[current_node]; nedge < edges_end; nedge++) {
+			if (IsSharpTurn(arrival, edge_info_[nedge].direction))
+				continue;
+
+			const double new_length = current_length + edge_lengths_[nedge];
+
+			/* we may just ignore longer routes that already found ones */
+			if (new_length > shortest_length)
+				continue;
+
+			if (new_length < lengths[nedge]) {
+				prevs[nedge] = current_edge;
+				lengths[nedge] = new_length;
+				queue.push(nedge, new_length + LowerBound(edge_targets_[nedge], ASTAR_SEARCH, fin_nodes, fin_offsets, bounds));
+			}
+		}
+	}
+
+	if (best_edge == -1 && best_node == -1)
+		return false;
+
+	/* recover route */
+	std::vector<int>& path = context.path_;
+	std::vector<uint32_t>& path_edges = context.path_edges_;
+	path.clear();
+	path_edges.clear();
+
+	if (best_edge == -1) {
+		path.push_back(best_node);
+		return true;
+	}
+
+	for (int nedge = best_edge; nedge != -1; nedge = prevs[nedge])
+		path_edges.push_back(nedge);
+	std::reverse(path_edges.begin(), path_edges.end());
+
+	path.push_back(EdgeSource(path_edges.front()));
+	for (std::vector<uint32_t>::const_iterator nedge = path_edges.begin(); nedge != path_edges.end(); ++nedge)
+		path.push_back(edge_targets_[*nedge]);
+
+	return true;
+}
+
+void RailRouting::CheckSearchMode(SearchMode mode) const {
+	if (mode == HIERARCHY_SEARCH && ch_up_offsets_.empty())
+		throw std::logic_error("contraction hierarchy is not built");
+	if (mode == LANDMARK_SEARCH && landmarks_.empty())
+		throw std::logic_error("landmarks are not built");
+}
+
+template <class Queue>
+bool RailRouting::Search(QueryContext& context, SearchMode mode, int& settled) const {
+	if (mode == BIDIRECTIONAL_SEARCH)
+		return SearchBidirectional<Queue>(context, settled);
+	else if (mode == HIERARCHY_SEARCH)
+		return SearchHierarchy<Queue>(context, settled);
+	else if (mode == TURN_AWARE_SEARCH)
+		return SearchTurnAware<Queue>(context, settled);
+	else
+		return SearchForward<Queue>(context, mode, settled);
+}
+
+bool RailRouting::Search(QueryContext& context, SearchMode mode, QueueType queue, int& settled) const {
+	context.path_edges_.clear();
+
+	switch (queue) {
+	case MULTIMAP_QUEUE:
+		return Search<multimap_queue<double> >(context, mode, settled);
+	case BINARY_HEAP_QUEUE:
+		return Search<dary_heap<2, double> >(context, mode, settled);
+	case QUATERNARY_HEAP_QUEUE:
+		return Search<dary_heap<4, double> >(context, mode, settled);
+	case RADIX_HEAP_QUEUE:
+		return Search<radix_heap<double> >(context, mode, settled);
+	}
+	return false;
+}
+
+uint32_t RailRouting::FindEdge(int from, int to) const {
+	/* shortest of edges between nodes, which is the one searches
+	 * take */
+	uint32_t best_edge = edge_offsets_[from + 1];
+	for (uint32_t nedge = edge_offsets_[from]; nedge != edge_offsets_[from + 1]; nedge++)
+		if (edge_targets_[nedge] == (uint32_t)to && (best_edge == edge_offsets_[from + 1] || edge_lengths_[nedge] < edge_lengths_[best_edge]))
+			best_edge = nedge;
+
+	assert(best_edge != edge_offsets_[from + 1]);
+	return best_edge;
+}
+
+int RailRouting::EdgeSource(uint32_t nedge) const {
+	return std::upper_bound(edge_offsets_.begin(), edge_offsets_.end(), nedge) - edge_offsets_.begin() - 1;
+}
+
+uint32_t RailRouting::ReverseEdge(uint32_t nedge) const {
+	const EdgeInfo& edge = edge_info_[nedge];
+	const int target = edge_targets_[nedge];
+
+	for (uint32_t nreverse = edge_offsets_[target]; nreverse < edge_offsets_[target + 1]; ++nreverse) {
+		const EdgeInfo& reverse = edge_info_[nreverse];
+		if (reverse.way == edge.way && reverse.start_pos == edge.end_pos && reverse.end_pos == edge.start_pos)
+			return nreverse;
+	}
+
+	return edge_targets_.size();
+}
+
+int RailRouting::EdgeSegments(uint32_t nedge) const {
+	const EdgeInfo& edge = edge_info_[nedge];
+	return edge.start_pos < edge.end_pos ? edge.end_pos - edge.start_pos : edge.start_pos - edge.end_pos;
+}
+
+void RailRouting::AppendEdgeNodes(uint32_t nedge, int first, int last, std::vector<RoutePoint>& nodes) const {
+	const EdgePolyline& polyline = edge_polylines_[nedge];
+	const RoutePoint* points = edge_points_.data();
+
+	/* points are copied as a range, in correct direction */
+	if (polyline.first <= polyline.last) {
+		nodes.insert(nodes.end(), points + polyline.first + first, points + polyline.first + last + 1);
+	} else {
+		typedef std::reverse_iterator<const RoutePoint*> ReverseIterator;
+		nodes.insert(nodes.end(), ReverseIterator(points + polyline.first - first + 1), ReverseIterator(points + polyline.first - last));
+	}
+}
+
+double RailRouting::AppendPathNodes(const QueryContext& context, std::vector<RoutePoint>& nodes) const {
+	const std::vector<int>& path = context.path_;
+	const std::vector<uint32_t>& path_edges = context.path_edges_;
+
+	/* distance is summed in the same order as forward search does */
+	double distance = 0.0;
+	for (size_t i = 1; i < path.size(); ++i) {
+		const uint32_t nedge = path_edges.empty() ? FindEdge(path[i - 1], path[i]) : path_edges[i - 1];
+		distance += edge_lengths_[nedge];
+		AppendEdgeNodes(nedge, 1, EdgeSegments(nedge), nodes);
+	}
+	return distance;
+}
+
+void RailRouting::FindSharpTurns(const std::vector<RoutePoint>& nodes, std::vector<double>& bearings, std::vector<RoutePoint>& turns) {
+	turns.clear();
+	if (nodes.size() <= 2)
+		return;
+
+	bearings.resize(nodes.size() - 1);
+	Bearings(nodes.data(), nodes.size(), bearings.data());
+
+	for (size_t i = 1; i < bearings.size(); ++i)
+		if (IsSharpTurn(bearings[i - 1], bearings[i]))
+			turns.push_back(nodes[i]);
+}
+
+void RailRouting::UnpackArc(uint32_t arc, std::vector<uint32_t>& stack, std::vector<int>& path) const {
+	stack.assign(1, arc);
+	while (!stack.empty()) {
+		const uint32_t current = stack.back();
+		stack.pop_back();
+
+		if (current < edge_targets_.size()) {
+			/* graph edge */
+			path.push_back(edge_targets_[current]);
 		} else {
-			for (int node_pos = edge->end_pos; node_pos < edge->start_pos; ++node_pos) {
-				NodeMap::const_iterator node = nodes_.find(way->second.NodeAt(node_pos));
-				assert(node != nodes_.end());
+			/* shortcut, second arc is unpacked after the first one */
+			const ShortcutInfo& shortcut = ch_shortcuts_[current - edge_targets_.size()];
+			stack.push_back(shortcut.second);
+			stack.push_back(shortcut.first);
+		}
+	}
+}
+
+int RailRouting::FindStops(const std::string& name, NodeSet& nodes) const {
+	nodes.clear();
+
+	int count = 0;
+	std::pair<StopMap::const_iterator, StopMap::const_iterator> stops = stops_.equal_range(name);
+	for (StopMap::const_iterator stop = stops.first; stop != stops.second; stop++) {
+		nodes.push_back(stop->second);
+		count++;
+	}
 
-				temp_nodes.push_back(&node->second);
+	/* fall back to stations with names differing in case or
+	 * spelling variations only */
+	if (nodes.empty()) {
+		std::vector<std::string> names;
+		station_index_.Find(name, names);
+		for (std::vector<std::string>::const_iterator similar = names.begin(); similar != names.end(); ++similar) {
+			stops = stops_.equal_range(*similar);
+			for (StopMap::const_iterator stop = stops.first; stop != stops.second; stop++) {
+				nodes.push_back(stop->second);
+				count++;
 			}
 		}
+	}
+
+	/* station may have several stops with the same route node */
+	std::sort(nodes.begin(), nodes.end());
+	nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+	return count;
+}
+
+RailRouting::QueryContext& RailRouting::ThreadContext() {
+	static thread_local QueryContext context;
+
+	return context;
+}
+
+bool RailRouting::FindRoute(const std::string& name_a, const std::string& name_b, FindRouteResult& result, SearchMode mode, QueueType queue) const {
+	return FindRoute(ThreadContext(), name_a, name_b, result, mode, queue);
+}
+
+bool RailRouting::FindRoute(QueryContext& context, const std::string& name_a, const std::string& name_b, FindRouteResult& result, SearchMode mode, QueueType queue) const {
+	/* before cache lookup, so unsupported modes fail the same way
+	 * whether result is cached or not */
+	CheckSearchMode(mode);
+
+	if (!route_cache_)
+		return FindRouteUncached(context, name_a, name_b, result, mode, queue);
+
+	const RouteKey key(name_a, name_b, mode == TURN_AWARE_SEARCH);
+
+	RouteCache::ValuePtr cached = route_cache_->get(key);
+	if (cached) {
+		result = *cached;
+		result.settled_count = 0;
+		return result.status == FindRouteResult::OK;
+	}
+
+	/* failures are cached too, as clients tend to repeat them */
+	const bool found = FindRouteUncached(context, name_a, name_b, result, mode, queue);
+	route_cache_->put(key, std::make_shared<const FindRouteResult>(result));
+
+	return found;
+}
+
+bool RailRouting::FindRouteUncached(QueryContext& context, const std::string& name_a, const std::string& name_b, FindRouteResult& result, SearchMode mode, QueueType queue) const {
+	const NodeSet& start_nodes = context.start_nodes_;
+	const NodeSet& fin_nodes = context.fin_nodes_;
 
-		/* one step back */
-		current_route_node = prev_route_node;
-		prev_route_node = prevs[current_route_node];
+	result.settled_count = 0;
+
+	/* find stops for stations A and B */
+	result.start_count = FindStops(name_a, context.start_nodes_);
+	result.end_count = FindStops(name_b, context.fin_nodes_);
+	context.start_offsets_.clear();
+	context.fin_offsets_.clear();
+	context.start_edges_.clear();
+	context.fin_edges_.clear();
+
+	if (start_nodes.empty() && fin_nodes.empty()) {
+		result.status = FindRouteResult::BOTH_STATIONS_NOT_FOUND;
+		return false;
+	} else if (start_nodes.empty()) {
+		result.status = FindRouteResult::START_STATION_NOT_FOUND;
+		return false;
+	} else if (fin_nodes.empty()) {
+		result.status = FindRouteResult::END_STATION_NOT_FOUND;
+		return false;
 	}
 
-	/* add first node (not added in the above loop) */
-	temp_nodes.push_back(&start_node->second);
+	const bool found = Search(context, mode, queue, result.settled_count);
 
-	/* reverse route in forward direction */
-	std::reverse(temp_nodes.begin(), temp_nodes.end());
+	if (!found) {
+		result.status = FindRouteResult::NO_ROUTE_FOUND;
+		return false;
+	}
+
+	/* sequence of route nodes from start to fin */
+	const std::vector<int>& path = context.path_;
+
+	/* fill rest of RouteResult */
+	result.start_node = RoutePoint(route_node_ids_[path.front()], route_node_pos_[path.front()]);
+	result.end_node = RoutePoint(route_node_ids_[path.back()], route_node_pos_[path.back()]);
+
+	StopNameMap::const_iterator start_name = stop_names_.find(path.front());
+	StopNameMap::const_iterator end_name = stop_names_.find(path.back());
+
+	result.start_name = start_name == stop_names_.end() ? "" : start_name->second;
+	result.end_name = end_name == stop_names_.end() ? "" : end_name->second;
+	result.status = FindRouteResult::OK;
+
+	/* recover route geometry; storage of reused result is reused
+	 * as well */
+	result.route_nodes.clear();
+	result.route_nodes.push_back(result.start_node);
+
+	result.distance = AppendPathNodes(context, result.route_nodes);
 
-	/* find sharp turns */
-	std::vector<const Node*> temp_sharp_turns;
-	if (temp_nodes.size() > 2) {
-		double prev_bearing = Bearing(**temp_nodes.begin(), **(temp_nodes.begin()+1));
-		for (std::vector<const Node*>::const_iterator node = ++temp_nodes.begin(); node != --temp_nodes.end(); ++node) {
-			double bearing = Bearing(**(node), **(node+1));
+	FindSharpTurns(result.route_nodes, context.bearings_, result.sharp_turns);
 
-			double delta = (bearing - prev_bearing)/M_PI*180.0;
-			if (delta > 180.0) delta -= 360.0;
-			if (delta < -180.0) delta += 360.0;
-			if (delta < 0.0) delta = -delta;
+	return true;
+}
 
-			if (delta > 90.0)
-				temp_sharp_turns.push_back(*node);
+bool RailRouting::FindRoute(const LonLat& from, const LonLat& to, FindRouteResult& result, SearchMode mode, QueueType queue) const {
+	return FindRoute(ThreadContext(), from, to, result, mode, queue);
+}
 
-			prev_bearing = bearing;
+bool RailRouting::FindRoute(QueryContext& context, const LonLat& from, const LonLat& to, FindRouteResult& result, SearchMode mode, QueueType queue) const {
+	CheckSearchMode(mode);
+
+	result.settled_count = 0;
+
+	/* find positions on track closest to points A and B */
+	std::vector<TrackPosition> starts;
+	std::vector<TrackPosition> fins;
+	SnapToEdges(from, context.snap_hits_, starts);
+	SnapToEdges(to, context.snap_hits_, fins);
+
+	result.start_count = starts.size();
+	result.end_count = fins.size();
+
+	if (starts.empty() && fins.empty()) {
+		result.status = FindRouteResult::BOTH_STATIONS_NOT_FOUND;
+		return false;
+	} else if (starts.empty()) {
+		result.status = FindRouteResult::START_STATION_NOT_FOUND;
+		return false;
+	} else if (fins.empty()) {
+		result.status = FindRouteResult::END_STATION_NOT_FOUND;
+		return false;
+	}
+
+	/* route may stay on a single edge if end point is ahead of start
+	 * point on it */
+	const TrackPosition* direct_start = NULL;
+	const TrackPosition* direct_fin = NULL;
+	double direct_length = std::numeric_limits<double>::infinity();
+	for (std::vector<TrackPosition>::const_iterator start = starts.begin(); start != starts.end(); ++start) {
+		for (std::vector<TrackPosition>::const_iterator fin = fins.begin(); fin != fins.end(); ++fin) {
+			if (start->edge == fin->edge && fin->offset >= start->offset && fin->offset - start->offset < direct_length) {
+				direct_length = fin->offset - start->offset;
+				direct_start = &*start;
+				direct_fin = &*fin;
+			}
 		}
 	}
 
-	result.route_nodes.swap(temp_nodes);
-	result.sharp_turns.swap(temp_sharp_turns);
+	/* otherwise, it leaves start edge at its target and enters fin
+	 * edge at its source, and these are connected by search */
+	SetTrackNodes(starts, true, context.start_nodes_, context.start_offsets_, context.start_edges_);
+	SetTrackNodes(fins, false, context.fin_nodes_, context.fin_offsets_, context.fin_edges_);
+
+	const bool found = Search(context, mode, queue, result.settled_count);
+	const std::vector<int>& path = context.path_;
+
+	const TrackPosition* route_start = NULL;
+	const TrackPosition* route_fin = NULL;
+	double route_length = std::numeric_limits<double>::infinity();
+	if (found) {
+		const size_t nstart = std::lower_bound(context.start_nodes_.begin(), context.start_nodes_.end(), path.front()) - context.start_nodes_.begin();
+		const size_t nfin = std::lower_bound(context.fin_nodes_.begin(), context.fin_nodes_.end(), path.back()) - context.fin_nodes_.begin();
+
+		for (std::vector<TrackPosition>::const_iterator start = starts.begin(); start != starts.end(); ++start)
+			if (start->edge == context.start_edges_[nstart])
+				route_start = &*start;
+		for (std::vector<TrackPosition>::const_iterator fin = fins.begin(); fin != fins.end(); ++fin)
+			if (fin->edge == context.fin_edges_[nfin])
+				route_fin = &*fin;
+
+		assert(route_start != NULL && route_fin != NULL);
+
+		route_length = context.start_offsets_[nstart] + context.fin_offsets_[nfin];
+		for (size_t i = 1; i < path.size(); ++i)
+			route_length += edge_lengths_[context.path_edges_.empty() ? FindEdge(path[i - 1], path[i]) : context.path_edges_[i - 1]];
+	}
+
+	if (direct_start == NULL && route_start == NULL) {
+		result.status = FindRouteResult::NO_ROUTE_FOUND;
+		return false;
+	}
+
+	/* recover route geometry, from snapped start point through nodes
+	 * of route edges to snapped end point */
+	std::vector<RoutePoint>& nodes = result.route_nodes;
+	nodes.clear();
+	if (direct_start != NULL && direct_length <= route_length) {
+		result.start_node = RoutePoint(0, direct_start->point);
+		result.end_node = RoutePoint(0, direct_fin->point);
+		result.distance = direct_length;
+
+		nodes.push_back(result.start_node);
+		AppendEdgeNodes(direct_start->edge, direct_start->segment + 1, direct_fin->segment, nodes);
+	} else {
+		result.start_node = RoutePoint(0, route_start->point);
+		result.end_node = RoutePoint(0, route_fin->point);
+		result.distance = route_length;
+
+		nodes.push_back(result.start_node);
+		AppendEdgeNodes(route_start->edge, route_start->segment + 1, EdgeSegments(route_start->edge), nodes);
+		AppendPathNodes(context, nodes);
+		AppendEdgeNodes(route_fin->edge, 1, route_fin->segment, nodes);
+	}
+	nodes.push_back(result.end_node);
+
+	/* snapped points may coincide with way nodes */
+	if (nodes[1].GetLonI() == nodes[0].GetLonI() && nodes[1].GetLatI() == nodes[0].GetLatI())
+		nodes.erase(nodes.begin());
+	if (nodes.size() > 1 && nodes[nodes.size() - 2].GetLonI() == nodes.back().GetLonI() && nodes[nodes.size() - 2].GetLatI() == nodes.back().GetLatI())
+		nodes.pop_back();
+
+	result.start_name = "";
+	result.end_name = "";
+	result.status = FindRouteResult::OK;
+
+	FindSharpTurns(nodes, context.bearings_, result.sharp_turns);
 
 	return true;
 }
@@ -22,35 +22,56 @@
 
 #include <map>
 #include <unordered_map>
-#include <set>
+#include <memory>
 
-#include "pool.hh"
+#include "nodestore.hh"
+#include "id_bitmap.hh"
+#include "frozen_array.hh"
+#include "stamped_array.hh"
+#include "snapshot.hh"
+#include "multimap_queue.hh"
+#include "dary_heap.hh"
+#include "radix_heap.hh"
+#include "lru_cache.hh"
+#include "name_index.hh"
+#include "segment_grid.hh"
 
 #include "ParserBase.hh"
 
 class RailRouting : public ParserBase<RailRouting> {
 private:
-	struct RouteNode;
-
-	struct RouteEdge {
-		osmid_t osmid;
-		unsigned short start_pos;
-		unsigned short end_pos;
-		int node;
+	/* data of route edge which is not needed by most searches: way
+	 * and positions of edge ends in it, and bearings in which edge
+	 * leaves its source and enters its target, which are used by
+	 * turn aware search */
+	struct EdgeInfo {
+		osmid_t way;
+		uint16_t start_pos;
+		uint16_t end_pos;
 		float direction;
-		double length;
+		float arrival;
+	};
 
-		RouteEdge() : osmid(0), start_pos(-1), end_pos(-1), node(-1), direction(0), length(0.0) {
-		}
+	/* range of points of route edge geometry, which goes backwards
+	 * if first is greater than last */
+	struct EdgePolyline {
+		uint32_t first;
+		uint32_t last;
 	};
 
-	struct RouteNode {
-		osmid_t osmid;
-		int nedges;
-		RouteEdge* edges;
+	/* contraction hierarchy shortcut, which replaces two arcs */
+	struct ShortcutInfo {
+		uint32_t first;
+		uint32_t second;
+	};
 
-		RouteNode(osmid_t id, int n, RouteEdge* e) : osmid(id), nedges(n), edges(e) {
-		}
+	/* position on route edge: its segment and distance from edge
+	 * start */
+	struct TrackPosition {
+		uint32_t edge;
+		int segment;
+		double offset;
+		LonLat point;
 	};
 
 	struct ConnectivityInfo {
@@ -63,6 +84,20 @@ private:
 	};
 
 public:
+	struct RoutePoint : public LonLat {
+		osmid_t osmid;
+
+		RoutePoint() : LonLat(0, 0), osmid(0) {
+		}
+
+		RoutePoint(osmid_t id, const LonLat& pos) : LonLat(pos), osmid(id) {
+		}
+
+		osmid_t GetId() const {
+			return osmid;
+		}
+	};
+
 	struct FindRouteResult {
 		enum RouteStatus {
 			OK,
@@ -75,13 +110,20 @@ public:
 		int start_count;
 		int end_count;
 
-		const Node* start_node;
-		const Node* end_node;
+		RoutePoint start_node;
+		RoutePoint end_node;
+
+		/* value of name tag of start and end stops */
+		std::string start_name;
+		std::string end_name;
 
 		double distance;
 
-		std::vector<const Node*> route_nodes;
-		std::vector<const Node*> sharp_turns;
+		/* number of route nodes settled by search */
+		int settled_count;
+
+		std::vector<RoutePoint> route_nodes;
+		std::vector<RoutePoint> sharp_turns;
 
 		const char* StatusString() const {
 			switch (status) {
@@ -100,41 +142,519 @@ public:
 		}
 	};
 
-private:
-	/* OSM nodes and ways */
-	typedef std::map<osmid_t, Node> NodeMap;
-	NodeMap nodes_;
+	typedef name_index::Match StationMatch;
+
+	struct RouteCacheStats {
+		size_t hits;
+		size_t misses;
+		size_t size;
+	};
+
+	/* route node reached by bounded search, and distance to it */
+	struct ReachedNode : public RoutePoint {
+		double distance;
+
+		ReachedNode(osmid_t id, const LonLat& pos, double dist) : RoutePoint(id, pos), distance(dist) {
+		}
+	};
+
+	struct ReachedStop : public ReachedNode {
+		/* value of name tag */
+		std::string name;
+
+		ReachedStop(const ReachedNode& node, const std::string& n) : ReachedNode(node), name(n) {
+		}
+	};
+
+	struct FindReachableResult {
+		int start_count;
+
+		/* reached route nodes and stops among them, in order of
+		 * distance */
+		std::vector<ReachedNode> route_nodes;
+		std::vector<ReachedStop> stops;
+	};
+
+	/* dense table of distances between stations: rows are sources,
+	 * columns are targets */
+	struct DistanceTable {
+		size_t nsources;
+		size_t ntargets;
+
+		/* number of stops found for each source and target */
+		std::vector<int> source_counts;
+		std::vector<int> target_counts;
+
+		/* distances by rows, infinity where there's no route */
+		std::vector<double> distances;
+
+		DistanceTable() : nsources(0), ntargets(0) {
+		}
+
+		double Get(size_t source, size_t target) const {
+			return distances[source * ntargets + target];
+		}
+	};
+
+	enum NodeStoreType {
+		/* sorted array of locations, suitable for extracts */
+		SPARSE_NODE_STORE,
+		/* file-backed array indexed by node id, suitable for
+		 * planet-sized inputs */
+		DENSE_NODE_STORE,
+	};
+
+	enum SearchMode {
+		/* plain Dijkstra */
+		DIJKSTRA_SEARCH,
+		/* A* with great circle distance to the closest end stop
+		 * as lower bound of remaining distance */
+		ASTAR_SEARCH,
+		/* Dijkstra from both start and end stops at once, which
+		 * settles about half as much nodes on long routes */
+		BIDIRECTIONAL_SEARCH,
+		/* bidirectional upward search in contraction hierarchy,
+		 * which must be built with BuildHierarchy() */
+		HIERARCHY_SEARCH,
+		/* A* with lower bounds from distances to and from
+		 * landmarks, which must be built with BuildLandmarks() */
+		LANDMARK_SEARCH,
+		/* A* over edges, as in ASTAR_SEARCH, which never turns
+		 * sharper than 90 degrees at route nodes, so found route
+		 * may be longer; settled count is that of edges */
+		TURN_AWARE_SEARCH,
+	};
+
+	enum QueueType {
+		/* std::multimap */
+		MULTIMAP_QUEUE,
+		/* indexed binary heap with decrease-key */
+		BINARY_HEAP_QUEUE,
+		/* indexed 4-ary heap with decrease-key */
+		QUATERNARY_HEAP_QUEUE,
+		/* monotone radix heap over lengths quantized to 1/1024 m */
+		RADIX_HEAP_QUEUE,
+	};
+
+	/**
+	 * Reusable state of route searches
+	 *
+	 * Owns per-node arrays and queues used by FindRoute, which are
+	 * reset between searches with generation stamps in O(1) instead
+	 * of being allocated for each one. A context may only be used
+	 * by one search at a time, so concurrent searches on the same
+	 * router need a context each.
+	 */
+	class QueryContext {
+		friend class RailRouting;
+
+	private:
+		/* state of search in one direction */
+		struct SearchSpace {
+			/* previous node of route for forward search, next one for
+			 * backward search, and index of edge leading to it */
+			stamped_array<int> links;
+			stamped_array<int> link_edges;
+			stamped_array<double> lengths;
+
+			/* lower bounds of remaining distance, computed once per
+			 * reached node by goal directed search */
+			stamped_array<double> bounds;
+
+			/* queues of all types, search uses one of them */
+			multimap_queue<double> multimap;
+			dary_heap<2, double> binary_heap;
+			dary_heap<4, double> quaternary_heap;
+			radix_heap<double> radix;
+
+			SearchSpace();
+
+			void Reset(size_t nnodes);
+
+			template <class Queue>
+			Queue& GetQueue();
+		};
+
+	private:
+		SearchSpace forward_;
+		SearchSpace backward_;
+
+		/* state of turn aware search, which is kept by edge by
+		 * which route enters a node instead of by node */
+		SearchSpace turn_aware_;
 
+		/* start and fin stops, route found and buffers for shortcut
+		 * unpacking */
+		std::vector<int> start_nodes_;
+		std::vector<int> fin_nodes_;
+
+		/* initial distances of start nodes and remaining ones of fin
+		 * nodes, for routes from points on track; empty when all
+		 * are zero */
+		std::vector<double> start_offsets_;
+		std::vector<double> fin_offsets_;
+
+		/* edges by which routes from points on track enter start
+		 * nodes and leave fin nodes, which turn aware search takes
+		 * into account; empty for stations */
+		std::vector<uint32_t> start_edges_;
+		std::vector<uint32_t> fin_edges_;
+
+		std::vector<segment_grid::Hit> snap_hits_;
+		std::vector<int> path_;
+		/* edges of path_, if found by turn aware search, which may
+		 * take other edge than the shortest between two nodes */
+		std::vector<uint32_t> path_edges_;
+		std::vector<uint32_t> arcs_;
+		std::vector<uint32_t> unpack_stack_;
+		std::vector<double> bearings_;
+
+	private:
+		QueryContext(const QueryContext&);
+		QueryContext& operator=(const QueryContext&);
+
+	public:
+		QueryContext() {
+		}
+	};
+
+private:
+	/* OSM data, only used while loading */
 	typedef std::map<osmid_t, Way> WayMap;
 	WayMap ways_;
 
 	/* set of node ids referenced by ways */
-	typedef std::set<osmid_t> IdSet;
-	IdSet needed_nodes_;
+	id_bitmap needed_nodes_;
+
+	/* node locations: all nodes in single pass mode, needed ones
+	 * otherwise; nodes which are not needed are ignored later */
+	std::unique_ptr<NodeStore> node_locations_;
+
+	/* stop nodes with their tags */
+	typedef std::map<osmid_t, Node> NodeMap;
+	NodeMap stop_nodes_;
 
 	/* map of node ids for stops by name */
 	typedef std::multimap<std::string, int> StopMap;
 	StopMap stops_;
 
-	/* route nodes */
-	typedef std::vector<RouteNode> RouteNodeVector;
-	RouteNodeVector route_nodes_;
+	/* index of station names (keys of stops_) for lookups tolerant
+	 * to case and spelling variations */
+	name_index station_index_;
+
+	/* sets of route nodes are sorted vectors */
+	typedef std::vector<int> NodeSet;
+
+	/* routing graph in compressed sparse row form: edges of route
+	 * node n occupy [edge_offsets_[n], edge_offsets_[n+1]) in edge
+	 * arrays, which are split into hot data used by search (targets
+	 * and lengths) and cold data used to reconstruct routes; route
+	 * node locations are used by goal directed search */
+	frozen_array<osmid_t> route_node_ids_;
+	frozen_array<LonLat> route_node_pos_;
+	frozen_array<uint32_t> edge_offsets_;
+	frozen_array<uint32_t> edge_targets_;
+	frozen_array<double> edge_lengths_;
+	frozen_array<EdgeInfo> edge_info_;
+
+	/* reverse graph for backward search: incoming edges of route
+	 * node n occupy [rev_edge_offsets_[n], rev_edge_offsets_[n+1]) */
+	frozen_array<uint32_t> rev_edge_offsets_;
+	frozen_array<uint32_t> rev_edge_sources_;
+	frozen_array<double> rev_edge_lengths_;
 
-	/* mapping of ism node ids to routing node indexes */
+	/* contraction hierarchy, if built: upward graph used by forward
+	 * search, and downward graph stored by lower node and used by
+	 * backward search. Arcs are identified by ids, ones below the
+	 * number of edges are graph edges, others are shortcuts */
+	frozen_array<uint32_t> ch_up_offsets_;
+	frozen_array<uint32_t> ch_up_targets_;
+	frozen_array<double> ch_up_lengths_;
+	frozen_array<uint32_t> ch_up_arcs_;
+	frozen_array<uint32_t> ch_down_offsets_;
+	frozen_array<uint32_t> ch_down_sources_;
+	frozen_array<double> ch_down_lengths_;
+	frozen_array<uint32_t> ch_down_arcs_;
+	frozen_array<ShortcutInfo> ch_shortcuts_;
 
-	/* pool for route edges */
-	typedef pool<RouteEdge> RouteEdgePool;
-	RouteEdgePool route_edge_pool_;
+	/* landmarks, if built, and distances from and to each of them
+	 * for every route node, stored by node */
+	frozen_array<uint32_t> landmarks_;
+	frozen_array<float> landmark_from_;
+	frozen_array<float> landmark_to_;
+
+	/* name tags of stop route nodes */
+	typedef std::unordered_map<int, std::string> StopNameMap;
+	StopNameMap stop_names_;
+
+	/* geometry of route edges: points of edge n, including its ends,
+	 * are a slice of edge_points_ given by edge_polylines_[n]. Edges
+	 * in opposite directions along the same track share the slice */
+	frozen_array<EdgePolyline> edge_polylines_;
+	frozen_array<RoutePoint> edge_points_;
+
+	/* spatial index of edge geometry segments, for snapping points
+	 * to track: segment n is track_segment_positions_[n]-th one of
+	 * edge track_segment_edges_[n], and starts track_segment_offsets_
+	 * [n] meters from its start; reverse edges are not indexed */
+	segment_grid track_grid_;
+	frozen_array<uint32_t> track_segment_edges_;
+	frozen_array<uint16_t> track_segment_positions_;
+	frozen_array<double> track_segment_offsets_;
+
+	/* mapped snapshot, if the graph was loaded from one */
+	SnapshotReader snapshot_;
+
+	/* cache of FindRoute results by names of start and end
+	 * stations and whether route is turn aware, if enabled */
+	struct RouteKey {
+		std::string from;
+		std::string to;
+		bool turn_aware;
+
+		RouteKey(const std::string& f, const std::string& t, bool ta) : from(f), to(t), turn_aware(ta) {
+		}
+
+		bool operator==(const RouteKey& other) const {
+			return from == other.from && to == other.to && turn_aware == other.turn_aware;
+		}
+	};
+
+	struct RouteKeyHash {
+		size_t operator()(const RouteKey& key) const {
+			return (std::hash<std::string>()(key.from) * 31 + std::hash<std::string>()(key.to)) * 2 + key.turn_aware;
+		}
+	};
+
+	typedef lru_cache<RouteKey, FindRouteResult, RouteKeyHash> RouteCache;
+	std::unique_ptr<RouteCache> route_cache_;
 
 private:
-	void ProcessNode(Node& node);
-	void ProcessWay(Way& way);
+	static bool IsStop(const Node& node);
+	static bool IsStop(const NodeView& node);
+
+	bool IsNeededNode(TagType type, osmid_t id) const;
+
+	void ProcessNode(const NodeView& node);
+	void ProcessWay(const WayView& way);
+	void StoreNode(const NodeView& node);
+	void FinalizeNodes();
+	bool LocateNode(osmid_t id, RoutePoint& point) const;
 	void Prepare();
+	void CompileGeometry();
+
+	void Clear();
+	void InvalidateRouteCache();
+	void BuildStationIndex();
+	void BuildTrackIndex();
+
+	double LandmarkBound(int node, int fin) const;
+	double LowerBound(int node, SearchMode mode, const NodeSet& fins, const std::vector<double>& fin_offsets, stamped_array<double>& bounds) const;
+
+	/* searches are parametrized by priority queue type, which is
+	 * one of multimap_queue, dary_heap or radix_heap; they take
+	 * start and fin nodes from context and store route into its
+	 * path */
+	template <class Queue>
+	bool SearchForward(QueryContext& context, SearchMode mode, int& settled) const;
+	template <class Queue>
+	bool SearchBidirectional(QueryContext& context, int& settled) const;
+	template <class Queue>
+	bool SearchHierarchy(QueryContext& context, int& settled) const;
+	template <class Queue>
+	bool SearchTurnAware(QueryContext& context, int& settled) const;
+	template <class Queue>
+	bool Search(QueryContext& context, SearchMode mode, int& settled) const;
+	bool Search(QueryContext& context, SearchMode mode, QueueType queue, int& settled) const;
+
+	/* throws if data needed by search mode is not built */
+	void CheckSearchMode(SearchMode mode) const;
+
+	void FindDistancesForward(const std::vector<NodeSet>& sources, const std::vector<NodeSet>& targets, DistanceTable& table) const;
+	void FindDistancesHierarchy(const std::vector<NodeSet>& sources, const std::vector<NodeSet>& targets, DistanceTable& table) const;
+
+	bool FindRouteUncached(QueryContext& context, const std::string& name_a, const std::string& name_b, FindRouteResult& result, SearchMode mode, QueueType queue) const;
+
+	int FindStops(const std::string& name, NodeSet& nodes) const;
+	static QueryContext& ThreadContext();
+
+	bool SnapToEdges(const LonLat& pos, std::vector<segment_grid::Hit>& hits, std::vector<TrackPosition>& positions) const;
+	void SetTrackNodes(const std::vector<TrackPosition>& positions, bool at_end, NodeSet& nodes, std::vector<double>& offsets, std::vector<uint32_t>& edges) const;
+
+	uint32_t FindEdge(int from, int to) const;
+	int EdgeSource(uint32_t nedge) const;
+	uint32_t ReverseEdge(uint32_t nedge) const;
+	int EdgeSegments(uint32_t nedge) const;
+	void AppendEdgeNodes(uint32_t nedge, int first, int last, std::vector<RoutePoint>& nodes) const;
+	double AppendPathNodes(const QueryContext& context, std::vector<RoutePoint>& nodes) const;
+	static void FindSharpTurns(const std::vector<RoutePoint>& nodes, std::vector<double>& bearings, std::vector<RoutePoint>& turns);
+	void UnpackArc(uint32_t arc, std::vector<uint32_t>& stack, std::vector<int>& path) const;
 
 public:
-	RailRouting();
+	/**
+	 * Constructs router
+	 *
+	 * By default, input is read in two passes: ways first, then
+	 * only the nodes they reference. In single pass mode, input is
+	 * scanned once while all node locations are kept in compact
+	 * (and spillable to disk) store, which allows reading from
+	 * non-seekable input such as stdin.
+	 */
+	RailRouting(bool single_pass = false);
+
+	/**
+	 * Selects store for node locations, must be called before Parse()
+	 *
+	 * Dense store rejects node ids above max_dense_id, which bounds
+	 * size of its file.
+	 */
+	void SetNodeStore(NodeStoreType type, osmid_t max_dense_id = DenseNodeStore::default_max_id);
+
+	/**
+	 * Builds contraction hierarchy for HIERARCHY_SEARCH
+	 *
+	 * Nodes are contracted in order of edge difference, adding
+	 * shortcuts where no witness path exists. This takes a while,
+	 * but the hierarchy is saved into snapshots.
+	 */
+	void BuildHierarchy();
+
+	/**
+	 * Selects landmarks and computes distances for LANDMARK_SEARCH
+	 *
+	 * Landmarks are selected with farthest heuristic: each next
+	 * one is the node farthest from already selected ones. The
+	 * distance tables are saved into snapshots.
+	 */
+	void BuildLandmarks(int count = 16);
+
+	/**
+	 * Finds station names equal to query regardless of case, ё/е
+	 * and spacing
+	 */
+	void FindStations(const std::string& query, std::vector<std::string>& names) const;
+
+	/**
+	 * Finds up to limit station names starting with prefix,
+	 * regardless of case, ё/е and spacing
+	 */
+	void CompleteStations(const std::string& prefix, size_t limit, std::vector<std::string>& names) const;
+
+	/**
+	 * Finds up to limit station names within given edit distance
+	 * from query, closest first
+	 */
+	void FindSimilarStations(const std::string& query, int max_distance, size_t limit, std::vector<StationMatch>& matches) const;
+
+	/**
+	 * Finds route between stations using given search context
+	 *
+	 * Stations are looked up by name, alt_name or official_name
+	 * of their stops, exactly or, if there are no such stations,
+	 * regardless of case, ё/е and spacing.
+	 *
+	 * The context should be reused for subsequent searches, which
+	 * makes them cheaper. Searches with different contexts may run
+	 * concurrently.
+	 *
+	 * Throws std::logic_error if mode needs contraction hierarchy
+	 * or landmarks which are not built, before stations are looked
+	 * up or cache is consulted.
+	 */
+	bool FindRoute(QueryContext& context, const std::string& name_a, const std::string& name_b, FindRouteResult& result, SearchMode mode = DIJKSTRA_SEARCH, QueueType queue = QUATERNARY_HEAP_QUEUE) const;
+
+	/**
+	 * Finds route between stations using context of calling thread
+	 */
+	bool FindRoute(const std::string& name_a, const std::string& name_b, FindRouteResult& result, SearchMode mode = DIJKSTRA_SEARCH, QueueType queue = QUATERNARY_HEAP_QUEUE) const;
+
+	/**
+	 * Finds point on track closest to given location, within
+	 * max_distance meters from it
+	 */
+	bool SnapToTrack(const LonLat& pos, double max_distance, RoutePoint& point, double& distance) const;
+
+	/**
+	 * Finds route between locations using given search context
+	 *
+	 * Locations are snapped to the closest track within 1 km, and
+	 * the route starts and ends at snapped points, which have zero
+	 * ids, in the middle of route edges. Such routes are not cached.
+	 */
+	bool FindRoute(QueryContext& context, const LonLat& from, const LonLat& to, FindRouteResult& result, SearchMode mode = DIJKSTRA_SEARCH, QueueType queue = QUATERNARY_HEAP_QUEUE) const;
+
+	/**
+	 * Finds route between locations using context of calling thread
+	 */
+	bool FindRoute(const LonLat& from, const LonLat& to, FindRouteResult& result, SearchMode mode = DIJKSTRA_SEARCH, QueueType queue = QUATERNARY_HEAP_QUEUE) const;
+
+	/**
+	 * Enables cache of FindRoute results for given number of
+	 * station pairs, or disables it if zero
+	 *
+	 * Results are cached by station names and by whether the
+	 * search was turn-aware; other search modes share entries.
+	 * The cache is cleared whenever the graph changes.
+	 * Cached results have zero settled_count. The cache is shared
+	 * by all threads, but must not be set up concurrently with
+	 * searches.
+	 */
+	void SetRouteCache(size_t capacity);
+
+	RouteCacheStats GetRouteCacheStats() const;
+
+	/**
+	 * Copies routing graph in compressed sparse row form: edges
+	 * of route node n are [offsets[n], offsets[n+1]) in targets
+	 * and lengths; used by benchmarks
+	 */
+	void ExportGraph(std::vector<uint32_t>& offsets, std::vector<uint32_t>& targets, std::vector<double>& lengths) const;
+
+	/**
+	 * Computes distances between all pairs of source and target
+	 * stations
+	 *
+	 * With contraction hierarchy, upward searches from targets
+	 * leave distances in buckets at nodes they reach, which are
+	 * then scanned by upward searches from sources, so the whole
+	 * table takes one search per station. Otherwise, Dijkstra is
+	 * run from each source until all targets are reached. Searches
+	 * run in parallel, in number of threads set by SetThreads().
+	 */
+	void FindDistances(const std::vector<std::string>& sources, const std::vector<std::string>& targets, DistanceTable& table) const;
+
+	/**
+	 * Finds route nodes and stops reachable from station within
+	 * given distance along track
+	 *
+	 * Search starts from all stops of the station at once, as in
+	 * FindRoute, and ends when the distance is exceeded. Stops are
+	 * ones with name tag.
+	 */
+	bool FindReachable(QueryContext& context, const std::string& name, double max_distance, FindReachableResult& result) const;
+
+	/**
+	 * Finds reachable route nodes using context of calling thread
+	 */
+	bool FindReachable(const std::string& name, double max_distance, FindReachableResult& result) const;
+
+	/**
+	 * Finds reachable route nodes for each of stations, in parallel
+	 */
+	void FindReachable(const std::vector<std::string>& names, double max_distance, std::vector<FindReachableResult>& results) const;
+
+	/**
+	 * Saves prepared graph into snapshot file
+	 */
+	void SaveSnapshot(const std::string& filename) const;
 
-	bool FindRoute(const std::string& name_a, const std::string& name_b, FindRouteResult& result) const;
+	/**
+	 * Replaces graph with one from snapshot file
+	 *
+	 * The file is mapped read-only and used in place, so loading
+	 * is fast and processes using the same snapshot share memory.
+	 */
+	void LoadSnapshot(const std::string& filename);
 };
 
 #endif
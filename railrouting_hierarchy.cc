@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <limits>
+#include <iostream>
+#include <functional>
+
+#include "railrouting.hh"
+
+namespace {
+
+/* witness searches are limited to this number of settled nodes;
+ * when limit is reached, shortcut is added, which is always safe.
+ * Lower limit is used when only estimating node priority */
+const int witness_settle_limit = 500;
+const int simulation_settle_limit = 50;
+
+/* arc of the graph being contracted */
+struct DynArc {
+	uint32_t node;
+	double length;
+	uint32_t arc;
+};
+
+typedef std::vector<DynArc> DynArcVector;
+
+/* arc of the resulting hierarchy, stored by its lower node */
+struct HierarchyArc {
+	uint32_t node;
+	double length;
+	uint32_t arc;
+};
+
+typedef std::vector<HierarchyArc> HierarchyArcVector;
+
+/* arcs replaced by shortcut */
+typedef std::pair<uint32_t, uint32_t> Shortcut;
+
+/* local Dijkstra search for witness paths, which make shortcuts
+ * unnecessary; state is reset in O(touched nodes) */
+class WitnessSearch {
+private:
+	typedef std::pair<double, uint32_t> QueueEntry;
+
+private:
+	std::vector<double> lengths_;
+	std::vector<uint32_t> touched_;
+
+	/* binary heap, kept in vector to reuse its memory */
+	std::vector<QueueEntry> queue_;
+
+private:
+	void Reset() {
+		for (std::vector<uint32_t>::const_iterator node = touched_.begin(); node != touched_.end(); ++node)
+			lengths_[*node] = std::numeric_limits<double>::infinity();
+		touched_.clear();
+		queue_.clear();
+	}
+
+	void Reach(uint32_t node, double length) {
+		if (lengths_[node] == std::numeric_limits<double>::infinity())
+			touched_.push_back(node);
+		lengths_[node] = length;
+		queue_.push_back(std::make_pair(length, node));
+		std::push_heap(queue_.begin(), queue_.end(), std::greater<QueueEntry>());
+	}
+
+public:
+	WitnessSearch(size_t nnodes) : lengths_(nnodes, std::numeric_limits<double>::infinity()) {
+	}
+
+	/* searches from source, avoiding ignored node, until nodes
+	 * closer than max_length are reached; lengths of nodes which
+	 * are not settled are upper bounds */
+	void Run(const std::vector<DynArcVector>& out, uint32_t source, uint32_t ignored, double max_length, int settle_limit) {
+		Reset();
+		Reach(source, 0.0);
+
+		int settled = 0;
+		while (!queue_.empty()) {
+			std::pop_heap(queue_.begin(), queue_.end(), std::greater<QueueEntry>());
+			const QueueEntry top = queue_.back();
+			queue_.pop_back();
+
+			if (top.first > lengths_[top.second])
+				continue;
+			if (top.first > max_length || ++settled > settle_limit)
+				break;
+
+			for (DynArcVector::const_iterator arc = out[top.second].begin(); arc != out[top.second].end(); ++arc) {
+				const double new_length = top.first + arc->length;
+				if (arc->node != ignored && new_length < lengths_[arc->node])
+					Reach(arc->node, new_length);
+			}
+		}
+	}
+
+	double Length(uint32_t node) const {
+		return lengths_[node];
+	}
+};
+
+/* state of hierarchy construction */
+class Contractor {
+private:
+	/* arcs between nodes not contracted yet */
+	std::vector<DynArcVector> out_;
+	std::vector<DynArcVector> in_;
+
+	/* number of contracted neighbours of each node */
+	std::vector<int> deleted_neighbours_;
+
+	/* arcs below this id are graph edges */
+	uint32_t nedges_;
+
+	WitnessSearch witness_;
+
+public:
+	std::vector<Shortcut> shortcuts;
+	std::vector<HierarchyArcVector> up;
+	std::vector<HierarchyArcVector> down;
+
+private:
+	static DynArcVector::iterator FindArc(DynArcVector& arcs, uint32_t node) {
+		DynArcVector::iterator arc = arcs.begin();
+		while (arc != arcs.end() && arc->node != node)
+			++arc;
+		return arc;
+	}
+
+	void AddArc(uint32_t from, uint32_t to, double length, uint32_t arc) {
+		DynArcVector::iterator existing = FindArc(out_[from], to);
+		if (existing == out_[from].end()) {
+			DynArc out = { to, length, arc };
+			DynArc in = { from, length, arc };
+			out_[from].push_back(out);
+			in_[to].push_back(in);
+		} else if (length < existing->length) {
+			/* replaced arc was never used, as neither of its ends
+			 * is contracted yet */
+			existing->length = length;
+			existing->arc = arc;
+
+			DynArcVector::iterator in = FindArc(in_[to], from);
+			in->length = length;
+			in->arc = arc;
+		}
+	}
+
+	void RemoveArc(DynArcVector& arcs, uint32_t node) {
+		DynArcVector::iterator arc = FindArc(arcs, node);
+		*arc = arcs.back();
+		arcs.pop_back();
+	}
+
+	/* finds shortcuts needed to contract node, and adds them unless
+	 * simulating; returns their number */
+	int AddShortcuts(uint32_t node, bool simulate) {
+		double max_out = 0.0;
+		for (DynArcVector::const_iterator out = out_[node].begin(); out != out_[node].end(); ++out)
+			max_out = std::max(max_out, out->length);
+
+		int nshortcuts = 0;
+		for (DynArcVector::const_iterator in = in_[node].begin(); in != in_[node].end(); ++in) {
+			witness_.Run(out_, in->node, node, in->length + max_out, simulate ? simulation_settle_limit : witness_settle_limit);
+
+			for (DynArcVector::const_iterator out = out_[node].begin(); out != out_[node].end(); ++out) {
+				if (out->node == in->node)
+					continue;
+
+				const double length = in->length + out->length;
+				if (witness_.Length(out->node) <= length)
+					continue;
+
+				nshortcuts++;
+				if (!simulate) {
+					shortcuts.push_back(std::make_pair(in->arc, out->arc));
+					AddArc(in->node, out->node, length, nedges_ + shortcuts.size() - 1);
+				}
+			}
+		}
+
+		return nshortcuts;
+	}
+
+public:
+	Contractor(size_t nnodes, uint32_t nedges)
+		: out_(nnodes),
+		  in_(nnodes),
+		  deleted_neighbours_(nnodes, 0),
+		  nedges_(nedges),
+		  witness_(nnodes),
+		  up(nnodes),
+		  down(nnodes) {
+	}
+
+	void AddEdge(uint32_t from, uint32_t to, double length, uint32_t edge) {
+		/* loops are never part of shortest routes */
+		if (from != to)
+			AddArc(from, to, length, edge);
+	}
+
+	/* doubled edge difference plus number of contracted neighbours,
+	 * which spreads contraction evenly over the graph */
+	int Priority(uint32_t node) {
+		return 2 * (AddShortcuts(node, true) - (int)(in_[node].size() + out_[node].size())) + deleted_neighbours_[node];
+	}
+
+	void Contract(uint32_t node) {
+		AddShortcuts(node, false);
+
+		for (DynArcVector::const_iterator out = out_[node].begin(); out != out_[node].end(); ++out) {
+			HierarchyArc arc = { out->node, out->length, out->arc };
+			up[node].push_back(arc);
+
+			RemoveArc(in_[out->node], node);
+			deleted_neighbours_[out->node]++;
+		}
+		for (DynArcVector::const_iterator in = in_[node].begin(); in != in_[node].end(); ++in) {
+			HierarchyArc arc = { in->node, in->length, in->arc };
+			down[node].push_back(arc);
+
+			RemoveArc(out_[in->node], node);
+			deleted_neighbours_[in->node]++;
+		}
+
+		DynArcVector().swap(out_[node]);
+		DynArcVector().swap(in_[node]);
+	}
+};
+
+void PackArcs(const std::vector<HierarchyArcVector>& arcs, std::vector<uint32_t>& offsets, std::vector<uint32_t>& nodes, std::vector<double>& lengths, std::vector<uint32_t>& ids) {
+	offsets.push_back(0);
+	for (std::vector<HierarchyArcVector>::const_iterator node = arcs.begin(); node != arcs.end(); ++node) {
+		for (HierarchyArcVector::const_iterator arc = node->begin(); arc != node->end(); ++arc) {
+			nodes.push_back(arc->node);
+			lengths.push_back(arc->length);
+			ids.push_back(arc->arc);
+		}
+		offsets.push_back(nodes.size());
+	}
+}
+
+}
+
+void RailRouting::BuildHierarchy() {
+	const size_t nnodes = route_node_ids_.size();
+
+	Contractor contractor(nnodes, edge_targets_.size());
+	for (size_t node = 0; node < nnodes; ++node)
+		for (uint32_t nedge = edge_offsets_[node]; nedge < edge_offsets_[node + 1]; ++nedge)
+			contractor.AddEdge(node, edge_targets_[nedge], edge_lengths_[nedge], nedge);
+
+	/* queue of nodes by priority, which is updated lazily: priority
+	 * of popped node is recomputed, and it's requeued if it's no
+	 * longer the least one */
+	typedef std::pair<int, uint32_t> QueueEntry;
+	std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > queue;
+
+	std::vector<int> priorities(nnodes);
+	for (size_t node = 0; node < nnodes; ++node) {
+		priorities[node] = contractor.Priority(node);
+		queue.push(std::make_pair(priorities[node], node));
+	}
+
+	std::vector<bool> contracted(nnodes, false);
+	while (!queue.empty()) {
+		const QueueEntry top = queue.top();
+		queue.pop();
+
+		if (contracted[top.second] || top.first != priorities[top.second])
+			continue;
+
+		priorities[top.second] = contractor.Priority(top.second);
+		if (!queue.empty() && priorities[top.second] > queue.top().first) {
+			queue.push(std::make_pair(priorities[top.second], top.second));
+			continue;
+		}
+
+		contractor.Contract(top.second);
+		contracted[top.second] = true;
+	}
+
+	std::cerr << contractor.shortcuts.size() << " shortcuts" << std::endl;
+
+	std::vector<uint32_t> up_offsets, up_targets, up_arcs, down_offsets, down_sources, down_arcs;
+	std::vector<double> up_lengths, down_lengths;
+	std::vector<ShortcutInfo> shortcuts;
+
+	shortcuts.reserve(contractor.shortcuts.size());
+	for (std::vector<Shortcut>::const_iterator arcs = contractor.shortcuts.begin(); arcs != contractor.shortcuts.end(); ++arcs) {
+		ShortcutInfo shortcut = { arcs->first, arcs->second };
+		shortcuts.push_back(shortcut);
+	}
+
+	PackArcs(contractor.up, up_offsets, up_targets, up_lengths, up_arcs);
+	PackArcs(contractor.down, down_offsets, down_sources, down_lengths, down_arcs);
+
+	ch_up_offsets_.assign(up_offsets);
+	ch_up_targets_.assign(up_targets);
+	ch_up_lengths_.assign(up_lengths);
+	ch_up_arcs_.assign(up_arcs);
+	ch_down_offsets_.assign(down_offsets);
+	ch_down_sources_.assign(down_sources);
+	ch_down_lengths_.assign(down_lengths);
+	ch_down_arcs_.assign(down_arcs);
+	ch_shortcuts_.assign(shortcuts);
+
+	InvalidateRouteCache();
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <iostream>
+
+#include "railrouting.hh"
+#include "dary_heap.hh"
+
+namespace {
+
+/* computes distances from source to all nodes over given graph */
+void ComputeDistances(const frozen_array<uint32_t>& offsets, const frozen_array<uint32_t>& neighbours, const frozen_array<double>& lengths, uint32_t source, std::vector<double>& distances) {
+	const size_t nnodes = offsets.size() - 1;
+
+	distances.assign(nnodes, std::numeric_limits<double>::infinity());
+
+	dary_heap<4, double> queue(nnodes);
+	distances[source] = 0.0;
+	queue.push(source, 0.0);
+
+	while (!queue.empty()) {
+		const uint32_t node = queue.top();
+		const double length = queue.top_priority();
+		queue.pop();
+
+		for (uint32_t nedge = offsets[node]; nedge < offsets[node + 1]; ++nedge) {
+			const double new_length = length + lengths[nedge];
+			if (new_length < distances[neighbours[nedge]]) {
+				distances[neighbours[nedge]] = new_length;
+				queue.push(neighbours[nedge], new_length);
+			}
+		}
+	}
+}
+
+}
+
+void RailRouting::BuildLandmarks(int count) {
+	const size_t nnodes = route_node_ids_.size();
+
+	std::vector<uint32_t> landmarks;
+	std::vector<std::vector<float> > from_tables;
+	std::vector<std::vector<float> > to_tables;
+
+	/* distance from each node to the closest selected landmark,
+	 * initially to arbitrary node, so the first landmark is on the
+	 * periphery; nodes not reached from any landmark are the
+	 * farthest, so each connected part of the graph gets one */
+	std::vector<double> min_distances;
+	if (nnodes > 0)
+		ComputeDistances(edge_offsets_, edge_targets_, edge_lengths_, 0, min_distances);
+
+	std::vector<double> distances;
+	while ((int)landmarks.size() < count && nnodes > 0) {
+		uint32_t landmark = 0;
+		for (uint32_t node = 1; node < nnodes; ++node)
+			if (min_distances[node] > min_distances[landmark])
+				landmark = node;
+
+		/* all nodes are landmarks already */
+		if (min_distances[landmark] == 0.0 && !landmarks.empty())
+			break;
+
+		landmarks.push_back(landmark);
+
+		ComputeDistances(edge_offsets_, edge_targets_, edge_lengths_, landmark, distances);
+		from_tables.push_back(std::vector<float>(distances.begin(), distances.end()));
+		if (landmarks.size() == 1)
+			min_distances = distances;
+		else
+			for (size_t node = 0; node < nnodes; ++node)
+				min_distances[node] = std::min(min_distances[node], distances[node]);
+
+		ComputeDistances(rev_edge_offsets_, rev_edge_sources_, rev_edge_lengths_, landmark, distances);
+		to_tables.push_back(std::vector<float>(distances.begin(), distances.end()));
+	}
+
+	/* interleave tables, so all distances for a node are together */
+	std::vector<float> landmark_from(nnodes * landmarks.size());
+	std::vector<float> landmark_to(nnodes * landmarks.size());
+	for (size_t node = 0; node < nnodes; ++node) {
+		for (size_t landmark = 0; landmark < landmarks.size(); ++landmark) {
+			landmark_from[node * landmarks.size() + landmark] = from_tables[landmark][node];
+			landmark_to[node * landmarks.size() + landmark] = to_tables[landmark][node];
+		}
+	}
+
+	std::cerr << landmarks.size() << " landmarks" << std::endl;
+
+	landmarks_.assign(landmarks);
+	landmark_from_.assign(landmark_from);
+	landmark_to_.assign(landmark_to);
+
+	InvalidateRouteCache();
+}
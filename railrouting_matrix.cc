@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include "railrouting.hh"
+#include "parallel.hh"
+
+namespace {
+
+/* distance to target station stored at a node reached by its
+ * upward search */
+struct BucketEntry {
+	uint32_t target;
+	double length;
+};
+
+/* runs Dijkstra from given nodes over given graph, calling
+ * visit(node, length) for each settled node until it returns false
+ * or all reachable nodes are settled */
+template <class Visitor>
+void Explore(dary_heap<4, double>& queue, stamped_array<double>& lengths, const std::vector<int>& sources, const frozen_array<uint32_t>& offsets, const frozen_array<uint32_t>& neighbours, const frozen_array<double>& edge_lengths, Visitor visit) {
+	for (std::vector<int>::const_iterator source = sources.begin(); source != sources.end(); ++source) {
+		lengths[*source] = 0.0;
+		queue.push(*source, 0.0);
+	}
+
+	while (!queue.empty()) {
+		const int node = queue.top();
+		const double length = queue.top_priority();
+		queue.pop();
+
+		if (!visit(node, length))
+			return;
+
+		const uint32_t edges_end = offsets[node + 1];
+		for (uint32_t nedge = offsets[node]; nedge < edges_end; nedge++) {
+			const double new_length = length + edge_lengths[nedge];
+			const int other_node = neighbours[nedge];
+
+			if (new_length < lengths[other_node]) {
+				lengths[other_node] = new_length;
+				queue.push(other_node, new_length);
+			}
+		}
+	}
+}
+
+}
+
+void RailRouting::FindDistancesForward(const std::vector<NodeSet>& sources, const std::vector<NodeSet>& targets, DistanceTable& table) const {
+	/* stops of all targets */
+	NodeSet target_stops;
+	for (std::vector<NodeSet>::const_iterator target = targets.begin(); target != targets.end(); ++target)
+		target_stops.insert(target_stops.end(), target->begin(), target->end());
+	std::sort(target_stops.begin(), target_stops.end());
+	target_stops.erase(std::unique(target_stops.begin(), target_stops.end()), target_stops.end());
+
+	ParallelFor(sources.size(), GetThreads(), [&](size_t nsource) {
+		if (sources[nsource].empty() || target_stops.empty())
+			return;
+
+		QueryContext::SearchSpace& space = ThreadContext().forward_;
+		space.Reset(route_node_ids_.size());
+
+		/* search stops when all target stops are settled; lengths of
+		 * ones which are not are infinite, as they are unreachable */
+		size_t unsettled = target_stops.size();
+		Explore(space.quaternary_heap, space.lengths, sources[nsource], edge_offsets_, edge_targets_, edge_lengths_, [&](int node, double) {
+			if (std::binary_search(target_stops.begin(), target_stops.end(), node))
+				unsettled--;
+			return unsettled > 0;
+		});
+
+		double* row = &table.distances[nsource * table.ntargets];
+		for (size_t ntarget = 0; ntarget < targets.size(); ++ntarget)
+			for (NodeSet::const_iterator stop = targets[ntarget].begin(); stop != targets[ntarget].end(); ++stop)
+				row[ntarget] = std::min(row[ntarget], space.lengths[*stop]);
+	});
+}
+
+void RailRouting::FindDistancesHierarchy(const std::vector<NodeSet>& sources, const std::vector<NodeSet>& targets, DistanceTable& table) const {
+	const size_t nnodes = route_node_ids_.size();
+
+	/* backward upward search from each target; any route meets
+	 * them at its highest node, which is settled by both upward
+	 * searches */
+	std::vector<std::vector<std::pair<int, double> > > reached(targets.size());
+	ParallelFor(targets.size(), GetThreads(), [&](size_t ntarget) {
+		QueryContext::SearchSpace& space = ThreadContext().backward_;
+		space.Reset(nnodes);
+
+		Explore(space.quaternary_heap, space.lengths, targets[ntarget], ch_down_offsets_, ch_down_sources_, ch_down_lengths_, [&](int node, double length) {
+			reached[ntarget].push_back(std::make_pair(node, length));
+			return true;
+		});
+	});
+
+	/* gather distances into buckets by node */
+	std::vector<uint32_t> bucket_offsets(nnodes + 1, 0);
+	for (size_t ntarget = 0; ntarget < targets.size(); ++ntarget)
+		for (std::vector<std::pair<int, double> >::const_iterator node = reached[ntarget].begin(); node != reached[ntarget].end(); ++node)
+			bucket_offsets[node->first + 1]++;
+	for (size_t node = 0; node < nnodes; ++node)
+		bucket_offsets[node + 1] += bucket_offsets[node];
+
+	std::vector<BucketEntry> buckets(bucket_offsets[nnodes]);
+	std::vector<uint32_t> bucket_ends(bucket_offsets.begin(), bucket_offsets.end() - 1);
+	for (size_t ntarget = 0; ntarget < targets.size(); ++ntarget) {
+		for (std::vector<std::pair<int, double> >::const_iterator node = reached[ntarget].begin(); node != reached[ntarget].end(); ++node) {
+			BucketEntry entry = { (uint32_t)ntarget, node->second };
+			buckets[bucket_ends[node->first]++] = entry;
+		}
+		std::vector<std::pair<int, double> >().swap(reached[ntarget]);
+	}
+
+	/* forward upward search from each source, combined with
+	 * distances to targets in buckets of nodes it settles */
+	ParallelFor(sources.size(), GetThreads(), [&](size_t nsource) {
+		QueryContext::SearchSpace& space = ThreadContext().forward_;
+		space.Reset(nnodes);
+
+		double* row = &table.distances[nsource * table.ntargets];
+		Explore(space.quaternary_heap, space.lengths, sources[nsource], ch_up_offsets_, ch_up_targets_, ch_up_lengths_, [&](int node, double length) {
+			for (uint32_t nentry = bucket_offsets[node]; nentry < bucket_offsets[node + 1]; ++nentry)
+				row[buckets[nentry].target] = std::min(row[buckets[nentry].target], length + buckets[nentry].length);
+			return true;
+		});
+	});
+}
+
+void RailRouting::FindDistances(const std::vector<std::string>& sources, const std::vector<std::string>& targets, DistanceTable& table) const {
+	table.nsources = sources.size();
+	table.ntargets = targets.size();
+	table.source_counts.resize(sources.size());
+	table.target_counts.resize(targets.size());
+	table.distances.assign(sources.size() * targets.size(), std::numeric_limits<double>::infinity());
+
+	std::vector<NodeSet> source_nodes(sources.size());
+	std::vector<NodeSet> target_nodes(targets.size());
+	for (size_t nsource = 0; nsource < sources.size(); ++nsource)
+		table.source_counts[nsource] = FindStops(sources[nsource], source_nodes[nsource]);
+	for (size_t ntarget = 0; ntarget < targets.size(); ++ntarget)
+		table.target_counts[ntarget] = FindStops(targets[ntarget], target_nodes[ntarget]);
+
+	if (ch_up_offsets_.empty())
+		FindDistancesForward(source_nodes, target_nodes, table);
+	else
+		FindDistancesHierarchy(source_nodes, target_nodes, table);
+}
+
+bool RailRouting::FindReachable(QueryContext& context, const std::string& name, double max_distance, FindReachableResult& result) const {
+	result.route_nodes.clear();
+	result.stops.clear();
+
+	result.start_count = FindStops(name, context.start_nodes_);
+	if (result.start_count == 0)
+		return false;
+
+	QueryContext::SearchSpace& space = context.forward_;
+	space.Reset(route_node_ids_.size());
+
+	/* nodes are settled in order of distance, so the first one
+	 * which is too far ends the search */
+	Explore(space.quaternary_heap, space.lengths, context.start_nodes_, edge_offsets_, edge_targets_, edge_lengths_, [&](int node, double length) {
+		if (length > max_distance)
+			return false;
+
+		result.route_nodes.push_back(ReachedNode(route_node_ids_[node], route_node_pos_[node], length));
+
+		StopNameMap::const_iterator stop_name = stop_names_.find(node);
+		if (stop_name != stop_names_.end())
+			result.stops.push_back(ReachedStop(result.route_nodes.back(), stop_name->second));
+
+		return true;
+	});
+
+	return true;
+}
+
+bool RailRouting::FindReachable(const std::string& name, double max_distance, FindReachableResult& result) const {
+	return FindReachable(ThreadContext(), name, max_distance, result);
+}
+
+void RailRouting::FindReachable(const std::vector<std::string>& names, double max_distance, std::vector<FindReachableResult>& results) const {
+	results.resize(names.size());
+
+	ParallelFor(names.size(), GetThreads(), [&](size_t nname) {
+		FindReachable(names[nname], max_distance, results[nname]);
+	});
+}
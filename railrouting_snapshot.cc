@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <stdexcept>
+
+#include "railrouting.hh"
+
+namespace {
+
+const char snapshot_magic[] = "RAILSNAP";
+
+/* bump on any change of snapshot layout */
+const uint32_t snapshot_version = 7;
+
+enum SnapshotSection {
+	ROUTE_NODE_IDS = 1,
+	EDGE_OFFSETS,
+	EDGE_TARGETS,
+	EDGE_LENGTHS,
+	EDGE_INFO,
+	STRINGS,
+	STOPS,
+	STOP_NAMES,
+	EDGE_POLYLINES,
+	EDGE_POINTS,
+	ROUTE_NODE_POS,
+	REV_EDGE_OFFSETS,
+	REV_EDGE_SOURCES,
+	REV_EDGE_LENGTHS,
+	TRACK_CELLS,
+	TRACK_SEGMENTS,
+	TRACK_SEGMENT_EDGES,
+	TRACK_SEGMENT_POSITIONS,
+	TRACK_SEGMENT_OFFSETS,
+	/* contraction hierarchy, optional */
+	CH_UP_OFFSETS,
+	CH_UP_TARGETS,
+	CH_UP_LENGTHS,
+	CH_UP_ARCS,
+	CH_DOWN_OFFSETS,
+	CH_DOWN_SOURCES,
+	CH_DOWN_LENGTHS,
+	CH_DOWN_ARCS,
+	CH_SHORTCUTS,
+	/* landmarks, optional */
+	LANDMARKS,
+	LANDMARK_FROM,
+	LANDMARK_TO,
+};
+
+struct SnapshotStop {
+	uint32_t name_offset;
+	uint32_t name_length;
+	int32_t node;
+};
+
+SnapshotStop MakeSnapshotStop(std::string& strings, const std::string& name, int node) {
+	SnapshotStop stop = { (uint32_t)strings.size(), (uint32_t)name.size(), node };
+	strings += name;
+	return stop;
+}
+
+/* checks that CSR adjacency arrays are consistent */
+void CheckAdjacency(const uint32_t* offsets, size_t noffsets, const uint32_t* neighbours, size_t nedges, size_t nnodes) {
+	if (noffsets != nnodes + 1)
+		throw std::runtime_error("graph arrays size mismatch");
+	if (offsets[0] != 0 || offsets[nnodes] != nedges)
+		throw std::runtime_error("bad edge offsets");
+	for (size_t i = 0; i < nnodes; ++i)
+		if (offsets[i] > offsets[i + 1])
+			throw std::runtime_error("bad edge offsets");
+	for (size_t i = 0; i < nedges; ++i)
+		if (neighbours[i] >= nnodes)
+			throw std::runtime_error("bad edge target");
+}
+
+}
+
+void RailRouting::SaveSnapshot(const std::string& filename) const {
+	/* stops and stop names, with names in common string pool */
+	std::string strings;
+
+	std::vector<SnapshotStop> stops;
+	stops.reserve(stops_.size());
+	for (StopMap::const_iterator stop = stops_.begin(); stop != stops_.end(); ++stop)
+		stops.push_back(MakeSnapshotStop(strings, stop->first, stop->second));
+
+	std::vector<SnapshotStop> stop_names;
+	stop_names.reserve(stop_names_.size());
+	for (StopNameMap::const_iterator stop = stop_names_.begin(); stop != stop_names_.end(); ++stop)
+		stop_names.push_back(MakeSnapshotStop(strings, stop->second, stop->first));
+
+	SnapshotWriter writer(snapshot_magic, snapshot_version);
+
+	/* graph arrays are stored in their in-memory layout */
+	writer.AddSection(ROUTE_NODE_IDS, route_node_ids_.data(), route_node_ids_.size() * sizeof(osmid_t));
+	writer.AddSection(EDGE_OFFSETS, edge_offsets_.data(), edge_offsets_.size() * sizeof(uint32_t));
+	writer.AddSection(EDGE_TARGETS, edge_targets_.data(), edge_targets_.size() * sizeof(uint32_t));
+	writer.AddSection(EDGE_LENGTHS, edge_lengths_.data(), edge_lengths_.size() * sizeof(double));
+	writer.AddSection(EDGE_INFO, edge_info_.data(), edge_info_.size() * sizeof(EdgeInfo));
+	writer.AddSection(REV_EDGE_OFFSETS, rev_edge_offsets_.data(), rev_edge_offsets_.size() * sizeof(uint32_t));
+	writer.AddSection(REV_EDGE_SOURCES, rev_edge_sources_.data(), rev_edge_sources_.size() * sizeof(uint32_t));
+	writer.AddSection(REV_EDGE_LENGTHS, rev_edge_lengths_.data(), rev_edge_lengths_.size() * sizeof(double));
+	writer.AddSection(STRINGS, strings.data(), strings.size());
+	writer.AddSection(STOPS, stops);
+	writer.AddSection(STOP_NAMES, stop_names);
+	writer.AddSection(EDGE_POLYLINES, edge_polylines_.data(), edge_polylines_.size() * sizeof(EdgePolyline));
+	writer.AddSection(EDGE_POINTS, edge_points_.data(), edge_points_.size() * sizeof(RoutePoint));
+	writer.AddSection(ROUTE_NODE_POS, route_node_pos_.data(), route_node_pos_.size() * sizeof(LonLat));
+	writer.AddSection(TRACK_CELLS, track_grid_.cells().data(), track_grid_.cells().size() * sizeof(segment_grid::Cell));
+	writer.AddSection(TRACK_SEGMENTS, track_grid_.segments().data(), track_grid_.segments().size() * sizeof(segment_grid::Segment));
+	writer.AddSection(TRACK_SEGMENT_EDGES, track_segment_edges_.data(), track_segment_edges_.size() * sizeof(uint32_t));
+	writer.AddSection(TRACK_SEGMENT_POSITIONS, track_segment_positions_.data(), track_segment_positions_.size() * sizeof(uint16_t));
+	writer.AddSection(TRACK_SEGMENT_OFFSETS, track_segment_offsets_.data(), track_segment_offsets_.size() * sizeof(double));
+
+	if (!ch_up_offsets_.empty()) {
+		writer.AddSection(CH_UP_OFFSETS, ch_up_offsets_.data(), ch_up_offsets_.size() * sizeof(uint32_t));
+		writer.AddSection(CH_UP_TARGETS, ch_up_targets_.data(), ch_up_targets_.size() * sizeof(uint32_t));
+		writer.AddSection(CH_UP_LENGTHS, ch_up_lengths_.data(), ch_up_lengths_.size() * sizeof(double));
+		writer.AddSection(CH_UP_ARCS, ch_up_arcs_.data(), ch_up_arcs_.size() * sizeof(uint32_t));
+		writer.AddSection(CH_DOWN_OFFSETS, ch_down_offsets_.data(), ch_down_offsets_.size() * sizeof(uint32_t));
+		writer.AddSection(CH_DOWN_SOURCES, ch_down_sources_.data(), ch_down_sources_.size() * sizeof(uint32_t));
+		writer.AddSection(CH_DOWN_LENGTHS, ch_down_lengths_.data(), ch_down_lengths_.size() * sizeof(double));
+		writer.AddSection(CH_DOWN_ARCS, ch_down_arcs_.data(), ch_down_arcs_.size() * sizeof(uint32_t));
+		writer.AddSection(CH_SHORTCUTS, ch_shortcuts_.data(), ch_shortcuts_.size() * sizeof(ShortcutInfo));
+	}
+
+	if (!landmarks_.empty()) {
+		writer.AddSection(LANDMARKS, landmarks_.data(), landmarks_.size() * sizeof(uint32_t));
+		writer.AddSection(LANDMARK_FROM, landmark_from_.data(), landmark_from_.size() * sizeof(float));
+		writer.AddSection(LANDMARK_TO, landmark_to_.data(), landmark_to_.size() * sizeof(float));
+	}
+
+	writer.Write(filename);
+}
+
+void RailRouting::LoadSnapshot(const std::string& filename) {
+	Clear();
+
+	try {
+		snapshot_.Open(filename, snapshot_magic, snapshot_version);
+
+		size_t nnodes, noffsets, nedges, nlengths, ninfo, nrev_offsets, nrev_edges, nrev_lengths, nstrings, nstops, nstop_names, npolylines, npoints, nnode_pos;
+
+		const osmid_t* node_ids = snapshot_.GetArray<osmid_t>(ROUTE_NODE_IDS, nnodes);
+		const uint32_t* edge_offsets = snapshot_.GetArray<uint32_t>(EDGE_OFFSETS, noffsets);
+		const uint32_t* edge_targets = snapshot_.GetArray<uint32_t>(EDGE_TARGETS, nedges);
+		const double* edge_lengths = snapshot_.GetArray<double>(EDGE_LENGTHS, nlengths);
+		const EdgeInfo* edge_info = snapshot_.GetArray<EdgeInfo>(EDGE_INFO, ninfo);
+		const uint32_t* rev_edge_offsets = snapshot_.GetArray<uint32_t>(REV_EDGE_OFFSETS, nrev_offsets);
+		const uint32_t* rev_edge_sources = snapshot_.GetArray<uint32_t>(REV_EDGE_SOURCES, nrev_edges);
+		const double* rev_edge_lengths = snapshot_.GetArray<double>(REV_EDGE_LENGTHS, nrev_lengths);
+		const char* strings = snapshot_.GetArray<char>(STRINGS, nstrings);
+		const SnapshotStop* stops = snapshot_.GetArray<SnapshotStop>(STOPS, nstops);
+		const SnapshotStop* stop_names = snapshot_.GetArray<SnapshotStop>(STOP_NAMES, nstop_names);
+		const EdgePolyline* polylines = snapshot_.GetArray<EdgePolyline>(EDGE_POLYLINES, npolylines);
+		const RoutePoint* points = snapshot_.GetArray<RoutePoint>(EDGE_POINTS, npoints);
+		const LonLat* node_pos = snapshot_.GetArray<LonLat>(ROUTE_NODE_POS, nnode_pos);
+
+		/* graph is used right in the mapping, but is checked first,
+		 * so a corrupt file can't make searches go out of bounds */
+		if (nnode_pos != nnodes || nlengths != nedges || ninfo != nedges || nrev_edges != nedges || nrev_lengths != nedges || npolylines != nedges)
+			throw std::runtime_error("graph arrays size mismatch");
+		CheckAdjacency(edge_offsets, noffsets, edge_targets, nedges, nnodes);
+		CheckAdjacency(rev_edge_offsets, nrev_offsets, rev_edge_sources, nrev_edges, nnodes);
+
+		route_node_ids_.assign(node_ids, nnodes);
+		route_node_pos_.assign(node_pos, nnode_pos);
+		edge_offsets_.assign(edge_offsets, noffsets);
+		edge_targets_.assign(edge_targets, nedges);
+		edge_lengths_.assign(edge_lengths, nlengths);
+		edge_info_.assign(edge_info, ninfo);
+		rev_edge_offsets_.assign(rev_edge_offsets, nrev_offsets);
+		rev_edge_sources_.assign(rev_edge_sources, nrev_edges);
+		rev_edge_lengths_.assign(rev_edge_lengths, nrev_lengths);
+
+		for (size_t i = 0; i < nstops + nstop_names; ++i) {
+			const SnapshotStop& stop = i < nstops ? stops[i] : stop_names[i - nstops];
+			if (stop.name_offset > nstrings || stop.name_length > nstrings - stop.name_offset || stop.node < 0 || (size_t)stop.node >= nnodes)
+				throw std::runtime_error("bad stop reference");
+
+			std::string name(strings + stop.name_offset, stop.name_length);
+			if (i < nstops)
+				stops_.insert(stops_.end(), std::make_pair(name, stop.node));
+			else
+				stop_names_.insert(std::make_pair(stop.node, name));
+		}
+
+		BuildStationIndex();
+
+		/* edge geometry must have as many segments as the edge */
+		for (size_t i = 0; i < npolylines; ++i) {
+			const EdgePolyline& polyline = polylines[i];
+			const uint32_t nsegments = polyline.first < polyline.last ? polyline.last - polyline.first : polyline.first - polyline.last;
+			if (polyline.first >= npoints || polyline.last >= npoints || nsegments != (uint32_t)EdgeSegments(i))
+				throw std::runtime_error("bad edge geometry");
+		}
+
+		edge_polylines_.assign(polylines, npolylines);
+		edge_points_.assign(points, npoints);
+
+		size_t ntrack_cells, ntrack_entries, ntrack_segments, ntrack_positions, ntrack_offsets;
+
+		const segment_grid::Cell* track_cells = snapshot_.GetArray<segment_grid::Cell>(TRACK_CELLS, ntrack_cells);
+		const segment_grid::Segment* track_entries = snapshot_.GetArray<segment_grid::Segment>(TRACK_SEGMENTS, ntrack_entries);
+		const uint32_t* track_segment_edges = snapshot_.GetArray<uint32_t>(TRACK_SEGMENT_EDGES, ntrack_segments);
+		const uint16_t* track_segment_positions = snapshot_.GetArray<uint16_t>(TRACK_SEGMENT_POSITIONS, ntrack_positions);
+		const double* track_segment_offsets = snapshot_.GetArray<double>(TRACK_SEGMENT_OFFSETS, ntrack_offsets);
+
+		if (ntrack_positions != ntrack_segments || ntrack_offsets != ntrack_segments)
+			throw std::runtime_error("track index arrays size mismatch");
+		for (size_t i = 0; i < ntrack_entries; ++i)
+			if (track_entries[i].id >= ntrack_segments)
+				throw std::runtime_error("bad track segment");
+		for (size_t i = 0; i < ntrack_segments; ++i)
+			if (track_segment_edges[i] >= nedges || track_segment_positions[i] >= EdgeSegments(track_segment_edges[i]))
+				throw std::runtime_error("bad track segment edge");
+
+		track_grid_.assign(track_cells, ntrack_cells, track_entries, ntrack_entries);
+		track_segment_edges_.assign(track_segment_edges, ntrack_segments);
+		track_segment_positions_.assign(track_segment_positions, ntrack_positions);
+		track_segment_offsets_.assign(track_segment_offsets, ntrack_offsets);
+
+		if (snapshot_.HasSection(CH_UP_OFFSETS)) {
+			size_t nup_offsets, nup_arcs, nup_lengths, nup_ids, ndown_offsets, ndown_arcs, ndown_lengths, ndown_ids, nshortcuts;
+
+			const uint32_t* up_offsets = snapshot_.GetArray<uint32_t>(CH_UP_OFFSETS, nup_offsets);
+			const uint32_t* up_targets = snapshot_.GetArray<uint32_t>(CH_UP_TARGETS, nup_arcs);
+			const double* up_lengths = snapshot_.GetArray<double>(CH_UP_LENGTHS, nup_lengths);
+			const uint32_t* up_arcs = snapshot_.GetArray<uint32_t>(CH_UP_ARCS, nup_ids);
+			const uint32_t* down_offsets = snapshot_.GetArray<uint32_t>(CH_DOWN_OFFSETS, ndown_offsets);
+			const uint32_t* down_sources = snapshot_.GetArray<uint32_t>(CH_DOWN_SOURCES, ndown_arcs);
+			const double* down_lengths = snapshot_.GetArray<double>(CH_DOWN_LENGTHS, ndown_lengths);
+			const uint32_t* down_arcs = snapshot_.GetArray<uint32_t>(CH_DOWN_ARCS, ndown_ids);
+			const ShortcutInfo* shortcuts = snapshot_.GetArray<ShortcutInfo>(CH_SHORTCUTS, nshortcuts);
+
+			if (nup_lengths != nup_arcs || nup_ids != nup_arcs || ndown_lengths != ndown_arcs || ndown_ids != ndown_arcs)
+				throw std::runtime_error("hierarchy arrays size mismatch");
+			CheckAdjacency(up_offsets, nup_offsets, up_targets, nup_arcs, nnodes);
+			CheckAdjacency(down_offsets, ndown_offsets, down_sources, ndown_arcs, nnodes);
+
+			/* shortcuts may only refer to arcs created before them,
+			 * so unpacking them always terminates */
+			for (size_t i = 0; i < nup_ids + ndown_ids; ++i)
+				if ((i < nup_ids ? up_arcs[i] : down_arcs[i - nup_ids]) >= nedges + nshortcuts)
+					throw std::runtime_error("bad hierarchy arc");
+			for (size_t i = 0; i < nshortcuts; ++i)
+				if (shortcuts[i].first >= nedges + i || shortcuts[i].second >= nedges + i)
+					throw std::runtime_error("bad hierarchy shortcut");
+
+			ch_up_offsets_.assign(up_offsets, nup_offsets);
+			ch_up_targets_.assign(up_targets, nup_arcs);
+			ch_up_lengths_.assign(up_lengths, nup_lengths);
+			ch_up_arcs_.assign(up_arcs, nup_ids);
+			ch_down_offsets_.assign(down_offsets, ndown_offsets);
+			ch_down_sources_.assign(down_sources, ndown_arcs);
+			ch_down_lengths_.assign(down_lengths, ndown_lengths);
+			ch_down_arcs_.assign(down_arcs, ndown_ids);
+			ch_shortcuts_.assign(shortcuts, nshortcuts);
+		}
+
+		if (snapshot_.HasSection(LANDMARKS)) {
+			size_t nlandmarks, nfrom, nto;
+
+			const uint32_t* landmarks = snapshot_.GetArray<uint32_t>(LANDMARKS, nlandmarks);
+			const float* landmark_from = snapshot_.GetArray<float>(LANDMARK_FROM, nfrom);
+			const float* landmark_to = snapshot_.GetArray<float>(LANDMARK_TO, nto);
+
+			if (nfrom != nnodes * nlandmarks || nto != nnodes * nlandmarks)
+				throw std::runtime_error("landmark tables size mismatch");
+			for (size_t i = 0; i < nlandmarks; ++i)
+				if (landmarks[i] >= nnodes)
+					throw std::runtime_error("bad landmark");
+
+			landmarks_.assign(landmarks, nlandmarks);
+			landmark_from_.assign(landmark_from, nfrom);
+			landmark_to_.assign(landmark_to, nto);
+		}
+	} catch (std::runtime_error& e) {
+		Clear();
+		throw std::runtime_error(std::string("cannot load snapshot: ") + e.what());
+	}
+}
@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEGMENT_GRID_HH
+#define SEGMENT_GRID_HH
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "ObjectBases.hh"
+#include "frozen_array.hh"
+
+/**
+ * Uniform grid index of line segments for nearest segment lookup
+ *
+ * Segments are added to grid cells they cross. Only nonempty cells
+ * are stored, in open addressing hash table, so the grid may cover
+ * the whole planet and a cell is found in constant time. Lookup
+ * scans rings of cells around the point until no closer segment may
+ * be found. Distances are measured in local equirectangular
+ * projection, which is precise for distances much smaller than Earth
+ * radius. Segments and lookups crossing antimeridian take the shorter
+ * way around.
+ *
+ * Built index consists of two arrays of plain structures, which may
+ * be saved and later used in place, like other frozen arrays.
+ */
+class segment_grid {
+public:
+	struct Hit {
+		uint32_t id;
+
+		/* distance to segment in meters, closest point of segment
+		 * and its position along segment in [0, 1] */
+		double distance;
+		LonLat point;
+		double fraction;
+
+		Hit(uint32_t i, double d, const LonLat& p, double f) : id(i), distance(d), point(p), fraction(f) {
+		}
+
+		bool operator<(const Hit& other) const {
+			return id < other.id;
+		}
+	};
+
+	struct Segment {
+		osmint_t lon1;
+		osmint_t lat1;
+		osmint_t lon2;
+		osmint_t lat2;
+		uint32_t id;
+	};
+
+	/* hash table slot: segments of cell are [first, last) */
+	struct Cell {
+		uint64_t key;
+		uint32_t first;
+		uint32_t last;
+	};
+
+private:
+	/* cell side, 1/64 degree in OSM coordinate units */
+	static const osmint_t cell_size_ = 156250;
+	static const int32_t cell_bias_ = 32768;
+
+	/* full circle of longitude, in OSM coordinate units and cells */
+	static const int64_t circle_ = 3600000000LL;
+	static const int32_t circle_cells_ = 360 * 64;
+	static const uint64_t empty_key_ = ~(uint64_t)0;
+
+	typedef std::vector<std::pair<uint64_t, Segment> > PendingVector;
+
+private:
+	frozen_array<Cell> cells_;
+	frozen_array<Segment> segments_;
+	uint64_t cell_mask_;
+
+	PendingVector pending_;
+
+private:
+	static int32_t CellOf(int64_t coord) {
+		return (coord >= 0 ? coord / cell_size_ : (coord - cell_size_ + 1) / cell_size_) + cell_bias_;
+	}
+
+	/* lower border of cell, in OSM coordinate units */
+	static int64_t CellStart(int32_t cell) {
+		return (int64_t)(cell - cell_bias_) * cell_size_;
+	}
+
+	/* brings longitude cell into [-180, 180) */
+	static int32_t WrapCell(int32_t x) {
+		const int32_t first = CellOf(-circle_ / 2);
+		return first + ((x - first) % circle_cells_ + circle_cells_) % circle_cells_;
+	}
+
+	/* brings longitude difference into [-180, 180) */
+	static int64_t WrapDelta(int64_t delta) {
+		if (delta >= circle_ / 2)
+			return delta - circle_;
+		if (delta < -circle_ / 2)
+			return delta + circle_;
+		return delta;
+	}
+
+	static uint64_t Key(int32_t x, int32_t y) {
+		return ((uint64_t)(uint32_t)y << 32) | (uint32_t)x;
+	}
+
+	static uint64_t Hash(uint64_t key) {
+		return (key * 0x9e3779b97f4a7c15ULL) >> 20;
+	}
+
+	static double MetersPerDegree() {
+		return 6378137.0 * M_PI / 180.0;
+	}
+
+	const Cell* FindCell(int32_t x, int32_t y) const {
+		const uint64_t key = Key(x, y);
+		for (uint64_t slot = Hash(key) & cell_mask_; ; slot = (slot + 1) & cell_mask_) {
+			if (cells_[slot].key == key)
+				return &cells_[slot];
+			if (cells_[slot].key == empty_key_)
+				return NULL;
+		}
+	}
+
+	/* checks segments of cell, keeping ones which may be within
+	 * tolerance from the closest one */
+	void ScanCell(int32_t x, int32_t y, const LonLat& pos, double kx, double ky, double max_distance, double tolerance, double& best, std::vector<Hit>& hits) const {
+		const Cell* cell = FindCell(x, y);
+		if (cell == NULL)
+			return;
+
+		for (uint32_t nsegment = cell->first; nsegment < cell->last; ++nsegment) {
+			const Segment& segment = segments_[nsegment];
+
+			/* coordinates relative to the point, in meters */
+			const int64_t dlon = WrapDelta((int64_t)segment.lon2 - segment.lon1);
+			const double ax = WrapDelta((int64_t)segment.lon1 - pos.GetLonI()) * kx;
+			const double ay = ((int64_t)segment.lat1 - pos.GetLatI()) * ky;
+			const double dx = dlon * kx;
+			const double dy = ((int64_t)segment.lat2 - segment.lat1) * ky;
+
+			const double length2 = dx * dx + dy * dy;
+			double fraction = length2 > 0.0 ? -(ax * dx + ay * dy) / length2 : 0.0;
+			fraction = std::max(0.0, std::min(1.0, fraction));
+
+			const double px = ax + dx * fraction;
+			const double py = ay + dy * fraction;
+			const double distance = std::sqrt(px * px + py * py);
+
+			if (distance > max_distance || distance > best + tolerance)
+				continue;
+
+			best = std::min(best, distance);
+
+			int64_t lon = segment.lon1 + (int64_t)std::floor(dlon * fraction + 0.5);
+			if (lon > circle_ / 2 || lon < -circle_ / 2)
+				lon = WrapDelta(lon);
+
+			LonLat point(
+				(osmint_t)lon,
+				segment.lat1 + (osmint_t)std::floor(((int64_t)segment.lat2 - segment.lat1) * fraction + 0.5)
+			);
+			hits.push_back(Hit(segment.id, distance, point, fraction));
+		}
+	}
+
+public:
+	segment_grid() : cell_mask_(0) {
+	}
+
+	void Add(const LonLat& a, const LonLat& b, uint32_t id) {
+		Segment segment = { a.GetLonI(), a.GetLatI(), b.GetLonI(), b.GetLatI(), id };
+
+		/* walk cells crossed by segment: step into the next cell by
+		 * x or y, whichever border the segment crosses first; end
+		 * longitude may be out of [-180, 180] if segment crosses
+		 * antimeridian, cells are wrapped when stored */
+		const int64_t x0 = a.GetLonI(), y0 = a.GetLatI();
+		const int64_t dx = WrapDelta((int64_t)b.GetLonI() - a.GetLonI());
+		const int64_t dy = (int64_t)b.GetLatI() - a.GetLatI();
+
+		const int32_t step_x = dx > 0 ? 1 : -1, step_y = dy > 0 ? 1 : -1;
+		const int32_t end_x = CellOf(x0 + dx), end_y = CellOf(y0 + dy);
+
+		/* differences are below 2^32, so their products fit */
+		const uint64_t adx = dx > 0 ? dx : -dx, ady = dy > 0 ? dy : -dy;
+
+		int32_t x = CellOf(x0), y = CellOf(y0);
+		pending_.push_back(std::make_pair(Key(WrapCell(x), y), segment));
+		while (x != end_x || y != end_y) {
+			/* distances along axes to the next borders; segment
+			 * crosses them at fractions next_x / adx, next_y / ady */
+			const uint64_t next_x = step_x > 0 ? CellStart(x + 1) - x0 : x0 - CellStart(x);
+			const uint64_t next_y = step_y > 0 ? CellStart(y + 1) - y0 : y0 - CellStart(y);
+
+			const uint64_t tx = x == end_x ? ~(uint64_t)0 : next_x * ady;
+			const uint64_t ty = y == end_y ? ~(uint64_t)0 : next_y * adx;
+
+			if (tx == ty) {
+				/* through the corner: add both side cells, so
+				 * lookups near the corner need not be exact */
+				pending_.push_back(std::make_pair(Key(WrapCell(x + step_x), y), segment));
+				pending_.push_back(std::make_pair(Key(WrapCell(x), y + step_y), segment));
+				x += step_x;
+				y += step_y;
+			} else if (tx < ty) {
+				x += step_x;
+			} else {
+				y += step_y;
+			}
+			pending_.push_back(std::make_pair(Key(WrapCell(x), y), segment));
+		}
+	}
+
+	/**
+	 * Builds index from added segments, must be called before lookups
+	 */
+	void Finalize() {
+		std::stable_sort(pending_.begin(), pending_.end(), [](const PendingVector::value_type& a, const PendingVector::value_type& b) {
+			return a.first < b.first;
+		});
+
+		size_t ncells = 0;
+		for (size_t i = 0; i < pending_.size(); ++i)
+			if (i == 0 || pending_[i].first != pending_[i - 1].first)
+				ncells++;
+
+		/* table is at most two thirds full */
+		size_t nslots = 1;
+		while (nslots < ncells * 3 / 2)
+			nslots *= 2;
+
+		const Cell empty = { empty_key_, 0, 0 };
+		std::vector<Cell> cells(nslots, empty);
+
+		std::vector<Segment> segments;
+		segments.reserve(pending_.size());
+
+		for (size_t i = 0; i < pending_.size(); ) {
+			const uint64_t key = pending_[i].first;
+
+			uint64_t slot = Hash(key) & (nslots - 1);
+			while (cells[slot].key != empty_key_)
+				slot = (slot + 1) & (nslots - 1);
+
+			cells[slot].key = key;
+			cells[slot].first = segments.size();
+			for (; i < pending_.size() && pending_[i].first == key; ++i)
+				segments.push_back(pending_[i].second);
+			cells[slot].last = segments.size();
+		}
+
+		PendingVector().swap(pending_);
+
+		cells_.assign(cells);
+		segments_.assign(segments);
+		cell_mask_ = nslots - 1;
+	}
+
+	/**
+	 * Uses previously built index arrays, which must outlive it
+	 */
+	void assign(const Cell* cells, size_t ncells, const Segment* segments, size_t nsegments) {
+		/* table size must be power of two, and lookups only end on
+		 * empty slots */
+		if (ncells & (ncells - 1))
+			throw std::runtime_error("bad segment grid size");
+
+		bool has_empty = ncells == 0;
+		for (size_t i = 0; i < ncells; ++i) {
+			if (cells[i].key == empty_key_)
+				has_empty = true;
+			else if (cells[i].first > cells[i].last || cells[i].last > nsegments)
+				throw std::runtime_error("bad segment grid cell");
+		}
+		if (!has_empty)
+			throw std::runtime_error("bad segment grid cell");
+
+		cells_.assign(cells, ncells);
+		segments_.assign(segments, nsegments);
+		cell_mask_ = ncells - 1;
+	}
+
+	const frozen_array<Cell>& cells() const {
+		return cells_;
+	}
+
+	const frozen_array<Segment>& segments() const {
+		return segments_;
+	}
+
+	void clear() {
+		cells_.clear();
+		segments_.clear();
+		cell_mask_ = 0;
+		pending_.clear();
+	}
+
+	/**
+	 * Finds segments closest to the point within max_distance
+	 * meters; all segments not farther than closest one plus
+	 * tolerance are returned, each once, ordered by id
+	 */
+	bool FindNearest(const LonLat& pos, double max_distance, double tolerance, std::vector<Hit>& hits) const {
+		hits.clear();
+		if (cells_.empty())
+			return false;
+
+		const double ky = MetersPerDegree() / 10000000.0;
+		const double kx = ky * std::cos(pos.GetLatD() / 180.0 * M_PI);
+
+		const int32_t x = CellOf(pos.GetLonI());
+		const int32_t y = CellOf(pos.GetLatI());
+
+		/* distances from the point to borders of its cell */
+		const osmint_t in_x = pos.GetLonI() - (osmint_t)((int64_t)(x - cell_bias_) * cell_size_);
+		const osmint_t in_y = pos.GetLatI() - (osmint_t)((int64_t)(y - cell_bias_) * cell_size_);
+		const double gap_x = std::min(in_x, cell_size_ - in_x);
+		const double gap_y = std::min(in_y, cell_size_ - in_y);
+
+		/* rings which may have segments within max_distance: beyond
+		 * them the scanned square covers it both in latitude and, in
+		 * the projection used, in longitude, or the whole circle of
+		 * longitude is scanned */
+		const double max_ring_y = max_distance / (cell_size_ * ky) + 1.0;
+		const double max_ring_x = kx > 0.0 ? max_distance / (cell_size_ * kx) + 1.0 : circle_cells_;
+		const int32_t max_ring = (int32_t)std::min(std::max(max_ring_x, max_ring_y), circle_cells_ / 2.0);
+
+		double best = max_distance;
+		for (int32_t ring = 0; ; ++ring) {
+			if (ring == 0) {
+				ScanCell(WrapCell(x), y, pos, kx, ky, max_distance, tolerance, best, hits);
+			} else {
+				for (int32_t i = -ring; i <= ring; ++i) {
+					ScanCell(WrapCell(x + i), y - ring, pos, kx, ky, max_distance, tolerance, best, hits);
+					ScanCell(WrapCell(x + i), y + ring, pos, kx, ky, max_distance, tolerance, best, hits);
+				}
+				for (int32_t i = -ring + 1; i < ring; ++i) {
+					ScanCell(WrapCell(x - ring), y + i, pos, kx, ky, max_distance, tolerance, best, hits);
+					ScanCell(WrapCell(x + ring), y + i, pos, kx, ky, max_distance, tolerance, best, hits);
+				}
+			}
+
+			/* all segments closer than border of scanned square are
+			 * already seen; distances are measured in the projection
+			 * at the point latitude, so it scales longitude for all
+			 * rows alike */
+			const double covered = std::min((gap_x + ring * cell_size_) * kx, (gap_y + ring * cell_size_) * ky);
+			if (covered >= best + tolerance || covered >= max_distance || ring >= max_ring)
+				break;
+		}
+
+		/* filter out segments found before closer ones, and
+		 * duplicates from segments spanning several cells */
+		size_t nkept = 0;
+		for (size_t nhit = 0; nhit < hits.size(); ++nhit)
+			if (hits[nhit].distance <= best + tolerance)
+				hits[nkept++] = hits[nhit];
+		hits.erase(hits.begin() + nkept, hits.end());
+
+		std::sort(hits.begin(), hits.end());
+		nkept = 0;
+		for (size_t nhit = 0; nhit < hits.size(); ++nhit)
+			if (nkept == 0 || hits[nkept - 1].id != hits[nhit].id)
+				hits[nkept++] = hits[nhit];
+		hits.erase(hits.begin() + nkept, hits.end());
+
+		return !hits.empty();
+	}
+
+	size_t size() const {
+		return segments_.size();
+	}
+};
+
+#endif
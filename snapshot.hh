@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNAPSHOT_HH
+#define SNAPSHOT_HH
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "mappedfile.hh"
+
+/**
+ * Snapshot file: versioned set of binary sections, laid out so
+ * they may be used directly from read-only memory mapping
+ *
+ * File starts with a header and a table of sections, each section
+ * is aligned to 64 bytes. Data is stored in native byte order,
+ * which is checked on load.
+ */
+class SnapshotFile {
+protected:
+	static const size_t alignment_ = 64;
+	static const uint32_t byte_order_mark_ = 0x01020304;
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t byte_order;
+		uint32_t nsections;
+		uint32_t reserved;
+	};
+
+	struct SectionEntry {
+		uint32_t id;
+		uint32_t reserved;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	static size_t Align(size_t offset) {
+		return (offset + alignment_ - 1) / alignment_ * alignment_;
+	}
+};
+
+class SnapshotWriter : public SnapshotFile {
+private:
+	struct Section {
+		uint32_t id;
+		const void* data;
+		size_t size;
+
+		Section(uint32_t i, const void* d, size_t s) : id(i), data(d), size(s) {
+		}
+	};
+
+	typedef std::vector<Section> SectionVector;
+
+private:
+	const std::string magic_;
+	const uint32_t version_;
+
+	SectionVector sections_;
+
+private:
+	static void WriteAll(int fd, const void* data, size_t size) {
+		const char* cur = static_cast<const char*>(data);
+		while (size > 0) {
+			ssize_t written = write(fd, cur, size);
+			if (written < 0)
+				throw std::runtime_error("snapshot write error");
+			cur += written;
+			size -= written;
+		}
+	}
+
+public:
+	SnapshotWriter(const std::string& magic, uint32_t version) : magic_(magic), version_(version) {
+	}
+
+	/* adds section; data must stay valid until Write() */
+	void AddSection(uint32_t id, const void* data, size_t size) {
+		sections_.push_back(Section(id, data, size));
+	}
+
+	template<class T>
+	void AddSection(uint32_t id, const std::vector<T>& data) {
+		AddSection(id, data.data(), data.size() * sizeof(T));
+	}
+
+	/* writes snapshot into temporary file, then atomically renames it */
+	void Write(const std::string& filename) const {
+		std::string tempname = filename + ".tmp";
+
+		int fd = open(tempname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd == -1)
+			throw std::runtime_error("cannot create snapshot file");
+
+		try {
+			Header header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, magic_.data(), std::min(magic_.size(), sizeof(header.magic)));
+			header.version = version_;
+			header.byte_order = byte_order_mark_;
+			header.nsections = sections_.size();
+
+			std::vector<SectionEntry> table(sections_.size());
+			size_t offset = Align(sizeof(Header) + sizeof(SectionEntry) * sections_.size());
+			for (size_t i = 0; i < sections_.size(); ++i) {
+				memset(&table[i], 0, sizeof(SectionEntry));
+				table[i].id = sections_[i].id;
+				table[i].offset = offset;
+				table[i].size = sections_[i].size;
+				offset = Align(offset + sections_[i].size);
+			}
+
+			WriteAll(fd, &header, sizeof(header));
+			WriteAll(fd, table.data(), table.size() * sizeof(SectionEntry));
+
+			static const char padding[alignment_] = {};
+			size_t written = sizeof(Header) + sizeof(SectionEntry) * sections_.size();
+			for (size_t i = 0; i < sections_.size(); ++i) {
+				WriteAll(fd, padding, table[i].offset - written);
+				WriteAll(fd, sections_[i].data, sections_[i].size);
+				written = table[i].offset + sections_[i].size;
+			}
+
+			if (fsync(fd) != 0)
+				throw std::runtime_error("snapshot write error");
+		} catch (...) {
+			close(fd);
+			unlink(tempname.c_str());
+			throw;
+		}
+
+		close(fd);
+
+		if (rename(tempname.c_str(), filename.c_str()) != 0) {
+			unlink(tempname.c_str());
+			throw std::runtime_error("cannot rename snapshot file");
+		}
+	}
+};
+
+class SnapshotReader : public SnapshotFile {
+private:
+	MappedFile file_;
+
+	const SectionEntry* sections_;
+	size_t nsections_;
+
+public:
+	SnapshotReader() : sections_(NULL), nsections_(0) {
+	}
+
+	/* maps snapshot and checks its header; throws on any mismatch */
+	void Open(const std::string& filename, const std::string& magic, uint32_t version) {
+		Close();
+
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd == -1)
+			throw std::runtime_error("cannot open snapshot file");
+
+		bool mapped = file_.Map(fd, MADV_WILLNEED);
+		close(fd);
+
+		if (!mapped || file_.size() < sizeof(Header))
+			throw std::runtime_error("cannot map snapshot file");
+
+		const Header* header = reinterpret_cast<const Header*>(file_.data());
+		if (strncmp(header->magic, magic.c_str(), sizeof(header->magic)) != 0)
+			throw std::runtime_error("not a snapshot file");
+		if (header->byte_order != byte_order_mark_)
+			throw std::runtime_error("snapshot byte order mismatch");
+		if (header->version != version)
+			throw std::runtime_error("snapshot version mismatch");
+		if (file_.size() < sizeof(Header) + sizeof(SectionEntry) * header->nsections)
+			throw std::runtime_error("truncated snapshot file");
+
+		sections_ = reinterpret_cast<const SectionEntry*>(file_.data() + sizeof(Header));
+		nsections_ = header->nsections;
+
+		for (size_t i = 0; i < nsections_; ++i) {
+			if (sections_[i].offset > file_.size() || sections_[i].size > file_.size() - sections_[i].offset)
+				throw std::runtime_error("truncated snapshot file");
+			/* sections are used in place as arrays, which needs them
+			 * aligned; mapping itself is page aligned */
+			if (sections_[i].offset % alignment_ != 0)
+				throw std::runtime_error("misaligned snapshot section");
+		}
+	}
+
+	void Close() {
+		file_.Unmap();
+		sections_ = NULL;
+		nsections_ = 0;
+	}
+
+	bool HasSection(uint32_t id) const {
+		for (size_t i = 0; i < nsections_; ++i)
+			if (sections_[i].id == id)
+				return true;
+		return false;
+	}
+
+	/* returns section as array of T; throws if it is missing or malformed */
+	template<class T>
+	const T* GetArray(uint32_t id, size_t& count) const {
+		for (size_t i = 0; i < nsections_; ++i) {
+			if (sections_[i].id == id) {
+				if (sections_[i].size % sizeof(T) != 0)
+					throw std::runtime_error("malformed snapshot section");
+				count = sections_[i].size / sizeof(T);
+				return reinterpret_cast<const T*>(file_.data() + sections_[i].offset);
+			}
+		}
+		throw std::runtime_error("missing snapshot section");
+	}
+};
+
+#endif
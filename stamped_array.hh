@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STAMPED_ARRAY_HH
+#define STAMPED_ARRAY_HH
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <stdint.h>
+
+/**
+ * Array which may be reset to default value in O(1)
+ *
+ * Each element is stamped with generation in which it was last
+ * written, and elements with older stamps read as default value.
+ * Reset just advances the generation, and only clears stamps when
+ * generation counter wraps around. Like lazyinit_array, element
+ * accessed through non-const reference is initialized.
+ */
+template <typename T>
+class stamped_array {
+private:
+	struct Entry {
+		uint32_t stamp;
+		T value;
+	};
+
+private:
+	/* stamps and values are interleaved, so accessing an element
+	 * touches a single cache line */
+	std::vector<Entry> entries_;
+	uint32_t generation_;
+	T default_;
+
+public:
+	stamped_array(T def) : generation_(1), default_(def) {
+	}
+
+	/* makes all elements default, resizing array if needed */
+	void reset(size_t size) {
+		if (size != entries_.size()) {
+			Entry entry = { 0, default_ };
+			entries_.assign(size, entry);
+			generation_ = 1;
+		} else if (++generation_ == 0) {
+			for (typename std::vector<Entry>::iterator entry = entries_.begin(); entry != entries_.end(); ++entry)
+				entry->stamp = 0;
+			generation_ = 1;
+		}
+	}
+
+	T& operator[](size_t n) {
+		Entry& entry = entries_[n];
+		if (entry.stamp != generation_) {
+			entry.stamp = generation_;
+			entry.value = default_;
+		}
+		return entry.value;
+	}
+
+	const T& operator[](size_t n) const {
+		const Entry& entry = entries_[n];
+		return entry.stamp == generation_ ? entry.value : default_;
+	}
+
+	size_t size() const {
+		return entries_.size();
+	}
+};
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2012 Dmitry Marakasov
+ *
+ * This file is part of rail routing demo.
+ *
+ * rail routing demo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rail routing demo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rail routing demo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STRINGTABLE_HH
+#define STRINGTABLE_HH
+
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <stdint.h>
+
+/* Id of interned string; 0 is never used for valid string */
+typedef uint32_t strid_t;
+
+/**
+ * Global table of interned strings
+ *
+ * Each distinct string is stored once and identified by integer
+ * id, so strings may be compared by comparing ids. Strings are
+ * never freed.
+ *
+ * Table is split into shards by string hash, each with its own
+ * lock, so it may be populated from multiple threads. Lookup of
+ * string by id does not lock, as ids may only be obtained after
+ * the string is stored.
+ */
+class StringTable {
+private:
+	static const int shard_bits_ = 6;
+	static const int nshards_ = 1 << shard_bits_;
+
+	static const int block_bits_ = 16;
+	static const size_t block_size_ = 1 << block_bits_;
+	static const size_t max_blocks_ = 1 << (32 - shard_bits_ - block_bits_);
+
+	static const size_t arena_size_ = 1024 * 1024;
+
+	struct Key {
+		const char* data;
+		size_t length;
+
+		Key(const char* d, size_t l) : data(d), length(l) {
+		}
+
+		bool operator==(const Key& other) const {
+			return length == other.length && memcmp(data, other.data, length) == 0;
+		}
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key& key) const {
+			return Hash(key.data, key.length);
+		}
+	};
+
+	typedef std::unordered_map<Key, strid_t, KeyHash> IndexMap;
+
+	struct Shard {
+		std::mutex mutex;
+
+		IndexMap index;
+
+		/* strings by index, in fixed size blocks which never move */
+		const char** blocks[max_blocks_];
+		size_t count;
+
+		/* storage for string data */
+		std::vector<char*> arenas;
+		char* arena;
+		size_t arena_left;
+
+		Shard() : count(0), arena(NULL), arena_left(0) {
+			std::fill(blocks, blocks + max_blocks_, (const char**)NULL);
+		}
+
+		~Shard() {
+			for (size_t i = 0; i < max_blocks_; ++i)
+				delete[] blocks[i];
+			for (std::vector<char*>::iterator arena = arenas.begin(); arena != arenas.end(); ++arena)
+				delete[] *arena;
+		}
+
+		const char* Store(const char* data, size_t length) {
+			if (length + 1 > arena_left) {
+				size_t size = length + 1 > arena_size_ ? length + 1 : arena_size_;
+				arenas.push_back(new char[size]);
+				arena = arenas.back();
+				arena_left = size;
+			}
+
+			char* where = arena;
+			memcpy(where, data, length);
+			where[length] = '\0';
+
+			arena += length + 1;
+			arena_left -= length + 1;
+
+			return where;
+		}
+	};
+
+private:
+	Shard shards_[nshards_];
+
+private:
+	/* FNV-1a */
+	static size_t Hash(const char* data, size_t length) {
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < length; ++i) {
+			hash ^= (unsigned char)data[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	StringTable() {
+	}
+
+	StringTable(const StringTable&);
+	StringTable& operator=(const StringTable&);
+
+public:
+	static StringTable& Instance() {
+		static StringTable instance;
+		return instance;
+	}
+
+	/**
+	 * Returns id of given string, adding it to the table if needed
+	 */
+	strid_t Intern(const char* data, size_t length) {
+		size_t hash = Hash(data, length);
+		Shard& shard = shards_[(hash >> 32) % nshards_];
+
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		IndexMap::const_iterator found = shard.index.find(Key(data, length));
+		if (found != shard.index.end())
+			return found->second;
+
+		if (shard.count >= max_blocks_ * block_size_ - 1)
+			throw std::length_error("string table shard overflow");
+
+		size_t index = shard.count++;
+		if (shard.blocks[index >> block_bits_] == NULL)
+			shard.blocks[index >> block_bits_] = new const char*[block_size_];
+
+		const char* stored = shard.Store(data, length);
+		shard.blocks[index >> block_bits_][index & (block_size_ - 1)] = stored;
+
+		strid_t id = ((strid_t)(index + 1) << shard_bits_) | ((hash >> 32) % nshards_);
+		shard.index.insert(std::make_pair(Key(stored, length), id));
+
+		return id;
+	}
+
+	strid_t Intern(const char* str) {
+		return Intern(str, strlen(str));
+	}
+
+	strid_t Intern(const std::string& str) {
+		return Intern(str.data(), str.length());
+	}
+
+	/**
+	 * Returns id of given string, or 0 if it was never interned
+	 */
+	strid_t Find(const char* data, size_t length) {
+		size_t hash = Hash(data, length);
+		Shard& shard = shards_[(hash >> 32) % nshards_];
+
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		IndexMap::const_iterator found = shard.index.find(Key(data, length));
+		return found == shard.index.end() ? 0 : found->second;
+	}
+
+	strid_t Find(const std::string& str) {
+		return Find(str.data(), str.length());
+	}
+
+	/**
+	 * Returns interned string by id
+	 */
+	const char* Get(strid_t id) const {
+		size_t index = (id >> shard_bits_) - 1;
+		return shards_[id & (nshards_ - 1)].blocks[index >> block_bits_][index & (block_size_ - 1)];
+	}
+};
+
+#endif